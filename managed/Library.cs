@@ -12,9 +12,67 @@ public static class StringDeduper
         }
     }
 
+    public static void Initialize(StringDedupConfig config)
+    {
+        config.Size = (uint)Marshal.SizeOf(typeof(StringDedupConfig));
+        CreateCLRProfiling(out var instance);
+        if (InitializeStringDeduperWithConfig(@"StringDedupingProfiler.dll", typeof(string).TypeHandle.Value, ref config, instance) != 0)
+        {
+            throw new Exception("String deduping initialization failed. Currently works on WinX64 only. This library uses the Profiling API so ensure no other profiler is attached.");
+        }
+    }
+
+    /// <summary>
+    /// Changes the config while running. Settings that affect a pass apply from the next gen2 collection on; the worker count, memory limit,
+    /// heavy hitters, report mode, persistence and time budget once the runtime resumes after it.
+    /// </summary>
+    public static void Configure(StringDedupConfig config)
+    {
+        config.Size = (uint)Marshal.SizeOf(typeof(StringDedupConfig));
+        if (UpdateStringDedupConfig(ref config) != 0)
+        {
+            throw new InvalidOperationException("String deduping could not be configured. Call Initialize first.");
+        }
+    }
+
+    public static StringDedupStatistics GetStatistics()
+    {
+        var statistics = new StringDedupStatistics { Size = (uint)Marshal.SizeOf(typeof(StringDedupStatistics)) };
+        if (GetStringDedupStatistics(ref statistics) != 0)
+        {
+            throw new InvalidOperationException("String deduping statistics are unavailable. Call Initialize first.");
+        }
+
+        return statistics;
+    }
+
+    /// <summary>
+    /// Writes the managed heap to a snapshot file during the next deduping pass, before it changes anything. The file is as large as the
+    /// heap and the pass pauses the process while it is written. Snapshots are replayed by HeapSnapshotReplay in native/benchmarks.
+    /// </summary>
+    public static void CaptureSnapshot(string path)
+    {
+        if (CaptureStringDedupSnapshot(path) != 0)
+        {
+            throw new InvalidOperationException("String deduping could not capture a snapshot. Call Initialize first.");
+        }
+    }
+
     [DllImport("coreclr.dll")]
     private static extern int CreateCLRProfiling(out IntPtr instance);
 
     [DllImport(@"StringDedupingProfiler.dll")]
     private static extern int InitializeStringDeduper([MarshalAs(UnmanagedType.LPWStr)] string profilerPath, IntPtr stringTypeHandle, IntPtr instance);
+
+    [DllImport(@"StringDedupingProfiler.dll")]
+    private static extern int InitializeStringDeduperWithConfig([MarshalAs(UnmanagedType.LPWStr)] string profilerPath, IntPtr stringTypeHandle, ref StringDedupConfig config, IntPtr instance);
+
+    [DllImport(@"StringDedupingProfiler.dll")]
+    private static extern int UpdateStringDedupConfig(ref StringDedupConfig config);
+
+    [DllImport(@"StringDedupingProfiler.dll")]
+    private static extern int GetStringDedupStatistics(ref StringDedupStatistics statistics);
+
+    [DllImport(@"StringDedupingProfiler.dll")]
+    private static extern int CaptureStringDedupSnapshot([MarshalAs(UnmanagedType.LPWStr)] string path);
 }
\ No newline at end of file
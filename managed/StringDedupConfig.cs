@@ -0,0 +1,116 @@
+using System;
+using System.Runtime.InteropServices;
+
+[Flags]
+public enum StringDedupFlags : uint
+{
+    None = 0x0,
+    Enabled = 0x1,
+
+    /// <summary>Keeps the canonical strings between passes, so strings already deduped are not hashed again.</summary>
+    Persistent = 0x2,
+
+    /// <summary>Leaves the heap untouched and writes a report of what a pass would have saved instead, to the file named by STRING_DEDUP_REPORT.</summary>
+    ReportOnly = 0x4,
+
+    /// <summary>
+    /// Also rewrites references to deduped strings from gen0 and gen1 objects and from strong handles, so the next gen2 collection can reclaim
+    /// the duplicates. Turns on full GC monitoring.
+    /// </summary>
+    Extended = 0x8,
+
+    /// <summary>
+    /// Makes the strings in frozen segments, where the runtime puts string literals, the canonical copies of any equal strings on the heap.
+    /// </summary>
+    SeedFrozen = 0x10,
+
+    /// <summary>
+    /// Folds empty strings and one-character ASCII strings into one instance each without hashing them, whatever the length limits. On by
+    /// default.
+    /// </summary>
+    FoldShortStrings = 0x20,
+}
+
+/// <summary>
+/// Which full blocking gen2 collections run a deduplication pass.
+/// </summary>
+public enum StringDedupTriggerMode : uint
+{
+    FullBlockingGen2,
+    EveryNthGen2,
+    InducedOnly,
+    Gen2Growth,
+}
+
+/// <summary>
+/// Which of several equal strings is kept, among those not seeded from frozen segments.
+/// </summary>
+public enum StringDedupCanonicalPolicy : uint
+{
+    /// <summary>The first one found, which depends on the order the heap is walked in.</summary>
+    FirstSeen,
+
+    /// <summary>The one at the lowest address, which is the same from pass to pass and, on a heap that compacts by sliding, the oldest.</summary>
+    LowestAddress,
+}
+
+/// <summary>
+/// How the deduper runs. Mirrors DedupConfig in native/DedupConfig.h. Start from <see cref="Default"/>, as zero is not the default for every field.
+/// </summary>
+[StructLayout(LayoutKind.Sequential)]
+public struct StringDedupConfig
+{
+    public uint Size;
+
+    /// <summary>
+    /// The version of this structure the caller was written against. Fields and flags added in later versions are ignored, as the padding of
+    /// an earlier version may overlap them; raise it only together with the fields set.
+    /// </summary>
+    public uint Version;
+    public StringDedupFlags Flags;
+
+    /// <summary>0 for one per processor.</summary>
+    public uint WorkerCount;
+
+    public uint MinimumLength;
+
+    /// <summary>0 for no limit.</summary>
+    public uint MaximumLength;
+
+    /// <summary>0 walks the whole heap on every pass; otherwise a pass stops after this long and the next one carries on.</summary>
+    public uint TimeBudgetMilliseconds;
+
+    public StringDedupTriggerMode TriggerMode;
+    public uint EveryNthGen2;
+
+    /// <summary>Samples one heap chunk in this many before a pass and skips the pass if too few references are duplicates. 0 disables sampling.</summary>
+    public uint SamplingStride;
+
+    public ulong Gen2GrowthBytes;
+
+    /// <summary>Bytes the canonical table and per-pass buffers may use; 0 for no limit.</summary>
+    public ulong MemoryLimit;
+
+    /// <summary>Only dedupes this many of the most referenced strings; 0 dedupes every string.</summary>
+    public ulong HeavyHitters;
+
+    public ulong ReportTopStrings;
+    public double MinimumDuplicateRatio;
+
+    /// <summary>How long the extended mode may add to a pass, in microseconds; 0 for no limit. Version 2.</summary>
+    public uint ExtendedBudgetMicroseconds;
+
+    /// <summary>Version 3; shares its offset with the padding at the end of version 2.</summary>
+    public StringDedupCanonicalPolicy CanonicalPolicy;
+
+    public static StringDedupConfig Default => new StringDedupConfig
+    {
+        Size = (uint)Marshal.SizeOf(typeof(StringDedupConfig)),
+        Version = 3,
+        Flags = StringDedupFlags.Enabled | StringDedupFlags.FoldShortStrings,
+        MinimumLength = 1,
+        TriggerMode = StringDedupTriggerMode.FullBlockingGen2,
+        EveryNthGen2 = 1,
+        ReportTopStrings = 100,
+    };
+}
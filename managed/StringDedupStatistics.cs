@@ -0,0 +1,100 @@
+using System.Runtime.InteropServices;
+
+/// <summary>
+/// Counters of one deduplication pass, or summed over every pass. Mirrors DedupPassCounters in native/DedupStatistics.h.
+/// </summary>
+[StructLayout(LayoutKind.Sequential)]
+public struct StringDedupPassCounters
+{
+    public ulong ObjectsScanned;
+
+    /// <summary>Reference slots examined; long runs of slots count their null slots too.</summary>
+    public ulong ReferencesVisited;
+
+    /// <summary>References to gen2 strings that were hashed.</summary>
+    public ulong StringReferences;
+
+    /// <summary>Canonical table slots examined.</summary>
+    public ulong HashProbes;
+
+    /// <summary>Table strings with the same hash and length but different characters.</summary>
+    public ulong HashCollisions;
+
+    /// <summary>References rewritten to point at a canonical copy.</summary>
+    public ulong Dedupes;
+
+    /// <summary>Sizes of the strings those references pointed at. A duplicate referenced from several slots is counted for each, so this is an upper bound.</summary>
+    public ulong BytesReclaimed;
+
+    public ulong WalkNanoseconds;
+    public ulong ResolveNanoseconds;
+    public ulong RewriteNanoseconds;
+    public ulong TotalNanoseconds;
+}
+
+/// <summary>
+/// What the extended mode rewrote outside gen2, in one pass or summed over every pass. Mirrors DedupExtendedCounters in native/DedupStatistics.h.
+/// These rewrites are included in the pass counters too.
+/// </summary>
+[StructLayout(LayoutKind.Sequential)]
+public struct StringDedupExtendedCounters
+{
+    /// <summary>References from gen0 and gen1 objects rewritten.</summary>
+    public ulong EphemeralDedupes;
+
+    /// <summary>Strong handles examined.</summary>
+    public ulong HandleRoots;
+
+    /// <summary>References from strong handles rewritten.</summary>
+    public ulong RootDedupes;
+
+    /// <summary>Passes where the budget ran out before every young object was walked.</summary>
+    public ulong BudgetExceeded;
+
+    public ulong Nanoseconds;
+}
+
+/// <summary>
+/// Everything the deduper counted so far. Mirrors DedupStatistics in native/DedupStatistics.h.
+/// </summary>
+[StructLayout(LayoutKind.Sequential)]
+public struct StringDedupStatistics
+{
+    public const int DurationBuckets = 256;
+    private const int DurationSubBucketBits = 3;
+    private const int DurationSubBuckets = 1 << DurationSubBucketBits;
+
+    public uint Size;
+    public uint Version;
+    public ulong Passes;
+    public StringDedupPassCounters LastPass;
+    public StringDedupPassCounters Total;
+
+    /// <summary>
+    /// Number of passes by duration. The histogram is log-linear: bucket i holds passes that took at least
+    /// <see cref="DurationBucketLowerBound"/>(i) microseconds and less than that of bucket i + 1; the last bucket also holds everything longer.
+    /// </summary>
+    [MarshalAs(UnmanagedType.ByValArray, SizeConst = DurationBuckets)]
+    public ulong[] PassDurations;
+
+    public StringDedupExtendedCounters LastExtended;
+    public StringDedupExtendedCounters TotalExtended;
+
+    /// <summary>Configs whose event mask could not be set, and so were applied without the persistent, extended and time-budget modes.</summary>
+    public uint EventMaskFailures;
+
+    /// <summary>The HRESULT of the last event mask that could not be set.</summary>
+    public uint LastEventMaskResult;
+
+    /// <summary>The shortest pass duration, in microseconds, that falls in bucket.</summary>
+    public static ulong DurationBucketLowerBound(int bucket)
+    {
+        if (bucket < 2 * DurationSubBuckets)
+        {
+            return (ulong)bucket;
+        }
+
+        int shift = bucket / DurationSubBuckets - 1;
+        return (ulong)(bucket - shift * DurationSubBuckets) << shift;
+    }
+}
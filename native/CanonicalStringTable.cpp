@@ -0,0 +1,142 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <new>
+#include "CanonicalStringTable.h"
+
+static const int InitialShift = 12;
+
+CanonicalStringTable::CanonicalStringTable() : capacity(0), count(0), shift(0)
+{
+}
+
+void CanonicalStringTable::ClearSlots(SIZE_T begin, SIZE_T end)
+{
+    for (SIZE_T i = begin; i < end; ++i)
+    {
+        this->slots[i].Hash.store(0, std::memory_order_relaxed);
+        this->slots[i].Object.store(0, std::memory_order_relaxed);
+    }
+}
+
+bool CanonicalStringTable::Reserve(SIZE_T additional, SIZE_T maxCapacity)
+{
+    if (additional == 0)
+    {
+        return true;
+    }
+
+    int newShift = this->shift == 0 ? InitialShift : this->shift;
+    while ((this->count + additional + 1) * 2 > ((SIZE_T)1 << newShift))
+    {
+        ++newShift;
+    }
+
+    bool reached = true;
+    while (maxCapacity != 0 && ((SIZE_T)1 << newShift) > maxCapacity && newShift > 0)
+    {
+        --newShift;
+        reached = false;
+    }
+
+    if (newShift <= this->shift)
+    {
+        return reached;
+    }
+
+    return this->Resize(newShift) && reached;
+}
+
+SIZE_T CanonicalStringTable::Shrink(SIZE_T maxCapacity)
+{
+    if (maxCapacity == 0 || this->capacity <= maxCapacity)
+    {
+        return 0;
+    }
+
+    int newShift = this->shift;
+    while (((SIZE_T)1 << newShift) > maxCapacity && newShift > 0)
+    {
+        --newShift;
+    }
+
+    SIZE_T oldCount = this->count;
+    std::unique_ptr<CanonicalStringEntry[]> oldSlots = std::move(this->slots);
+    SIZE_T oldCapacity = this->capacity;
+
+    SIZE_T newCapacity = (SIZE_T)1 << newShift;
+    this->slots.reset(new (std::nothrow) CanonicalStringEntry[newCapacity]);
+    this->count = 0;
+    if (this->slots == nullptr)
+    {
+        this->capacity = 0;
+        this->shift = 0;
+        return oldCount;
+    }
+
+    this->capacity = newCapacity;
+    this->shift = newShift;
+    this->ClearSlots(0, newCapacity);
+
+    SIZE_T keep = newCapacity / 2 > 1 ? newCapacity / 2 - 1 : 0;
+    for (SIZE_T i = 0; i < oldCapacity && this->count < keep; ++i)
+    {
+        ObjectID object = oldSlots[i].Object.load(std::memory_order_relaxed);
+        if (object != 0)
+        {
+            this->InsertUnique(CanonicalString{object, oldSlots[i].Hash.load(std::memory_order_relaxed), oldSlots[i].Length});
+            ++this->count;
+        }
+    }
+
+    return oldCount - this->count;
+}
+
+bool CanonicalStringTable::Resize(int newShift)
+{
+    SIZE_T newCapacity = (SIZE_T)1 << newShift;
+    std::unique_ptr<CanonicalStringEntry[]> newSlots(new (std::nothrow) CanonicalStringEntry[newCapacity]);
+    if (newSlots == nullptr)
+    {
+        return false;
+    }
+
+    std::unique_ptr<CanonicalStringEntry[]> oldSlots = std::move(this->slots);
+    SIZE_T oldCapacity = this->capacity;
+
+    this->slots = std::move(newSlots);
+    this->capacity = newCapacity;
+    this->shift = newShift;
+    this->ClearSlots(0, newCapacity);
+
+    for (SIZE_T i = 0; i < oldCapacity; ++i)
+    {
+        ObjectID object = oldSlots[i].Object.load(std::memory_order_relaxed);
+        if (object != 0)
+        {
+            this->InsertUnique(CanonicalString{object, oldSlots[i].Hash.load(std::memory_order_relaxed), oldSlots[i].Length});
+        }
+    }
+
+    return true;
+}
+
+void CanonicalStringTable::InsertUnique(const CanonicalString &string)
+{
+    SIZE_T mask = this->capacity - 1;
+    SIZE_T index = this->IndexFor(string.Hash);
+
+    while (true)
+    {
+        CanonicalStringEntry &entry = this->slots[index];
+        uint64_t entryKey = 0;
+        if (entry.Hash.compare_exchange_strong(entryKey, string.Hash, std::memory_order_relaxed))
+        {
+            entry.Length = string.Length;
+            entry.Object.store(string.Object, std::memory_order_release);
+            return;
+        }
+
+        index = (index + 1) & mask;
+    }
+}
@@ -0,0 +1,294 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "cor.h"
+#include "corprof.h"
+
+// One slot of the table. A slot is claimed by setting Hash; Object is published
+// last, so a reader that finds a matching Hash waits until Object is set.
+struct CanonicalStringEntry
+{
+    std::atomic<uint64_t> Hash;
+    std::atomic<ObjectID> Object;
+    ULONG Length;
+};
+
+// A copy of an entry, used while relocating.
+struct CanonicalString
+{
+    ObjectID Object;
+    // the key as stored, with the length class in its low bits
+    uint64_t Hash;
+    ULONG Length;
+};
+
+// Open-addressing table of canonical strings keyed by (hash, length), shared by all
+// workers of a pass. The low bits of each stored key hold the string's length class,
+// so the table is partitioned by length: a slot holding a string of another length
+// (below the last class) is passed over on the key alone, without waiting for its
+// object or reading its length or characters. Lookups and insertions are lock-free: a thread claims an empty
+// slot with a compare-exchange on its hash and then publishes the string, so equal
+// strings found concurrently always resolve to the same canonical copy, while
+// strings that share a hash but differ in content each keep their own slot.
+//
+// The capacity is fixed during a pass. Reserve, Clear and Relocate are called
+// between passes, and FindOrInsert stops inserting rather than grow if the table
+// is full.
+class CanonicalStringTable
+{
+  public:
+    CanonicalStringTable();
+
+    // Makes room for `additional` more strings without growing past maxCapacity slots
+    // (0 for no limit). Returns false if that much room could not be made, in which
+    // case the table may still have grown. Not thread-safe.
+    bool Reserve(SIZE_T additional, SIZE_T maxCapacity = 0);
+
+    // Shrinks the table to at most maxCapacity slots if it has more, keeping as many
+    // strings as fit while it stays under half full. Returns how many were dropped;
+    // if the smaller table cannot be allocated, the table is released and every string
+    // dropped. Not thread-safe.
+    SIZE_T Shrink(SIZE_T maxCapacity);
+
+    void Clear()
+    {
+        this->ClearSlots(0, this->capacity);
+        this->count = 0;
+    }
+
+    // Resets the slots in [begin, end); disjoint ranges may be cleared concurrently.
+    // The caller resets the count once all ranges are done.
+    void ClearSlots(SIZE_T begin, SIZE_T end);
+
+    void ResetCount()
+    {
+        this->count = 0;
+    }
+
+    SIZE_T GetCount() const
+    {
+        return this->count;
+    }
+
+    // Insertions are counted by the callers and added once a phase is complete, so
+    // concurrent workers do not contend on a shared counter.
+    void AddCount(SIZE_T inserted)
+    {
+        this->count += inserted;
+    }
+
+    SIZE_T GetCapacity() const
+    {
+        return this->capacity;
+    }
+
+    // How many more strings can be inserted while the table stays under half full;
+    // callers split this into per-worker quotas and only look up once theirs is used.
+    SIZE_T GetInsertLimit() const
+    {
+        return this->capacity / 2 > this->count + 1 ? this->capacity / 2 - 1 - this->count : 0;
+    }
+
+    // The slot a lookup of hash starts probing at; only valid while the capacity is
+    // not zero and until the table next grows. Used to prefetch ahead of FindOrInsert.
+    const CanonicalStringEntry *GetSlot(uint64_t hash, ULONG length) const
+    {
+        return &this->slots[this->IndexFor(KeyFor(hash, length))];
+    }
+
+    // Returns the canonical string equal to object, inserting object as the
+    // canonical copy if none is known. *inserted is set only when this call took a
+    // slot, not when object was already the canonical copy. equals(candidate) is only
+    // invoked for candidates whose hash and length both match. The number of slots
+    // examined is added to *probes if it is not null. Safe to call concurrently.
+    template <typename EqualsFunc>
+    ObjectID FindOrInsert(uint64_t hash, ULONG length, ObjectID object, EqualsFunc equals, bool *inserted, SIZE_T *probes = nullptr)
+    {
+        *inserted = false;
+        return this->Probe(hash, length, object, equals, inserted, probes);
+    }
+
+    // Like FindOrInsert, but returns 0 instead of inserting when no equal string is
+    // known. Safe to call concurrently with FindOrInsert.
+    template <typename EqualsFunc>
+    ObjectID Find(uint64_t hash, ULONG length, ObjectID object, EqualsFunc equals, SIZE_T *probes = nullptr)
+    {
+        return this->Probe(hash, length, object, equals, nullptr, probes);
+    }
+
+    // Like FindOrInsert, but when an equal string is already canonical and
+    // prefer(existing) returns true, object takes its place. Strings folded into the
+    // one replaced still point at it, so canonical copies are meant to be elected this
+    // way before any are handed out. A null inserted only looks up, as Find does.
+    // Safe to call concurrently with FindOrInsert.
+    template <typename EqualsFunc, typename PreferFunc>
+    ObjectID FindOrReplace(uint64_t hash, ULONG length, ObjectID object, EqualsFunc equals, PreferFunc prefer, bool *inserted, SIZE_T *probes = nullptr)
+    {
+        if (inserted != nullptr)
+        {
+            *inserted = false;
+        }
+
+        CanonicalStringEntry *entry = nullptr;
+        ObjectID existing = this->Probe(hash, length, object, equals, inserted, probes, &entry);
+        while (existing != 0 && existing != object && prefer(existing))
+        {
+            if (entry->Object.compare_exchange_weak(existing, object, std::memory_order_acq_rel))
+            {
+                return object;
+            }
+
+            // another thread replaced it first; existing now holds its string
+        }
+
+        return existing;
+    }
+
+    // Inserts a string known not to be in the table. Safe to call concurrently.
+    void InsertUnique(const CanonicalString &string);
+
+    template <typename Func>
+    void ForEach(Func func) const
+    {
+        for (SIZE_T i = 0; i < this->capacity; ++i)
+        {
+            ObjectID object = this->slots[i].Object.load(std::memory_order_relaxed);
+            if (object != 0)
+            {
+                func(object);
+            }
+        }
+    }
+
+    // Appends relocate(object) for every string in slots [begin, end) that relocate
+    // does not drop by returning 0. Disjoint ranges may be collected concurrently;
+    // the table is then cleared and the survivors reinserted with InsertUnique.
+    template <typename RelocateFunc>
+    void CollectRelocated(SIZE_T begin, SIZE_T end, RelocateFunc relocate, std::vector<CanonicalString> &survivors) const
+    {
+        for (SIZE_T i = begin; i < end; ++i)
+        {
+            const CanonicalStringEntry &entry = this->slots[i];
+            ObjectID object = entry.Object.load(std::memory_order_relaxed);
+            if (object == 0)
+            {
+                continue;
+            }
+
+            ObjectID moved = relocate(object);
+            if (moved != 0)
+            {
+                survivors.push_back(CanonicalString{moved, entry.Hash.load(std::memory_order_relaxed), entry.Length});
+            }
+        }
+    }
+
+  private:
+    template <typename EqualsFunc>
+    ObjectID Probe(uint64_t hash, ULONG length, ObjectID object, EqualsFunc equals, bool *inserted, SIZE_T *probes, CanonicalStringEntry **found = nullptr)
+    {
+        uint64_t key = KeyFor(hash, length);
+        SIZE_T mask = this->capacity - 1;
+        SIZE_T index = this->capacity == 0 ? 0 : this->IndexFor(key);
+        SIZE_T examined = 0;
+        ObjectID result = inserted != nullptr ? object : 0;
+
+        while (examined < this->capacity)
+        {
+            CanonicalStringEntry &entry = this->slots[index];
+            uint64_t entryKey = entry.Hash.load(std::memory_order_relaxed);
+            ++examined;
+
+            if (entryKey == 0)
+            {
+                if (inserted == nullptr)
+                {
+                    result = 0;
+                    break;
+                }
+
+                if (entry.Hash.compare_exchange_strong(entryKey, key, std::memory_order_relaxed))
+                {
+                    entry.Length = length;
+                    entry.Object.store(object, std::memory_order_release);
+                    *inserted = true;
+                    result = object;
+                    if (found != nullptr)
+                    {
+                        *found = &entry;
+                    }
+
+                    break;
+                }
+
+                // another thread claimed the slot first; entryKey now holds its hash
+            }
+
+            if (entryKey == key)
+            {
+                ObjectID existing = WaitForObject(entry);
+                if (entry.Length == length && (existing == object || equals(existing)))
+                {
+                    result = existing;
+                    if (found != nullptr)
+                    {
+                        *found = &entry;
+                    }
+
+                    break;
+                }
+            }
+
+            index = (index + 1) & mask;
+        }
+
+        if (probes != nullptr)
+        {
+            *probes += examined;
+        }
+
+        return result;
+    }
+
+    bool Resize(int newShift);
+
+    // Strings shorter than LengthClassMask characters each have a class of their own,
+    // and longer ones share the last.
+    static const uint64_t LengthClassMask = 0xFF;
+
+    // The slot index comes from the high bits of the hash, so taking its low bits
+    // for the length class leaves the distribution alone. 0 marks an empty slot, so
+    // a key of 0 is stored as 1.
+    static uint64_t KeyFor(uint64_t hash, ULONG length)
+    {
+        uint64_t key = (hash & ~LengthClassMask) | (length < LengthClassMask ? length : LengthClassMask);
+        return key != 0 ? key : 1;
+    }
+
+    static ObjectID WaitForObject(const CanonicalStringEntry &entry)
+    {
+        ObjectID object;
+        while ((object = entry.Object.load(std::memory_order_acquire)) == 0)
+        {
+            // the claiming thread is between its two stores
+        }
+
+        return object;
+    }
+
+    SIZE_T IndexFor(uint64_t key) const
+    {
+        return (SIZE_T)(key >> (64 - this->shift));
+    }
+
+    std::unique_ptr<CanonicalStringEntry[]> slots;
+    SIZE_T capacity;
+    SIZE_T count;
+    int shift;
+};
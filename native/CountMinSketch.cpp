@@ -0,0 +1,47 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <algorithm>
+#include <new>
+#include "CountMinSketch.h"
+
+CountMinSketch::CountMinSketch()
+{
+}
+
+bool CountMinSketch::Clear()
+{
+    if (this->counters.empty())
+    {
+        try
+        {
+            this->counters.resize(Depth * Width);
+        }
+        catch (const std::bad_alloc &)
+        {
+            return false;
+        }
+
+        return true;
+    }
+
+    std::fill(this->counters.begin(), this->counters.end(), 0u);
+    return true;
+}
+
+void CountMinSketch::Merge(const CountMinSketch &other)
+{
+    for (SIZE_T i = 0; i < this->counters.size(); ++i)
+    {
+        uint32_t sum = this->counters[i] + other.counters[i];
+        this->counters[i] = sum < this->counters[i] ? UINT32_MAX : sum;
+    }
+}
+
+void CountMinSketch::Age()
+{
+    for (auto &counter : this->counters)
+    {
+        counter >>= 1;
+    }
+}
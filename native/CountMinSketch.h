@@ -0,0 +1,87 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "cor.h"
+#include "corprof.h"
+
+// Count-Min sketch of how often each hash was added, in Depth rows of Width 32-bit
+// counters (256 KB). Estimates never undercount; with conservative updates they
+// overcount by a small share of the total for all but the rarest hashes. Each row is
+// indexed by a different slice of the hash, so hashes must be well mixed.
+class CountMinSketch
+{
+  public:
+    static const int Depth = 4;
+    static const int WidthBits = 14;
+    static const SIZE_T Width = (SIZE_T)1 << WidthBits;
+
+    CountMinSketch();
+
+    // Allocates the counters on first use and zeroes them. Add, Estimate and Merge
+    // may only be called once this has succeeded.
+    bool Clear();
+
+    // Counts one more occurrence of hash and returns its new estimate. Only the
+    // counters below the new estimate are raised.
+    uint32_t Add(uint64_t hash)
+    {
+        SIZE_T index[Depth];
+        uint32_t estimate = UINT32_MAX;
+        for (int row = 0; row < Depth; ++row)
+        {
+            index[row] = IndexFor(hash, row);
+            estimate = this->counters[index[row]] < estimate ? this->counters[index[row]] : estimate;
+        }
+
+        if (estimate == UINT32_MAX)
+        {
+            return estimate;
+        }
+
+        ++estimate;
+        for (int row = 0; row < Depth; ++row)
+        {
+            if (this->counters[index[row]] < estimate)
+            {
+                this->counters[index[row]] = estimate;
+            }
+        }
+
+        return estimate;
+    }
+
+    uint32_t Estimate(uint64_t hash) const
+    {
+        uint32_t estimate = UINT32_MAX;
+        for (int row = 0; row < Depth; ++row)
+        {
+            uint32_t counter = this->counters[IndexFor(hash, row)];
+            estimate = counter < estimate ? counter : estimate;
+        }
+
+        return estimate;
+    }
+
+    // Adds the counts of other, saturating at the counter width.
+    void Merge(const CountMinSketch &other);
+
+    // Halves every counter, so that older passes weigh less than recent ones.
+    void Age();
+
+    bool IsAllocated() const
+    {
+        return !this->counters.empty();
+    }
+
+  private:
+    static SIZE_T IndexFor(uint64_t hash, int row)
+    {
+        return (SIZE_T)row * Width + (SIZE_T)((hash >> (row * WidthBits)) & (Width - 1));
+    }
+
+    std::vector<uint32_t> counters;
+};
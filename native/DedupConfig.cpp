@@ -0,0 +1,109 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <cstring>
+#include "DedupConfig.h"
+#include "DedupTriggerPolicy.h"
+
+// The flags each version added; a caller of an older version gets their defaults
+static const uint32_t FlagsAddedInVersion2 = DedupConfigExtended;
+static const uint32_t FlagsAddedInVersion3 = DedupConfigSeedFrozen | DedupConfigFoldShortStrings;
+
+DedupConfig DedupConfig::Default()
+{
+    DedupConfig config = {};
+    config.Size = sizeof(DedupConfig);
+    config.Version = CurrentVersion;
+    config.Flags = DedupConfigEnabled | DedupConfigFoldShortStrings;
+    config.MinimumLength = 1;
+    config.TriggerMode = (uint32_t)DedupTriggerMode::FullBlockingGen2;
+    config.EveryNthGen2 = 1;
+    config.ReportTopStrings = 100;
+    return config;
+}
+
+bool DedupConfig::Read(const void *data, SIZE_T size, DedupConfig *config)
+{
+    *config = Default();
+
+    uint32_t callerSize;
+    if (data == nullptr || size < offsetof(DedupConfig, Flags))
+    {
+        return false;
+    }
+
+    memcpy(&callerSize, data, sizeof(callerSize));
+    if (callerSize != size)
+    {
+        return false;
+    }
+
+    uint32_t callerVersion;
+    memcpy(&callerVersion, (const BYTE *)data + offsetof(DedupConfig, Version), sizeof(callerVersion));
+
+    memcpy(config, data, size < sizeof(DedupConfig) ? size : sizeof(DedupConfig));
+
+    // a later field may sit in what was padding at the end of an earlier version, so
+    // the size alone does not tell which fields the caller set
+    DedupConfig defaults = Default();
+    if (callerVersion < 2)
+    {
+        config->Flags = (config->Flags & ~FlagsAddedInVersion2) | (defaults.Flags & FlagsAddedInVersion2);
+        config->ExtendedBudgetMicroseconds = defaults.ExtendedBudgetMicroseconds;
+    }
+
+    if (callerVersion < 3)
+    {
+        config->Flags = (config->Flags & ~FlagsAddedInVersion3) | (defaults.Flags & FlagsAddedInVersion3);
+        config->CanonicalPolicy = defaults.CanonicalPolicy;
+    }
+
+    config->Size = sizeof(DedupConfig);
+    config->Version = CurrentVersion;
+    return true;
+}
+
+DedupControlBlock::DedupControlBlock() : sequence(0), config(DedupConfig::Default())
+{
+}
+
+void DedupControlBlock::Publish(const DedupConfig &config)
+{
+    std::lock_guard<std::mutex> lock(this->writeLock);
+
+    uint32_t sequence = this->sequence.load(std::memory_order_relaxed);
+    this->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    this->config = config;
+
+    this->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+bool DedupControlBlock::ReadIfChanged(uint32_t *sequence, DedupConfig *config) const
+{
+    while (true)
+    {
+        uint32_t before = this->sequence.load(std::memory_order_acquire);
+        if (before == *sequence)
+        {
+            return false;
+        }
+
+        if ((before & 1) != 0)
+        {
+            // a writer is halfway through; it only copies a small struct
+            continue;
+        }
+
+        DedupConfig copy = this->config;
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (this->sequence.load(std::memory_order_relaxed) == before)
+        {
+            *config = copy;
+            *sequence = before;
+            return true;
+        }
+    }
+}
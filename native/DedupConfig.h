@@ -0,0 +1,89 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include "cor.h"
+#include "corprof.h"
+
+enum DedupConfigFlags : uint32_t
+{
+    DedupConfigEnabled = 0x1,
+    DedupConfigPersistent = 0x2,
+    DedupConfigReportOnly = 0x4,
+    DedupConfigExtended = 0x8,
+    DedupConfigSeedFrozen = 0x10,
+    DedupConfigFoldShortStrings = 0x20,
+};
+
+// What the profiler is told to do, passed at attach after the string MethodTable and
+// later published through the DedupControlBlock. Mirrored by StringDedupConfig in
+// managed/StringDedupConfig.cs; new fields and flags are only ever appended, with
+// Version bumped. Size is the size of the caller's structure and Version the version
+// it was written against; the fields and flags added after that version keep their
+// defaults, whatever bytes the structure holds there.
+struct DedupConfig
+{
+    static const uint32_t CurrentVersion = 3;
+
+    static DedupConfig Default();
+
+    // Copies the config at data, which holds size bytes, over the defaults. Returns
+    // false if it is too short or its Size does not match.
+    static bool Read(const void *data, SIZE_T size, DedupConfig *config);
+
+    uint32_t Size;
+    uint32_t Version;
+    uint32_t Flags;
+    // 0 for one per processor
+    uint32_t WorkerCount;
+    uint32_t MinimumLength;
+    // 0 for no limit
+    uint32_t MaximumLength;
+    uint32_t TimeBudgetMilliseconds;
+    // DedupTriggerMode
+    uint32_t TriggerMode;
+    uint32_t EveryNthGen2;
+    uint32_t SamplingStride;
+    uint64_t Gen2GrowthBytes;
+    uint64_t MemoryLimit;
+    uint64_t HeavyHitters;
+    uint64_t ReportTopStrings;
+    double MinimumDuplicateRatio;
+
+    // version 2
+    // how long the extended mode may add to a pass; 0 for no limit
+    uint32_t ExtendedBudgetMicroseconds;
+
+    // version 3
+    // DedupCanonicalPolicy
+    uint32_t CanonicalPolicy;
+};
+
+// The config as last published by managed code while the profiler runs, read once
+// per pass.
+//
+// A sequence lock: a writer makes the sequence odd, writes the config and makes it even
+// again, so a reader that sees the same even sequence before and after its copy got a
+// consistent one. Readers never wait, which matters as they read from GC callbacks;
+// writers are serialized by a mutex.
+class DedupControlBlock
+{
+  public:
+    DedupControlBlock();
+
+    void Publish(const DedupConfig &config);
+
+    // Copies the config into *config if it was published since *sequence was taken,
+    // and updates *sequence. Returns false if nothing changed.
+    bool ReadIfChanged(uint32_t *sequence, DedupConfig *config) const;
+
+  private:
+    std::mutex writeLock;
+    std::atomic<uint32_t> sequence;
+    DedupConfig config;
+};
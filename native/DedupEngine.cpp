@@ -0,0 +1,2042 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <cwchar>
+#include "DedupEngine.h"
+#include "CountMinSketch.h"
+#include "StringDedupingProfiler.h"
+#include "GCDesc.h"
+#include "HeavyHitters.h"
+#include "HyperLogLog.h"
+#include "Prefetch.h"
+#include "ReferenceScan.h"
+#include "StringHash.h"
+
+// Ranges larger than this are cut into several chunks so they can be walked in parallel
+static const SIZE_T ChunkBytes = 2 * 1024 * 1024;
+
+// Share of the memory limit given to the candidate and rewrite buffers, as a divisor
+static const SIZE_T CandidateMemoryShare = 4;
+
+// Free table slots a worker claims at a time while resolving
+static const SIZE_T InsertPermitBlock = 1024;
+
+// Chunks cut for a budgeted pass are smaller, since the budget is only checked
+// between chunks
+static const SIZE_T BudgetChunkBytes = 256 * 1024;
+
+// References are classified in batches: the walk only appends non-null slots, and the
+// batch is then read back with the target strings prefetched this many entries ahead.
+static const SIZE_T ReferenceBatchSize = 256;
+static const SIZE_T PrefetchDistance = 16;
+
+// Size of a string object: the header and the characters including the terminator,
+// but at least the minimum object size.
+static SIZE_T GetStringObjectSize(ULONG stringBufferOffset, ULONG length)
+{
+    SIZE_T size = align_up(stringBufferOffset + ((SIZE_T)length + 1) * sizeof(WCHAR), sizeof(SIZE_T));
+    return size > 3 * sizeof(SIZE_T) ? size : 3 * sizeof(SIZE_T);
+}
+
+// The singleton a string is folded into, or ShortStringCount if it is resolved against
+// the canonical table.
+static SIZE_T ShortStringIndex(ObjectID string, ULONG length, ULONG stringBufferOffset)
+{
+    if (length == 0)
+    {
+        return 0;
+    }
+
+    if (length == 1)
+    {
+        WCHAR character = *(WCHAR *)((PBYTE)string + stringBufferOffset);
+        if (character < ShortStringCount - 1)
+        {
+            return 1 + character;
+        }
+    }
+
+    return ShortStringCount;
+}
+
+// Collects the references found by the walk as candidates for the resolve phase.
+class CandidateSink
+{
+  public:
+    explicit CandidateSink(WalkObjectContext *context) : context(context)
+    {
+    }
+
+    void Add(ObjectID *slot, ObjectID string, uint64_t hash, ULONG length)
+    {
+        WalkObjectContext *context = this->context;
+
+        DedupCandidate candidate;
+        candidate.Slot = slot;
+        candidate.String = string;
+        candidate.Hash = hash;
+        candidate.Length = length;
+        context->Candidates->push_back(candidate);
+
+        if (context->CandidateLimit != 0 && context->Candidates->size() >= context->CandidateLimit)
+        {
+            context->Engine->FlushCandidates(context->Worker);
+        }
+    }
+
+    // Makes string the singleton for index if there is none yet, and otherwise queues
+    // the slot to be rewritten to it. While canonical copies are elected the lower of
+    // the two becomes the singleton instead, and the slot is only resolved with the
+    // candidates, once the singleton is settled.
+    void AddShort(ObjectID *slot, ObjectID string, SIZE_T index, ULONG length)
+    {
+        WalkObjectContext *context = this->context;
+        DedupEngine *engine = context->Engine;
+        ++engine->resolvedCounts[context->Worker];
+
+        if (engine->electing)
+        {
+            std::atomic<ObjectID> &singleton = context->ShortStrings[index];
+            ObjectID existing = singleton.load(std::memory_order_relaxed);
+            while ((existing == 0 || engine->PreferCanonical(string, existing)) && !singleton.compare_exchange_weak(existing, string, std::memory_order_relaxed))
+            {
+            }
+
+            std::vector<DedupRewrite> &shortCandidates = engine->shortCandidates[context->Worker];
+            shortCandidates.push_back(DedupRewrite{slot, string});
+            if (context->CandidateLimit != 0 && shortCandidates.size() >= context->CandidateLimit)
+            {
+                engine->FlushCandidates(context->Worker);
+            }
+
+            return;
+        }
+
+        ObjectID canonical = 0;
+        if (context->ShortStrings[index].compare_exchange_strong(canonical, string, std::memory_order_relaxed) || canonical == string)
+        {
+            return;
+        }
+
+        std::vector<DedupRewrite> &rewrites = engine->rewrites[context->Worker];
+        rewrites.push_back(DedupRewrite{slot, canonical});
+        ++context->Counters->Dedupes;
+        context->Counters->BytesReclaimed += GetStringObjectSize(context->StringBufferOffset, length);
+
+        if (context->CandidateLimit != 0 && rewrites.size() >= context->CandidateLimit)
+        {
+            engine->FlushCandidates(context->Worker);
+        }
+    }
+
+  private:
+    WalkObjectContext *context;
+};
+
+// In heavy-hitter mode, counts every reference found by the walk but only collects the
+// ones to strings that earlier passes found hot.
+class HeavyHitterSink
+{
+  public:
+    HeavyHitterSink(WalkObjectContext *context, CountMinSketch *counts, HeavyHitters *seen, const HeavyHitters *hot) : candidates(context), counts(counts), seen(seen), hot(hot)
+    {
+    }
+
+    void Add(ObjectID *slot, ObjectID string, uint64_t hash, ULONG length)
+    {
+        this->seen->Offer(hash, this->counts->Add(hash));
+        if (this->hot->Contains(hash))
+        {
+            this->candidates.Add(slot, string, hash, length);
+        }
+    }
+
+    // short strings are cheap to fold, so they are folded whether hot or not
+    void AddShort(ObjectID *slot, ObjectID string, SIZE_T index, ULONG length)
+    {
+        this->candidates.AddShort(slot, string, index, length);
+    }
+
+  private:
+    CandidateSink candidates;
+    CountMinSketch *counts;
+    HeavyHitters *seen;
+    const HeavyHitters *hot;
+};
+
+// Counts the references found by the sampling pre-pass and estimates how many
+// distinct strings they point at.
+class SampleSink
+{
+  public:
+    explicit SampleSink(HyperLogLog *distinct) : distinct(distinct), count(0)
+    {
+    }
+
+    void Add(ObjectID *slot, ObjectID string, uint64_t hash, ULONG length)
+    {
+        this->distinct->Add(hash);
+        ++this->count;
+    }
+
+    void AddShort(ObjectID *slot, ObjectID string, SIZE_T index, ULONG length)
+    {
+        // the index is spread over the hash space as HyperLogLog expects
+        this->distinct->Add((uint64_t)(index + 1) * 0x9E3779B97F4A7C15ull);
+        ++this->count;
+    }
+
+    SIZE_T GetCount() const
+    {
+        return this->count;
+    }
+
+  private:
+    HyperLogLog *distinct;
+    SIZE_T count;
+};
+
+// Visits the reference slots of the objects in one chunk and hands every gen2 string
+// reference to the sink. The walker calls it inline from its slot loops; Flush must
+// be called once the chunk is done.
+template <typename Sink>
+class StringReferenceVisitor
+{
+  public:
+    StringReferenceVisitor(const WalkObjectContext *context, Sink &sink) : context(context), sink(sink), stringMethodTable(context->StringMethodTable), pendingCount(0), referencesVisited(0), stringReferences(0)
+    {
+    }
+
+    // Adds what the visitor counted to the pass counters.
+    void AddCounters(DedupPassCounters *counters) const
+    {
+        counters->ReferencesVisited += this->referencesVisited;
+        counters->StringReferences += this->stringReferences;
+    }
+
+    void Visit(ObjectID *slot)
+    {
+        this->pending[this->pendingCount++] = slot;
+        if (this->pendingCount == ReferenceBatchSize)
+        {
+            this->Flush();
+        }
+    }
+
+    void VisitRun(ObjectID *slots, SIZE_T count)
+    {
+        if (count < ReferenceScan::MinimumRun)
+        {
+            for (SIZE_T i = 0; i < count; ++i)
+            {
+                if (slots[i] != 0)
+                {
+                    this->Visit(&slots[i]);
+                }
+            }
+
+            return;
+        }
+
+        // long runs are matched directly; the targets of the next block are requested
+        // while the current one is gathered
+        this->referencesVisited += count;
+        for (SIZE_T i = 0; i < count; i += ReferenceScan::BatchSize)
+        {
+            SIZE_T batch = count - i < ReferenceScan::BatchSize ? count - i : ReferenceScan::BatchSize;
+            SIZE_T nextEnd = i + batch + ReferenceScan::BatchSize < count ? i + batch + ReferenceScan::BatchSize : count;
+            for (SIZE_T j = i + batch; j < nextEnd; ++j)
+            {
+                if (slots[j] != 0)
+                {
+                    PrefetchRead((const void *)slots[j]);
+                }
+            }
+
+            uint64_t matches = ReferenceScan::MatchMethodTable(slots + i, batch, this->stringMethodTable);
+            while (matches != 0)
+            {
+                SIZE_T index = i + ReferenceScan::LowestSetBit(matches);
+                matches &= matches - 1;
+                this->VisitString(&slots[index], slots[index]);
+            }
+        }
+    }
+
+    void Flush()
+    {
+        SIZE_T count = this->pendingCount;
+        this->referencesVisited += count;
+        for (SIZE_T i = 0; i < count && i < PrefetchDistance; ++i)
+        {
+            PrefetchRead((const void *)*this->pending[i]);
+        }
+
+        for (SIZE_T i = 0; i < count; ++i)
+        {
+            if (i + PrefetchDistance < count)
+            {
+                PrefetchRead((const void *)*this->pending[i + PrefetchDistance]);
+            }
+
+            ObjectID *slot = this->pending[i];
+            ObjectID objectReference = *slot;
+            if (*(SIZE_T *)objectReference == this->stringMethodTable)
+            {
+                this->VisitString(slot, objectReference);
+            }
+        }
+
+        this->pendingCount = 0;
+    }
+
+  private:
+    void VisitString(ObjectID *slot, ObjectID objectReference)
+    {
+        const WalkObjectContext *context = this->context;
+
+        if (context->KnownStrings != nullptr && context->KnownStrings->Contains(objectReference))
+        {
+            return;
+        }
+
+        // the length shares a cache line with the method table just read, so it is
+        // checked before the generation lookup
+        ULONG objectReferenceStringLength = *(PULONG)((PBYTE)objectReference + context->StringLengthOffset);
+        SIZE_T shortIndex = ShortStringCount;
+        if (objectReferenceStringLength <= 1 && context->ShortStrings != nullptr)
+        {
+            shortIndex = ShortStringIndex(objectReference, objectReferenceStringLength, context->StringBufferOffset);
+        }
+
+        if (shortIndex == ShortStringCount && (objectReferenceStringLength < context->MinimumLength || objectReferenceStringLength > context->MaximumLength))
+        {
+            return;
+        }
+
+        if (context->GenerationIndex->GetGeneration(objectReference) > 1)
+        {
+            if (shortIndex != ShortStringCount)
+            {
+                ++this->stringReferences;
+                this->sink.AddShort(slot, objectReference, shortIndex, objectReferenceStringLength);
+                return;
+            }
+
+            WCHAR *objectReferenceStringData = (WCHAR *)((PBYTE)objectReference + context->StringBufferOffset);
+            uint64_t hash = StringHash::Hash(objectReferenceStringData, objectReferenceStringLength);
+
+            ++this->stringReferences;
+            this->sink.Add(slot, objectReference, hash, objectReferenceStringLength);
+        }
+    }
+
+    const WalkObjectContext *context;
+    Sink &sink;
+    SIZE_T stringMethodTable;
+    SIZE_T pendingCount;
+    SIZE_T referencesVisited;
+    SIZE_T stringReferences;
+    ObjectID *pending[ReferenceBatchSize];
+};
+
+static void RecordFailure(std::atomic<HRESULT> &failure, HRESULT hr)
+{
+    HRESULT expected = S_OK;
+    failure.compare_exchange_strong(expected, hr);
+}
+
+static uint64_t ElapsedNanoseconds(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to = std::chrono::steady_clock::now())
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count();
+}
+
+DedupEngine::DedupEngine() : heapInfo(nullptr), eventLog(nullptr), stringMethodTable(0), stringLengthOffset(0), stringBufferOffset(0), persistent(false), relocationTracking(false), timeBudgetMilliseconds(0), cursor(), extended(false), extendedBudgetMicroseconds(0), extendedCounters(), rootTracking(false), foldShortStrings(true), canonicalPolicy(DedupCanonicalPolicy::FirstSeen), seedFrozen(false), electing(false), minimumLength(1), maximumLength(0xFFFFFFFF), memoryLimit(0), candidateLimit(0), previousStringCount(0), previousCandidatePeak(0), insertPermits(0), samplingStride(0), minimumDuplicateRatio(0), lastSample(), statistics(), reportOnly(false), reportTopStrings(0), passCount(0), reportPending(false), heavyHitterCount(0), heavyHittersPending(false)
+{
+    for (auto &singleton : this->shortStrings)
+    {
+        singleton.store(0, std::memory_order_relaxed);
+    }
+}
+
+void DedupEngine::Initialize(ManagedHeapInfo *heapInfo, SIZE_T stringMethodTable, ULONG stringLengthOffset, ULONG stringBufferOffset)
+{
+    this->heapInfo = heapInfo;
+    this->stringMethodTable = stringMethodTable;
+    this->stringLengthOffset = stringLengthOffset;
+    this->stringBufferOffset = stringBufferOffset;
+}
+
+bool DedupEngine::StartWorkers(int workerCount)
+{
+    std::lock_guard<std::mutex> lock(this->passLock);
+    if (workerCount < 1)
+    {
+        workerCount = 1;
+    }
+
+    bool started = this->workerPool.Start(workerCount);
+    workerCount = this->workerPool.GetWorkerCount();
+
+    this->table.Clear();
+    this->knownStrings.Clear();
+    this->candidates.clear();
+    this->candidates.resize(workerCount);
+    this->rewrites.clear();
+    this->rewrites.resize(workerCount);
+    this->shortCandidates.clear();
+    this->shortCandidates.resize(workerCount);
+    this->newCanonicals.clear();
+    this->newCanonicals.resize(workerCount);
+    this->relocatedStrings.clear();
+    this->relocatedStrings.resize(workerCount);
+    this->insertQuotas.assign(workerCount, 0);
+    this->insertedCounts.assign(workerCount, 0);
+    this->refusedCounts.assign(workerCount, 0);
+    this->resolvedCounts.assign(workerCount, 0);
+    this->workerCounters.assign(workerCount, DedupPassCounters());
+    this->reportBuilders.clear();
+    this->reportBuilders.resize(workerCount);
+    this->ResetReportBuilders();
+    this->samplers.clear();
+    this->samplers.resize(workerCount);
+    this->UpdateCandidateLimit();
+    this->ResetHeavyHitters();
+    this->methodTableCaches.clear();
+    this->methodTableCaches.resize(workerCount);
+
+    return started;
+}
+
+void DedupEngine::StopWorkers()
+{
+    this->workerPool.Stop();
+}
+
+HRESULT DedupEngine::GetObjectSize(MethodTableCache &methodTables, ObjectID object, const MethodTableInfo **info, SIZE_T *size)
+{
+    *info = methodTables.Lookup(*(SIZE_T *)object);
+    if (MethodTableCache::TryGetObjectSize(*info, object, size))
+    {
+        return S_OK;
+    }
+
+    return this->heapInfo->GetObjectSize(object, size);
+}
+
+HRESULT DedupEngine::PartitionRange(MethodTableCache &methodTables, const COR_PRF_GC_GENERATION_RANGE &range, std::vector<HeapChunk> &chunks)
+{
+    chunks.clear();
+
+    ObjectID curr = range.rangeStart;
+    ObjectID end = range.rangeStart + range.rangeLength;
+
+    if (range.rangeLength <= ChunkBytes)
+    {
+        chunks.push_back(HeapChunk{curr, end});
+        return S_OK;
+    }
+
+    ObjectID chunkStart = curr;
+    while (curr < end)
+    {
+        const MethodTableInfo *info;
+        SIZE_T size;
+        IfFailRet(this->GetObjectSize(methodTables, curr, &info, &size));
+
+        curr = (ObjectID)(align_up((SIZE_T)curr + size, sizeof(SIZE_T)));
+        if (curr - chunkStart >= ChunkBytes)
+        {
+            chunks.push_back(HeapChunk{chunkStart, curr});
+            chunkStart = curr;
+        }
+    }
+
+    if (chunkStart < end)
+    {
+        chunks.push_back(HeapChunk{chunkStart, end});
+    }
+
+    return S_OK;
+}
+
+HRESULT DedupEngine::CutChunk(MethodTableCache &methodTables, const std::vector<COR_PRF_GC_GENERATION_RANGE> &ranges, WalkCursor &position, HeapChunk *chunk)
+{
+    const COR_PRF_GC_GENERATION_RANGE &range = ranges[position.RangeIndex];
+    ObjectID curr = position.Object;
+    ObjectID end = range.rangeStart + range.rangeLength;
+
+    while (curr < end && curr - position.Object < BudgetChunkBytes)
+    {
+        const MethodTableInfo *info;
+        SIZE_T size;
+        IfFailRet(this->GetObjectSize(methodTables, curr, &info, &size));
+
+        curr = (ObjectID)(align_up((SIZE_T)curr + size, sizeof(SIZE_T)));
+    }
+
+    *chunk = HeapChunk{position.Object, curr < end ? curr : end};
+
+    if (curr < end)
+    {
+        position.Object = curr;
+    }
+    else if (++position.RangeIndex < ranges.size())
+    {
+        position.Object = ranges[position.RangeIndex].rangeStart;
+    }
+
+    return S_OK;
+}
+
+template <typename Sink>
+HRESULT DedupEngine::WalkChunk(WalkObjectContext *context, const HeapChunk &chunk, Sink &sink)
+{
+    StringReferenceVisitor<Sink> visitor(context, sink);
+    ObjectID curr = chunk.Start;
+    ObjectID end = chunk.End;
+    SIZE_T objects = 0;
+
+    while (curr < end)
+    {
+        const MethodTableInfo *info;
+        SIZE_T size;
+        HRESULT hr = this->GetObjectSize(*context->MethodTables, curr, &info, &size);
+        if (FAILED(hr))
+        {
+            visitor.Flush();
+            visitor.AddCounters(context->Counters);
+            context->Counters->ObjectsScanned += objects;
+            return hr;
+        }
+
+        ++objects;
+
+        if (info->SeriesDecoded)
+        {
+            WalkCachedObject(*context->MethodTables, info, (PBYTE)curr, size, visitor);
+        }
+        else if (info->ContainsPointerOrCollectible)
+        {
+            GCDesc gcdesc = GCDesc::ForMethodTable(info->MethodTable);
+            gcdesc.WalkObject((PBYTE)curr, size, visitor);
+        }
+
+        curr = (ObjectID)(align_up((SIZE_T)curr + size, sizeof(SIZE_T))); // is it SIZE_T alignment on LOH in 32-bit??
+    }
+
+    visitor.Flush();
+    visitor.AddCounters(context->Counters);
+    context->Counters->ObjectsScanned += objects;
+    return S_OK;
+}
+
+// Calls walk(sink) with the sink that collects candidates in the engine's mode.
+template <typename WalkFunc>
+void DedupEngine::WithCandidateSink(WalkObjectContext *context, WalkFunc walk)
+{
+    if (this->heavyHitterCount == 0)
+    {
+        CandidateSink sink(context);
+        walk(sink);
+        return;
+    }
+
+    HeavyHitterSink sink(context, &this->hitterSketches[context->Worker], &this->hitterCandidates[context->Worker], &this->hotStrings);
+    walk(sink);
+}
+
+// Resolves the candidates one worker found against the shared table. Once the free
+// slots of the table are used up, candidates are only folded into canonical strings
+// that are already known.
+void DedupEngine::ResolveCandidates(int worker)
+{
+    if (!this->shortCandidates[worker].empty())
+    {
+        this->ResolveShortStrings(worker);
+    }
+
+    CanonicalStringTable &table = this->table;
+    std::vector<DedupCandidate> &buffer = this->candidates[worker];
+    std::vector<DedupRewrite> &rewrites = this->rewrites[worker];
+    ULONG stringBufferOffset = this->stringBufferOffset;
+    SIZE_T count = buffer.size();
+    SIZE_T &quota = this->insertQuotas[worker];
+    DedupPassCounters &counters = this->workerCounters[worker];
+    SIZE_T rewrittenBytes = 0;
+    SIZE_T probes = 0;
+    SIZE_T collisions = 0;
+    SIZE_T rewritesBefore = rewrites.size();
+    this->resolvedCounts[worker] += count;
+
+    for (SIZE_T i = 0; i < count; ++i)
+    {
+        // two stages ahead: first the table slot, then the string stored in it
+        if (table.GetCapacity() != 0)
+        {
+            if (i + PrefetchDistance < count)
+            {
+                PrefetchRead(table.GetSlot(buffer[i + PrefetchDistance].Hash, buffer[i + PrefetchDistance].Length));
+            }
+
+            if (i + PrefetchDistance / 2 < count)
+            {
+                ObjectID existing = table.GetSlot(buffer[i + PrefetchDistance / 2].Hash, buffer[i + PrefetchDistance / 2].Length)->Object.load(std::memory_order_relaxed);
+                if (existing != 0)
+                {
+                    PrefetchRead((PBYTE)existing + stringBufferOffset);
+                }
+            }
+        }
+
+        const DedupCandidate &candidate = buffer[i];
+        WCHAR *stringData = (WCHAR *)((PBYTE)candidate.String + stringBufferOffset);
+
+        auto equals = [=, &collisions](ObjectID existing) {
+            WCHAR *existingStringData = (WCHAR *)((PBYTE)existing + stringBufferOffset);
+            bool equal = StringHash::Equals(stringData, existingStringData, candidate.Length);
+            collisions += equal ? 0 : 1;
+            return equal;
+        };
+
+        if (quota == 0)
+        {
+            quota = this->ClaimInserts();
+        }
+
+        if (quota == 0)
+        {
+            ObjectID canonical = table.Find(candidate.Hash, candidate.Length, candidate.String, equals, &probes);
+            if (canonical == 0)
+            {
+                ++this->refusedCounts[worker];
+            }
+            else if (canonical != candidate.String)
+            {
+                rewrites.push_back(DedupRewrite{candidate.Slot, canonical});
+                rewrittenBytes += GetStringObjectSize(stringBufferOffset, candidate.Length);
+            }
+
+            continue;
+        }
+
+        bool inserted;
+        ObjectID canonical = table.FindOrInsert(candidate.Hash, candidate.Length, candidate.String, equals, &inserted, &probes);
+
+        if (canonical != candidate.String)
+        {
+            rewrites.push_back(DedupRewrite{candidate.Slot, canonical});
+            rewrittenBytes += GetStringObjectSize(stringBufferOffset, candidate.Length);
+        }
+        else if (inserted)
+        {
+            --quota;
+            ++this->insertedCounts[worker];
+            if (this->persistent)
+            {
+                this->newCanonicals[worker].push_back(canonical);
+            }
+        }
+    }
+
+    counters.HashProbes += probes;
+    counters.HashCollisions += collisions;
+    counters.Dedupes += rewrites.size() - rewritesBefore;
+    counters.BytesReclaimed += rewrittenBytes;
+    buffer.clear();
+}
+
+// Makes the lowest of the equal strings in one worker's buffer canonical, inserting
+// the ones not yet known as ResolveCandidates would. Nothing is rewritten, and the
+// buffer is kept for ResolveCandidates.
+void DedupEngine::ElectCanonicals(int worker)
+{
+    CanonicalStringTable &table = this->table;
+    const std::vector<DedupCandidate> &buffer = this->candidates[worker];
+    ULONG stringBufferOffset = this->stringBufferOffset;
+    SIZE_T count = buffer.size();
+    SIZE_T &quota = this->insertQuotas[worker];
+    SIZE_T probes = 0;
+    SIZE_T collisions = 0;
+
+    for (SIZE_T i = 0; i < count; ++i)
+    {
+        if (table.GetCapacity() != 0 && i + PrefetchDistance < count)
+        {
+            PrefetchRead(table.GetSlot(buffer[i + PrefetchDistance].Hash, buffer[i + PrefetchDistance].Length));
+        }
+
+        const DedupCandidate &candidate = buffer[i];
+        WCHAR *stringData = (WCHAR *)((PBYTE)candidate.String + stringBufferOffset);
+
+        auto equals = [=, &collisions](ObjectID existing) {
+            WCHAR *existingStringData = (WCHAR *)((PBYTE)existing + stringBufferOffset);
+            bool equal = StringHash::Equals(stringData, existingStringData, candidate.Length);
+            collisions += equal ? 0 : 1;
+            return equal;
+        };
+
+        auto prefer = [this, &candidate](ObjectID existing) {
+            return this->PreferCanonical(candidate.String, existing);
+        };
+
+        if (quota == 0)
+        {
+            quota = this->ClaimInserts();
+        }
+
+        bool inserted = false;
+        table.FindOrReplace(candidate.Hash, candidate.Length, candidate.String, equals, prefer, quota != 0 ? &inserted : nullptr, &probes);
+        if (inserted)
+        {
+            --quota;
+            ++this->insertedCounts[worker];
+        }
+    }
+
+    DedupPassCounters &counters = this->workerCounters[worker];
+    counters.HashProbes += probes;
+    counters.HashCollisions += collisions;
+}
+
+// Frozen strings and the canonical strings of earlier passes stay canonical, so that
+// slots already pointing at them are not rewritten again.
+bool DedupEngine::PreferCanonical(ObjectID string, ObjectID existing) const
+{
+    return string < existing && !this->IsFrozen(existing) && !(this->persistent && this->knownStrings.Contains(existing));
+}
+
+// Rewrites the short-string slots queued while canonical copies were elected to their
+// singleton, now that it is settled.
+void DedupEngine::ResolveShortStrings(int worker)
+{
+    std::vector<DedupRewrite> &shortCandidates = this->shortCandidates[worker];
+    std::vector<DedupRewrite> &rewrites = this->rewrites[worker];
+    DedupPassCounters &counters = this->workerCounters[worker];
+
+    for (const DedupRewrite &candidate : shortCandidates)
+    {
+        ULONG length = *(PULONG)((PBYTE)candidate.Canonical + this->stringLengthOffset);
+        ObjectID singleton = this->shortStrings[ShortStringIndex(candidate.Canonical, length, this->stringBufferOffset)].load(std::memory_order_relaxed);
+        if (singleton != candidate.Canonical)
+        {
+            rewrites.push_back(DedupRewrite{candidate.Slot, singleton});
+            ++counters.Dedupes;
+            counters.BytesReclaimed += GetStringObjectSize(this->stringBufferOffset, length);
+        }
+    }
+
+    shortCandidates.clear();
+}
+
+bool DedupEngine::IsFrozen(ObjectID object) const
+{
+    auto iter = std::upper_bound(this->frozenRanges.begin(), this->frozenRanges.end(), object, [](ObjectID value, const COR_PRF_GC_GENERATION_RANGE &range) {
+        return value < range.rangeStart;
+    });
+
+    return iter != this->frozenRanges.begin() && object - (iter - 1)->rangeStart < (iter - 1)->rangeLength;
+}
+
+void DedupEngine::FlushCandidates(int worker)
+{
+    if (this->electing)
+    {
+        this->ElectCanonicals(worker);
+    }
+
+    // the slots were all found by this worker in chunks only it walks, so they can be
+    // rewritten while the other workers are still walking
+    this->ResolveCandidates(worker);
+    this->RewriteSlots(worker);
+}
+
+void DedupEngine::SetInsertQuotas()
+{
+    this->insertPermits = this->table.GetInsertLimit();
+    std::fill(this->insertQuotas.begin(), this->insertQuotas.end(), 0);
+    std::fill(this->insertedCounts.begin(), this->insertedCounts.end(), 0);
+    std::fill(this->refusedCounts.begin(), this->refusedCounts.end(), 0);
+}
+
+// Workers take the free slots of the table in blocks as they need them, so a worker
+// that found more distinct strings than the others is not cut short.
+SIZE_T DedupEngine::ClaimInserts()
+{
+    SIZE_T available = this->insertPermits.load(std::memory_order_relaxed);
+    while (available != 0)
+    {
+        SIZE_T claim = available < InsertPermitBlock ? available : InsertPermitBlock;
+        if (this->insertPermits.compare_exchange_weak(available, available - claim, std::memory_order_relaxed))
+        {
+            return claim;
+        }
+    }
+
+    return 0;
+}
+
+// A quarter of the memory limit goes to the per-worker candidate and rewrite buffers,
+// the rest to the canonical table and, in persistent mode, the known-string set and
+// the strings added to it per pass.
+void DedupEngine::UpdateCandidateLimit()
+{
+    if (this->memoryLimit == 0)
+    {
+        this->candidateLimit = 0;
+        return;
+    }
+
+    SIZE_T perWorker = this->memoryLimit / CandidateMemoryShare / this->candidates.size();
+    this->candidateLimit = perWorker / (sizeof(DedupCandidate) + sizeof(DedupRewrite));
+    if (this->candidateLimit < ReferenceBatchSize)
+    {
+        this->candidateLimit = ReferenceBatchSize;
+    }
+}
+
+SIZE_T DedupEngine::GetMaxTableCapacity() const
+{
+    SIZE_T capacity = 0;
+    if (this->memoryLimit != 0)
+    {
+        SIZE_T slotBytes = sizeof(CanonicalStringEntry) + (this->persistent ? 2 * sizeof(ObjectID) : 0);
+        SIZE_T tableBytes = this->memoryLimit - this->memoryLimit / CandidateMemoryShare;
+
+        capacity = 1;
+        while (capacity * 2 * slotBytes <= tableBytes)
+        {
+            capacity *= 2;
+        }
+    }
+
+    if (this->heavyHitterCount != 0)
+    {
+        // room for twice the hot list at half load, so that in persistent mode the
+        // canonical copies of strings that went cold do not crowd out new ones at once
+        SIZE_T heavyCapacity = 1;
+        while (heavyCapacity < this->heavyHitterCount * 4)
+        {
+            heavyCapacity *= 2;
+        }
+
+        if (capacity == 0 || heavyCapacity < capacity)
+        {
+            capacity = heavyCapacity;
+        }
+    }
+
+    return capacity;
+}
+
+void DedupEngine::SetTimeBudget(uint32_t milliseconds)
+{
+    std::lock_guard<std::mutex> lock(this->passLock);
+    this->timeBudgetMilliseconds = milliseconds;
+    this->cursor = WalkCursor();
+}
+
+void DedupEngine::SetExtended(bool extended, uint32_t budgetMicroseconds)
+{
+    std::lock_guard<std::mutex> lock(this->passLock);
+    this->extended = extended;
+    this->extendedBudgetMicroseconds = budgetMicroseconds;
+}
+
+void DedupEngine::SetCanonicalPolicy(DedupCanonicalPolicy policy, bool seedFrozen)
+{
+    std::lock_guard<std::mutex> lock(this->passLock);
+    this->canonicalPolicy = policy;
+    this->seedFrozen = seedFrozen;
+}
+
+void DedupEngine::SetSampling(SIZE_T chunkStride, double minimumDuplicateRatio)
+{
+    std::lock_guard<std::mutex> lock(this->passLock);
+    this->samplingStride = chunkStride;
+    this->minimumDuplicateRatio = minimumDuplicateRatio;
+}
+
+void DedupEngine::SetLengthLimits(ULONG minimumLength, ULONG maximumLength)
+{
+    std::lock_guard<std::mutex> lock(this->passLock);
+    this->minimumLength = minimumLength != 0 ? minimumLength : 1;
+    this->maximumLength = maximumLength != 0 ? maximumLength : 0xFFFFFFFF;
+}
+
+void DedupEngine::SetFoldShortStrings(bool fold)
+{
+    std::lock_guard<std::mutex> lock(this->passLock);
+    this->foldShortStrings = fold;
+}
+
+void DedupEngine::SetMemoryLimit(SIZE_T bytes)
+{
+    std::lock_guard<std::mutex> lock(this->passLock);
+    this->memoryLimit = bytes;
+    this->UpdateCandidateLimit();
+}
+
+void DedupEngine::SetReportOnly(bool reportOnly, SIZE_T topStrings)
+{
+    std::lock_guard<std::mutex> lock(this->passLock);
+    this->reportOnly = reportOnly;
+    this->reportTopStrings = topStrings;
+    this->reportPending = false;
+    this->ResetReportBuilders();
+}
+
+// Allocates the per-worker report summaries before a report-only pass needs them. If
+// the sketches for the top strings cannot be allocated, reports leave them out.
+void DedupEngine::ResetReportBuilders()
+{
+    SIZE_T topStrings = this->reportOnly ? this->reportTopStrings : 0;
+    for (DedupReportBuilder &builder : this->reportBuilders)
+    {
+        if (!builder.Reset(topStrings))
+        {
+            this->reportTopStrings = topStrings = 0;
+            for (DedupReportBuilder &reset : this->reportBuilders)
+            {
+                reset.Reset(0);
+            }
+
+            break;
+        }
+    }
+}
+
+bool DedupEngine::TakeReport(DedupReport *report)
+{
+    std::lock_guard<std::mutex> lock(this->passLock);
+    if (!this->reportPending)
+    {
+        return false;
+    }
+
+    *report = std::move(this->report);
+    this->reportPending = false;
+    return true;
+}
+
+// Summarizes the duplicates counted by a report-only pass. Runs before the runtime
+// resumes, since it reads the top strings.
+void DedupEngine::BuildReport()
+{
+    DedupReport &report = this->report;
+    report = DedupReport();
+    report.Pass = this->passCount;
+    report.DistinctStrings = this->table.GetCount();
+    for (auto &singleton : this->shortStrings)
+    {
+        report.DistinctStrings += singleton.load(std::memory_order_relaxed) != 0 ? 1 : 0;
+    }
+
+    for (SIZE_T worker = 0; worker < this->reportBuilders.size(); ++worker)
+    {
+        report.StringReferences += this->resolvedCounts[worker];
+        report.UntrackedReferences += this->refusedCounts[worker];
+    }
+
+    if (this->reportBuilders.empty())
+    {
+        this->reportPending = true;
+        return;
+    }
+
+    DedupReportBuilder &summary = this->reportBuilders[0];
+    for (SIZE_T worker = 1; worker < this->reportBuilders.size(); ++worker)
+    {
+        summary.Merge(this->reportBuilders[worker]);
+    }
+
+    summary.Build(&report);
+
+    // every duplicate of a string has its size, so the references to a canonical copy
+    // give the bytes they hold
+    std::vector<std::pair<ObjectID, DedupReportString>> top;
+    summary.ForEachTop([this, &top](ObjectID canonical, SIZE_T references) {
+        DedupReportString string;
+        string.Length = *(PULONG)((PBYTE)canonical + this->stringLengthOffset);
+        string.Instances = references;
+        string.WastedBytes = references * GetStringObjectSize(this->stringBufferOffset, string.Length);
+        top.emplace_back(canonical, std::move(string));
+    });
+
+    std::sort(top.begin(), top.end(), [](const std::pair<ObjectID, DedupReportString> &left, const std::pair<ObjectID, DedupReportString> &right) {
+        return left.second.WastedBytes > right.second.WastedBytes;
+    });
+
+    if (top.size() > this->reportTopStrings)
+    {
+        top.resize(this->reportTopStrings);
+    }
+
+    for (auto &entry : top)
+    {
+        DedupReportString &string = entry.second;
+        WCHAR *text = (WCHAR *)((PBYTE)entry.first + this->stringBufferOffset);
+        string.Text.assign(text, text + (string.Length < DedupReport::MaxTextLength ? string.Length : DedupReport::MaxTextLength));
+        report.TopStrings.push_back(std::move(string));
+    }
+
+    this->reportPending = true;
+}
+
+bool DedupEngine::SetHeavyHitters(SIZE_T count)
+{
+    std::lock_guard<std::mutex> lock(this->passLock);
+    this->heavyHitterCount = count;
+    return this->ResetHeavyHitters();
+}
+
+// Sizes the counters and lists for the current heavy-hitter count and worker count,
+// dropping whatever earlier passes counted. Falls back to deduping every string if
+// they cannot be allocated.
+bool DedupEngine::ResetHeavyHitters()
+{
+    SIZE_T count = this->heavyHitterCount;
+    this->heavyHittersPending = false;
+
+    if (count == 0)
+    {
+        this->hitterCounts = CountMinSketch();
+        this->hotStrings = HeavyHitters();
+        this->nextHotStrings = HeavyHitters();
+        this->hitterSketches.clear();
+        this->hitterCandidates.clear();
+        return true;
+    }
+
+    this->hitterSketches.resize(this->candidates.size());
+    this->hitterCandidates.resize(this->candidates.size());
+
+    bool allocated = this->hitterCounts.Clear() && this->hotStrings.SetCapacity(count) && this->nextHotStrings.SetCapacity(count);
+    for (SIZE_T worker = 0; allocated && worker < this->hitterSketches.size(); ++worker)
+    {
+        allocated = this->hitterSketches[worker].Clear() && this->hitterCandidates[worker].SetCapacity(count);
+    }
+
+    if (!allocated)
+    {
+        this->heavyHitterCount = 0;
+        this->ResetHeavyHitters();
+    }
+
+    return allocated;
+}
+
+// Ages the counts kept so far, adds the ones of the last pass, and rebuilds the hot
+// list from the strings that were hot before and the ones each worker saw most.
+// Strings seen once are never hot, since they have nothing to be folded into.
+void DedupEngine::UpdateHeavyHitters()
+{
+    this->hitterCounts.Age();
+    for (auto &sketch : this->hitterSketches)
+    {
+        this->hitterCounts.Merge(sketch);
+        sketch.Clear();
+    }
+
+    this->nextHotStrings.Clear();
+    auto offer = [this](uint64_t hash, uint32_t) {
+        uint32_t count = this->hitterCounts.Estimate(hash);
+        if (count > 1)
+        {
+            this->nextHotStrings.Offer(hash, count);
+        }
+    };
+
+    this->hotStrings.ForEach(offer);
+    for (auto &seen : this->hitterCandidates)
+    {
+        seen.ForEach(offer);
+        seen.Clear();
+    }
+
+    std::swap(this->hotStrings, this->nextHotStrings);
+    this->heavyHittersPending = false;
+}
+
+void DedupEngine::PrepareNextPass()
+{
+    std::lock_guard<std::mutex> lock(this->passLock);
+
+    if (this->heavyHittersPending)
+    {
+        this->UpdateHeavyHitters();
+    }
+
+    if (this->reportOnly)
+    {
+        for (DedupReportBuilder &builder : this->reportBuilders)
+        {
+            builder.Clear();
+        }
+    }
+
+    // the strings the previous pass inserted or would have, plus a quarter for growth;
+    // with a limit and nothing to go by, as much as the limit allows
+    SIZE_T maxCapacity = this->GetMaxTableCapacity();
+    SIZE_T expectedStrings = this->previousStringCount + this->previousStringCount / 4;
+    if (expectedStrings == 0 && maxCapacity != 0)
+    {
+        expectedStrings = maxCapacity / 2;
+    }
+
+    // a lower limit takes effect here rather than during a pass; a persistent table
+    // keeps the canonical strings that still fit
+    SIZE_T capacity = this->table.GetCapacity();
+    this->table.Shrink(maxCapacity);
+    if (this->table.GetCapacity() != capacity)
+    {
+        this->LogTableResized(capacity);
+
+        // the set was sized for the larger table, so it is replaced rather than cleared
+        this->knownStrings = ObjectIdSet();
+        if (this->persistent)
+        {
+            this->RebuildKnownStrings();
+        }
+    }
+
+    this->table.Reserve(expectedStrings, maxCapacity);
+
+    SIZE_T insertLimit = this->table.GetInsertLimit();
+    if (this->persistent && this->table.GetCapacity() != 0)
+    {
+        this->knownStrings.Reserve(this->table.GetCount() + insertLimit);
+    }
+
+    SIZE_T candidateCapacity = this->candidateLimit != 0 ? this->candidateLimit : this->previousCandidatePeak + this->previousCandidatePeak / 4;
+    for (SIZE_T worker = 0; worker < this->candidates.size(); ++worker)
+    {
+        this->candidates[worker].reserve(candidateCapacity);
+        this->rewrites[worker].reserve(candidateCapacity);
+        if (this->canonicalPolicy == DedupCanonicalPolicy::LowestAddress && this->foldShortStrings)
+        {
+            this->shortCandidates[worker].reserve(candidateCapacity);
+        }
+        if (this->persistent)
+        {
+            this->newCanonicals[worker].reserve(insertLimit / this->candidates.size());
+        }
+    }
+}
+
+// Sizes the table once the walk has counted the candidates, which only happens without
+// a memory limit; growing it here reallocates while the runtime is suspended.
+void DedupEngine::ReserveTable(SIZE_T expected)
+{
+    SIZE_T capacity = this->table.GetCapacity();
+    this->table.Reserve(expected, this->GetMaxTableCapacity());
+    if (this->table.GetCapacity() != capacity)
+    {
+        this->LogTableResized(capacity);
+    }
+}
+
+void DedupEngine::LogTableResized(SIZE_T oldCapacity)
+{
+    if (this->eventLog != nullptr)
+    {
+        this->eventLog->Log(DedupEventKind::TableResized, 0, oldCapacity, this->table.GetCapacity());
+    }
+}
+
+void DedupEngine::RewriteSlots(int worker)
+{
+    std::vector<DedupRewrite> &rewrites = this->rewrites[worker];
+    SIZE_T count = rewrites.size();
+
+    if (this->reportOnly)
+    {
+        // the slots are left alone, so they still point at the duplicates
+        DedupReportBuilder &builder = this->reportBuilders[worker];
+        for (SIZE_T i = 0; i < count; ++i)
+        {
+            ObjectID duplicate = *rewrites[i].Slot;
+            ULONG length = *(PULONG)((PBYTE)duplicate + this->stringLengthOffset);
+            builder.Add(duplicate, rewrites[i].Canonical, length, GetStringObjectSize(this->stringBufferOffset, length));
+        }
+
+        rewrites.clear();
+        return;
+    }
+
+    for (SIZE_T i = 0; i < count; ++i)
+    {
+        if (i + PrefetchDistance < count)
+        {
+            PrefetchWrite(rewrites[i + PrefetchDistance].Slot);
+        }
+
+#ifdef DEDUP_TRACE_STRINGS
+        if (this->eventLog != nullptr)
+        {
+            this->eventLog->Log(DedupEventKind::StringDeduped, 0, (uint64_t)rewrites[i].Slot, rewrites[i].Canonical, *(PULONG)((PBYTE)rewrites[i].Canonical + this->stringLengthOffset));
+        }
+#endif
+
+        *rewrites[i].Slot = rewrites[i].Canonical;
+    }
+
+    rewrites.clear();
+}
+
+// The slots of the table a worker handles when a table-wide operation is spread over
+// the pool.
+static void SliceForWorker(SIZE_T capacity, int worker, int workerCount, SIZE_T *begin, SIZE_T *end)
+{
+    SIZE_T slice = (capacity + workerCount - 1) / workerCount;
+    *begin = slice * worker < capacity ? slice * worker : capacity;
+    *end = *begin + slice < capacity ? *begin + slice : capacity;
+}
+
+void DedupEngine::ClearTable()
+{
+    int workerCount = this->workerPool.GetWorkerCount();
+    this->workerPool.Run([&](int worker) {
+        SIZE_T begin, end;
+        SliceForWorker(this->table.GetCapacity(), worker, workerCount, &begin, &end);
+        this->table.ClearSlots(begin, end);
+    });
+
+    this->table.ResetCount();
+    this->knownStrings.Clear();
+}
+
+void DedupEngine::RebuildKnownStrings()
+{
+    this->knownStrings.Clear();
+    this->table.ForEach([this](ObjectID object) {
+        this->knownStrings.Insert(object);
+    });
+}
+
+void DedupEngine::SetPersistent(bool persistent)
+{
+    std::lock_guard<std::mutex> lock(this->passLock);
+    if (this->persistent && !persistent)
+    {
+        this->ClearTable();
+    }
+
+    this->persistent = persistent;
+}
+
+void DedupEngine::BeginRelocationTracking()
+{
+    std::lock_guard<std::mutex> lock(this->relocationLock);
+    this->relocationTracking = this->persistent || this->cursor.Object != 0;
+    this->relocationRanges.clear();
+}
+
+void DedupEngine::BeginRootTracking()
+{
+    std::lock_guard<std::mutex> lock(this->rootLock);
+    this->rootTracking = this->extended;
+    this->handleSlots.clear();
+}
+
+// The cursor points at an object start, or at the byte after the last object walked
+// if that object died. A surviving cursor object keeps its place; otherwise the pass
+// resumes at the first survivor above it. Compaction into other regions does not keep
+// address order, so a resumed cycle may skip or repeat some objects; both are harmless
+// as the next cycle starts over.
+void DedupEngine::RelocateCursor()
+{
+    if (this->cursor.Object == 0)
+    {
+        return;
+    }
+
+    const std::vector<RelocationRange> &ranges = this->relocationRanges;
+    ObjectID object = this->cursor.Object;
+
+    auto iter = std::upper_bound(ranges.begin(), ranges.end(), object, [](ObjectID value, const RelocationRange &range) {
+        return value < range.OldStart;
+    });
+
+    if (iter != ranges.begin() && object - (iter - 1)->OldStart < (iter - 1)->Length)
+    {
+        this->cursor.Object = (iter - 1)->NewStart + (object - (iter - 1)->OldStart);
+    }
+    else if (iter != ranges.end())
+    {
+        this->cursor.Object = iter->NewStart;
+    }
+    else
+    {
+        this->cursor = WalkCursor();
+    }
+}
+
+void DedupEngine::EndRelocationTracking()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->relocationLock);
+        if (!this->relocationTracking)
+        {
+            return;
+        }
+
+        this->relocationTracking = false;
+    }
+
+    std::lock_guard<std::mutex> lock(this->passLock);
+
+    if (this->relocationRanges.empty())
+    {
+        // nothing was reported for a gen2 collection, so the survivors are unknown
+        this->ClearTable();
+        this->cursor = WalkCursor();
+        return;
+    }
+
+    std::sort(this->relocationRanges.begin(), this->relocationRanges.end(), [](const RelocationRange &left, const RelocationRange &right) {
+        return left.OldStart < right.OldStart;
+    });
+
+    this->RelocateCursor();
+    if (!this->persistent)
+    {
+        return;
+    }
+
+    const std::vector<RelocationRange> &ranges = this->relocationRanges;
+    auto relocate = [&ranges](ObjectID object) -> ObjectID {
+        auto iter = std::upper_bound(ranges.begin(), ranges.end(), object, [](ObjectID value, const RelocationRange &range) {
+            return value < range.OldStart;
+        });
+
+        if (iter == ranges.begin())
+        {
+            return 0;
+        }
+
+        --iter;
+        if (object - iter->OldStart >= iter->Length)
+        {
+            return 0;
+        }
+
+        return iter->NewStart + (object - iter->OldStart);
+    };
+
+    // collect the survivors, clear, then reinsert them at their new addresses; each
+    // step is spread over the pool
+    int workerCount = this->workerPool.GetWorkerCount();
+    this->workerPool.Run([&](int worker) {
+        SIZE_T begin, end;
+        SliceForWorker(this->table.GetCapacity(), worker, workerCount, &begin, &end);
+        this->relocatedStrings[worker].clear();
+        this->table.CollectRelocated(begin, end, relocate, this->relocatedStrings[worker]);
+    });
+
+    this->ClearTable();
+
+    this->workerPool.Run([&](int worker) {
+        for (auto &string : this->relocatedStrings[worker])
+        {
+            this->table.InsertUnique(string);
+        }
+    });
+
+    for (auto &survivors : this->relocatedStrings)
+    {
+        this->table.AddCount(survivors.size());
+        survivors.clear();
+    }
+
+    this->RebuildKnownStrings();
+}
+
+// Returns false if the sampling pre-pass found the heap not worth a full walk.
+bool DedupEngine::WalkAll(const std::vector<COR_PRF_GC_GENERATION_RANGE> &ranges, std::atomic<HRESULT> &failure)
+{
+    std::atomic<SIZE_T> next(0);
+
+    this->rangeChunks.resize(ranges.size());
+    this->workerPool.Run([&](int worker) {
+        SIZE_T i;
+        while ((i = next++) < ranges.size())
+        {
+            HRESULT hr = this->PartitionRange(this->methodTableCaches[worker], ranges[i], this->rangeChunks[i]);
+            if (FAILED(hr))
+            {
+                RecordFailure(failure, hr);
+                return;
+            }
+        }
+    });
+
+    if (FAILED(failure.load()))
+    {
+        return true;
+    }
+
+    this->chunks.clear();
+    for (SIZE_T i = 0; i < ranges.size(); ++i)
+    {
+        this->chunks.insert(this->chunks.end(), this->rangeChunks[i].begin(), this->rangeChunks[i].end());
+    }
+
+    if (this->samplingStride != 0 && !this->SampleChunks(failure))
+    {
+        return false;
+    }
+
+    next = 0;
+    this->workerPool.Run([&](int worker) {
+        WalkObjectContext context(&this->generationIndex, this->stringMethodTable, this->stringLengthOffset, this->stringBufferOffset, this->minimumLength, this->maximumLength, &this->candidates[worker], this->persistent ? &this->knownStrings : nullptr, this->foldShortStrings ? this->shortStrings : nullptr, &this->methodTableCaches[worker], this, worker, this->candidateLimit, &this->workerCounters[worker]);
+        this->WithCandidateSink(&context, [&](auto &sink) {
+            SIZE_T i;
+            while ((i = next++) < this->chunks.size())
+            {
+                HRESULT hr = this->WalkChunk(&context, this->chunks[i], sink);
+                if (FAILED(hr))
+                {
+                    RecordFailure(failure, hr);
+                    return;
+                }
+            }
+        });
+    });
+
+    return true;
+}
+
+// Rewrites the references to gen2 strings from strong handles and from gen1 and gen0
+// objects to the canonical copies the pass found, handles first and the older objects
+// next, as they are the likelier to live until the next gen2 collection.
+void DedupEngine::RewriteExtended(const std::vector<COR_PRF_GC_GENERATION_RANGE> &objectRanges, std::atomic<HRESULT> &failure)
+{
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::microseconds(this->extendedBudgetMicroseconds);
+    bool budgeted = this->extendedBudgetMicroseconds != 0;
+
+    auto countDedupes = [this]() {
+        uint64_t dedupes = 0;
+        for (const DedupPassCounters &counters : this->workerCounters)
+        {
+            dedupes += counters.Dedupes;
+        }
+
+        return dedupes;
+    };
+
+    // lookups only, so the table keeps the size the gen2 walk gave it
+    this->insertPermits = 0;
+    std::fill(this->insertQuotas.begin(), this->insertQuotas.end(), 0);
+
+    uint64_t dedupes = countDedupes();
+    {
+        std::lock_guard<std::mutex> lock(this->rootLock);
+
+        WalkObjectContext context(&this->generationIndex, this->stringMethodTable, this->stringLengthOffset, this->stringBufferOffset, this->minimumLength, this->maximumLength, &this->candidates[0], this->persistent ? &this->knownStrings : nullptr, this->foldShortStrings ? this->shortStrings : nullptr, &this->methodTableCaches[0], this, 0, this->candidateLimit, &this->workerCounters[0]);
+        CandidateSink sink(&context);
+        StringReferenceVisitor<CandidateSink> visitor(&context, sink);
+        for (ObjectID *slot : this->handleSlots)
+        {
+            if (*slot != 0)
+            {
+                visitor.Visit(slot);
+            }
+        }
+
+        visitor.Flush();
+        visitor.AddCounters(context.Counters);
+        this->extendedCounters.HandleRoots = this->handleSlots.size();
+        this->handleSlots.clear();
+        this->rootTracking = false;
+    }
+
+    this->FlushCandidates(0);
+    this->extendedCounters.RootDedupes = countDedupes() - dedupes;
+    dedupes += this->extendedCounters.RootDedupes;
+
+    std::vector<COR_PRF_GC_GENERATION_RANGE> ranges;
+    for (auto &s : objectRanges)
+    {
+        if (s.generation < COR_PRF_GC_GEN_2 && s.rangeLength != 0)
+        {
+            ranges.push_back(s);
+        }
+    }
+
+    std::stable_sort(ranges.begin(), ranges.end(), [](const COR_PRF_GC_GENERATION_RANGE &left, const COR_PRF_GC_GENERATION_RANGE &right) { return left.generation > right.generation; });
+
+    // chunks are cut as workers ask for them, as in a budgeted gen2 walk, so that the
+    // budget also bounds the cutting
+    WalkCursor position{0, ranges.empty() ? 0 : ranges[0].rangeStart};
+    std::mutex positionLock;
+    std::atomic<bool> exceeded(false);
+
+    this->workerPool.Run([&](int worker) {
+        WalkObjectContext context(&this->generationIndex, this->stringMethodTable, this->stringLengthOffset, this->stringBufferOffset, this->minimumLength, this->maximumLength, &this->candidates[worker], this->persistent ? &this->knownStrings : nullptr, this->foldShortStrings ? this->shortStrings : nullptr, &this->methodTableCaches[worker], this, worker, this->candidateLimit, &this->workerCounters[worker]);
+        CandidateSink sink(&context);
+
+        while (true)
+        {
+            HeapChunk chunk;
+
+            {
+                std::lock_guard<std::mutex> lock(positionLock);
+                if (position.RangeIndex >= ranges.size() || FAILED(failure.load()))
+                {
+                    break;
+                }
+
+                if (budgeted && std::chrono::steady_clock::now() >= deadline)
+                {
+                    exceeded = true;
+                    break;
+                }
+
+                HRESULT hr = this->CutChunk(this->methodTableCaches[worker], ranges, position, &chunk);
+                if (FAILED(hr))
+                {
+                    RecordFailure(failure, hr);
+                    break;
+                }
+            }
+
+            HRESULT hr = this->WalkChunk(&context, chunk, sink);
+            if (FAILED(hr))
+            {
+                RecordFailure(failure, hr);
+                break;
+            }
+        }
+
+        this->FlushCandidates(worker);
+    });
+
+    this->extendedCounters.EphemeralDedupes = countDedupes() - dedupes;
+    this->extendedCounters.BudgetExceeded = exceeded ? 1 : 0;
+}
+
+// Inserts the strings in the frozen ranges into the table ahead of the walk and
+// returns how many were new. In heavy-hitter mode only the hot ones are seeded, as the
+// table is kept small.
+SIZE_T DedupEngine::SeedFrozenStrings(std::atomic<HRESULT> &failure)
+{
+    const std::vector<COR_PRF_GC_GENERATION_RANGE> &ranges = this->frozenRanges;
+    std::atomic<SIZE_T> next(0);
+
+    this->rangeChunks.resize(ranges.size());
+    this->workerPool.Run([&](int worker) {
+        SIZE_T i;
+        while ((i = next++) < ranges.size())
+        {
+            HRESULT hr = this->PartitionRange(this->methodTableCaches[worker], ranges[i], this->rangeChunks[i]);
+            if (FAILED(hr))
+            {
+                RecordFailure(failure, hr);
+                return;
+            }
+        }
+    });
+
+    if (FAILED(failure.load()))
+    {
+        return 0;
+    }
+
+    this->chunks.clear();
+    for (SIZE_T i = 0; i < ranges.size(); ++i)
+    {
+        this->chunks.insert(this->chunks.end(), this->rangeChunks[i].begin(), this->rangeChunks[i].end());
+    }
+
+    // the strings are collected in the candidate buffers, which are empty until the walk
+    next = 0;
+    this->workerPool.Run([&](int worker) {
+        MethodTableCache &methodTables = this->methodTableCaches[worker];
+        std::vector<DedupCandidate> &seeds = this->candidates[worker];
+
+        SIZE_T i;
+        while ((i = next++) < this->chunks.size())
+        {
+            ObjectID curr = this->chunks[i].Start;
+            ObjectID end = this->chunks[i].End;
+
+            while (curr < end)
+            {
+                const MethodTableInfo *info;
+                SIZE_T size;
+                HRESULT hr = this->GetObjectSize(methodTables, curr, &info, &size);
+                if (FAILED(hr))
+                {
+                    RecordFailure(failure, hr);
+                    return;
+                }
+
+                if (info->MethodTable == this->stringMethodTable)
+                {
+                    ULONG length = *(PULONG)((PBYTE)curr + this->stringLengthOffset);
+                    SIZE_T shortIndex = this->foldShortStrings ? ShortStringIndex(curr, length, this->stringBufferOffset) : ShortStringCount;
+                    if (shortIndex != ShortStringCount)
+                    {
+                        ObjectID none = 0;
+                        this->shortStrings[shortIndex].compare_exchange_strong(none, curr, std::memory_order_relaxed);
+                    }
+                    else if (length >= this->minimumLength && length <= this->maximumLength)
+                    {
+                        uint64_t hash = StringHash::Hash((WCHAR *)((PBYTE)curr + this->stringBufferOffset), length);
+                        if (this->heavyHitterCount == 0 || this->hotStrings.Contains(hash))
+                        {
+                            seeds.push_back(DedupCandidate{nullptr, curr, hash, length});
+                        }
+                    }
+                }
+
+                curr = (ObjectID)(align_up((SIZE_T)curr + size, sizeof(SIZE_T)));
+            }
+        }
+    });
+
+    SIZE_T total = 0;
+    for (auto &seeds : this->candidates)
+    {
+        total += seeds.size();
+    }
+
+    if (this->memoryLimit == 0)
+    {
+        this->ReserveTable(total);
+        this->SetInsertQuotas();
+    }
+
+    this->workerPool.Run([&](int worker) {
+        std::vector<DedupCandidate> &seeds = this->candidates[worker];
+        SIZE_T &quota = this->insertQuotas[worker];
+        ULONG stringBufferOffset = this->stringBufferOffset;
+
+        for (const DedupCandidate &seed : seeds)
+        {
+            WCHAR *stringData = (WCHAR *)((PBYTE)seed.String + stringBufferOffset);
+            auto equals = [=](ObjectID existing) {
+                return StringHash::Equals(stringData, (WCHAR *)((PBYTE)existing + stringBufferOffset), seed.Length);
+            };
+
+            if (quota == 0 && (quota = this->ClaimInserts()) == 0)
+            {
+                break;
+            }
+
+            bool inserted;
+            this->table.FindOrInsert(seed.Hash, seed.Length, seed.String, equals, &inserted);
+            if (inserted)
+            {
+                --quota;
+                ++this->insertedCounts[worker];
+                if (this->persistent)
+                {
+                    this->newCanonicals[worker].push_back(seed.String);
+                }
+            }
+        }
+
+        seeds.clear();
+    });
+
+    // counted now, as the quotas are set again once the walk is done
+    SIZE_T seeded = 0;
+    for (SIZE_T &inserted : this->insertedCounts)
+    {
+        seeded += inserted;
+        inserted = 0;
+    }
+
+    this->table.AddCount(seeded);
+    return seeded;
+}
+
+// Walks every samplingStride-th chunk and estimates the share of the string references
+// in them that point at a string with an equal copy elsewhere in the sample. Returns
+// false if that share is below the threshold. Duplicates that span chunks are only
+// seen when both chunks are sampled, so the estimate errs low for large strides.
+bool DedupEngine::SampleChunks(std::atomic<HRESULT> &failure)
+{
+    std::atomic<SIZE_T> next(0);
+    std::vector<SIZE_T> counts(this->samplers.size());
+
+    this->workerPool.Run([&](int worker) {
+        // sampled chunks are walked again, so they are not counted
+        DedupPassCounters counters = {};
+        WalkObjectContext context(&this->generationIndex, this->stringMethodTable, this->stringLengthOffset, this->stringBufferOffset, this->minimumLength, this->maximumLength, nullptr, this->persistent ? &this->knownStrings : nullptr, this->foldShortStrings ? this->shortStrings : nullptr, &this->methodTableCaches[worker], this, worker, 0, &counters);
+        this->samplers[worker].Clear();
+        SampleSink sink(&this->samplers[worker]);
+
+        SIZE_T i;
+        while ((i = next++ * this->samplingStride) < this->chunks.size())
+        {
+            HRESULT hr = this->WalkChunk(&context, this->chunks[i], sink);
+            if (FAILED(hr))
+            {
+                RecordFailure(failure, hr);
+                break;
+            }
+        }
+
+        counts[worker] = sink.GetCount();
+    });
+
+    SIZE_T sampled = 0;
+    for (SIZE_T worker = 0; worker < this->samplers.size(); ++worker)
+    {
+        sampled += counts[worker];
+        if (worker != 0)
+        {
+            this->samplers[0].Merge(this->samplers[worker]);
+        }
+    }
+
+    double distinct = sampled == 0 ? 0 : this->samplers[0].Estimate();
+    if (distinct > (double)sampled)
+    {
+        distinct = (double)sampled;
+    }
+
+    this->lastSample.SampledReferences = sampled;
+    this->lastSample.DistinctStrings = distinct;
+    this->lastSample.DuplicateRatio = sampled == 0 ? 0 : 1.0 - distinct / sampled;
+
+    return SUCCEEDED(failure.load()) && sampled != 0 && this->lastSample.DuplicateRatio >= this->minimumDuplicateRatio;
+}
+
+WalkCursor DedupEngine::ResumePosition(const std::vector<COR_PRF_GC_GENERATION_RANGE> &ranges) const
+{
+    ObjectID object = this->cursor.Object;
+    if (object != 0)
+    {
+        auto contains = [object](const COR_PRF_GC_GENERATION_RANGE &range) {
+            return object >= range.rangeStart && object - range.rangeStart < range.rangeLength;
+        };
+
+        if (this->cursor.RangeIndex < ranges.size() && contains(ranges[this->cursor.RangeIndex]))
+        {
+            return this->cursor;
+        }
+
+        // the ranges changed since the last pass; find the cursor by address
+        for (SIZE_T i = 0; i < ranges.size(); ++i)
+        {
+            if (contains(ranges[i]))
+            {
+                return WalkCursor{i, object};
+            }
+
+            if (ranges[i].rangeStart > object)
+            {
+                return WalkCursor{i, ranges[i].rangeStart};
+            }
+        }
+    }
+
+    return WalkCursor{0, ranges.empty() ? 0 : ranges[0].rangeStart};
+}
+
+void DedupEngine::WalkBudgeted(std::vector<COR_PRF_GC_GENERATION_RANGE> &ranges, std::chrono::steady_clock::time_point deadline, std::atomic<HRESULT> &failure)
+{
+    std::sort(ranges.begin(), ranges.end(), [](const COR_PRF_GC_GENERATION_RANGE &left, const COR_PRF_GC_GENERATION_RANGE &right) {
+        return left.rangeStart < right.rangeStart;
+    });
+
+    WalkCursor position = this->ResumePosition(ranges);
+    std::mutex positionLock;
+
+    this->workerPool.Run([&](int worker) {
+        WalkObjectContext context(&this->generationIndex, this->stringMethodTable, this->stringLengthOffset, this->stringBufferOffset, this->minimumLength, this->maximumLength, &this->candidates[worker], this->persistent ? &this->knownStrings : nullptr, this->foldShortStrings ? this->shortStrings : nullptr, &this->methodTableCaches[worker], this, worker, this->candidateLimit, &this->workerCounters[worker]);
+        this->WithCandidateSink(&context, [&](auto &sink) {
+            while (true)
+            {
+                HeapChunk chunk;
+
+                {
+                    std::lock_guard<std::mutex> lock(positionLock);
+                    if (position.RangeIndex >= ranges.size() || FAILED(failure.load()) || std::chrono::steady_clock::now() >= deadline)
+                    {
+                        return;
+                    }
+
+                    HRESULT hr = this->CutChunk(this->methodTableCaches[worker], ranges, position, &chunk);
+                    if (FAILED(hr))
+                    {
+                        RecordFailure(failure, hr);
+                        return;
+                    }
+                }
+
+                HRESULT hr = this->WalkChunk(&context, chunk, sink);
+                if (FAILED(hr))
+                {
+                    RecordFailure(failure, hr);
+                    return;
+                }
+            }
+        });
+    });
+
+    if (FAILED(failure.load()) || position.RangeIndex >= ranges.size())
+    {
+        // the cycle is complete, or the heap could not be walked from here
+        this->cursor = WalkCursor();
+    }
+    else
+    {
+        this->cursor = position;
+    }
+}
+
+HRESULT DedupEngine::Run(const std::vector<COR_PRF_GC_GENERATION_RANGE> &objectRanges)
+{
+    std::lock_guard<std::mutex> lock(this->passLock);
+
+    auto start = std::chrono::steady_clock::now();
+    ++this->passCount;
+    std::fill(this->workerCounters.begin(), this->workerCounters.end(), DedupPassCounters());
+    // counted from the walk on, as short strings are folded while walking
+    std::fill(this->resolvedCounts.begin(), this->resolvedCounts.end(), 0);
+    this->extendedCounters = DedupExtendedCounters();
+    this->frozenRanges.clear();
+    for (auto &singleton : this->shortStrings)
+    {
+        singleton.store(0, std::memory_order_relaxed);
+    }
+
+    std::vector<COR_PRF_GC_GENERATION_RANGE> ranges;
+
+    for (auto &s : objectRanges)
+    {
+        if (s.generation < COR_PRF_GC_GEN_2)
+        {
+            continue;
+        }
+
+        BOOL frozen;
+        IfFailRet(this->heapInfo->IsFrozenObject(s.rangeStart, &frozen));
+
+        if (frozen)
+        {
+            this->frozenRanges.push_back(s);
+            continue;
+        }
+
+        ranges.push_back(s);
+    }
+
+    std::sort(this->frozenRanges.begin(), this->frozenRanges.end(), [](const COR_PRF_GC_GENERATION_RANGE &left, const COR_PRF_GC_GENERATION_RANGE &right) {
+        return left.rangeStart < right.rangeStart;
+    });
+
+    this->generationIndex.Build(objectRanges);
+
+    if (this->memoryLimit != 0)
+    {
+        // the table was sized when the runtime last resumed and does not grow during
+        // the pass; candidates are resolved whenever a worker's buffer fills up
+        this->SetInsertQuotas();
+    }
+
+    std::atomic<HRESULT> failure(S_OK);
+    SIZE_T seeded = 0;
+    if (this->seedFrozen && !this->frozenRanges.empty())
+    {
+        seeded = this->SeedFrozenStrings(failure);
+    }
+
+    this->electing = this->canonicalPolicy == DedupCanonicalPolicy::LowestAddress;
+    this->lastSample = DedupSampleEstimate();
+    if (this->timeBudgetMilliseconds == 0)
+    {
+        if (!this->WalkAll(ranges, failure))
+        {
+            // nothing was collected; a failed walk still returns its error
+            if (seeded != 0 && !this->persistent)
+            {
+                this->ClearTable();
+            }
+
+            HRESULT hr = FAILED(failure.load()) ? failure.load() : S_FALSE;
+            DedupPassCounters times = {};
+            times.WalkNanoseconds = ElapsedNanoseconds(start);
+            times.TotalNanoseconds = times.WalkNanoseconds;
+            this->FinishPass(hr, times);
+            return hr;
+        }
+    }
+    else
+    {
+        this->WalkBudgeted(ranges, start + std::chrono::milliseconds(this->timeBudgetMilliseconds), failure);
+    }
+
+    this->heavyHittersPending = this->heavyHitterCount != 0;
+
+    DedupPassCounters times = {};
+    auto walked = std::chrono::steady_clock::now();
+    times.WalkNanoseconds = ElapsedNanoseconds(start, walked);
+
+    // resolve even after a walk failure so buffers and tables are left empty for the
+    // next pass; every candidate recorded so far is a valid reference
+    SIZE_T total = 0;
+    SIZE_T peak = 0;
+    for (auto &buffer : this->candidates)
+    {
+        total += buffer.size();
+        peak = buffer.size() > peak ? buffer.size() : peak;
+    }
+
+    if (this->memoryLimit == 0)
+    {
+        // sized up front so no lookup finds the table full, and the slots prefetched
+        // during resolution stay put. A sample bounds the distinct strings well below
+        // the candidate count when most of them are duplicates; scaling the sampled
+        // distinct count by the stride overestimates, so the bound is safe.
+        SIZE_T expected = total;
+        if (this->lastSample.SampledReferences != 0)
+        {
+            double sampledDistinct = this->lastSample.DistinctStrings * this->samplingStride * 1.25;
+            if (sampledDistinct < (double)total)
+            {
+                expected = (SIZE_T)sampledDistinct;
+            }
+        }
+
+        this->ReserveTable(expected);
+        this->SetInsertQuotas();
+        this->previousCandidatePeak = peak;
+    }
+
+    if (this->electing)
+    {
+        // every canonical copy is elected before any slot is resolved against it
+        this->workerPool.Run([&](int worker) {
+            this->ElectCanonicals(worker);
+        });
+    }
+
+    this->workerPool.Run([&](int worker) {
+        this->ResolveCandidates(worker);
+    });
+
+    SIZE_T inserted = 0;
+    this->previousStringCount = seeded;
+    for (SIZE_T worker = 0; worker < this->insertedCounts.size(); ++worker)
+    {
+        inserted += this->insertedCounts[worker];
+        this->previousStringCount += this->insertedCounts[worker] + this->refusedCounts[worker];
+    }
+
+    this->table.AddCount(inserted);
+
+    auto resolved = std::chrono::steady_clock::now();
+    times.ResolveNanoseconds = ElapsedNanoseconds(walked, resolved);
+
+    this->workerPool.Run([&](int worker) {
+        this->RewriteSlots(worker);
+    });
+
+    times.RewriteNanoseconds = ElapsedNanoseconds(resolved);
+
+    if (this->extended && !this->reportOnly && SUCCEEDED(failure.load()))
+    {
+        // the young references are only looked up, so the copies stay as elected
+        this->electing = false;
+        auto rewritten = std::chrono::steady_clock::now();
+        this->RewriteExtended(objectRanges, failure);
+        this->extendedCounters.Nanoseconds = ElapsedNanoseconds(rewritten);
+    }
+
+    if (this->reportOnly)
+    {
+        this->BuildReport();
+    }
+
+    if (!this->persistent)
+    {
+        this->ClearTable();
+    }
+    else if (this->canonicalPolicy == DedupCanonicalPolicy::LowestAddress)
+    {
+        // the election replaced copies without recording which, so the set is rebuilt
+        for (auto &canonicals : this->newCanonicals)
+        {
+            canonicals.clear();
+        }
+
+        this->RebuildKnownStrings();
+    }
+    else
+    {
+        // only the strings that became canonical in this pass are new; a full rebuild
+        // is left to relocation, where every address changes
+        for (auto &canonicals : this->newCanonicals)
+        {
+            for (ObjectID canonical : canonicals)
+            {
+                this->knownStrings.Insert(canonical);
+            }
+
+            canonicals.clear();
+        }
+    }
+
+    times.TotalNanoseconds = ElapsedNanoseconds(start);
+    this->FinishPass(failure.load(), times);
+    return failure.load();
+}
+
+// Records a pass in the statistics and the event log, with the phase times in times
+// and everything else summed from what the workers counted.
+void DedupEngine::FinishPass(HRESULT hr, const DedupPassCounters &times)
+{
+    DedupPassCounters counters = {};
+    for (const DedupPassCounters &worker : this->workerCounters)
+    {
+        counters.Add(worker);
+    }
+
+    counters.WalkNanoseconds = times.WalkNanoseconds;
+    counters.ResolveNanoseconds = times.ResolveNanoseconds;
+    counters.RewriteNanoseconds = times.RewriteNanoseconds;
+    counters.TotalNanoseconds = times.TotalNanoseconds;
+
+    {
+        std::lock_guard<std::mutex> lock(this->statisticsLock);
+        ++this->statistics.Passes;
+        this->statistics.LastPass = counters;
+        this->statistics.Total.Add(counters);
+        ++this->statistics.PassDurations[DedupStatistics::DurationBucketFor(counters.TotalNanoseconds / 1000)];
+        this->statistics.LastExtended = this->extendedCounters;
+        this->statistics.TotalExtended.Add(this->extendedCounters);
+    }
+
+    if (this->eventLog != nullptr)
+    {
+        this->eventLog->Log(DedupEventKind::PassFinished, (uint32_t)hr, counters.TotalNanoseconds, counters.StringReferences, counters.Dedupes, counters.BytesReclaimed);
+    }
+}
+
+void DedupEngine::GetStatistics(DedupStatistics *statistics)
+{
+    std::lock_guard<std::mutex> lock(this->statisticsLock);
+
+    uint32_t size = statistics->Size < sizeof(DedupStatistics) ? statistics->Size : (uint32_t)sizeof(DedupStatistics);
+    memcpy(statistics, &this->statistics, size);
+    statistics->Size = size;
+    statistics->Version = DedupStatistics::VersionFitting(size);
+}
+
+void DedupEngine::RecordEventMaskFailure(HRESULT hr)
+{
+    std::lock_guard<std::mutex> lock(this->statisticsLock);
+
+    ++this->statistics.EventMaskFailures;
+    this->statistics.LastEventMaskResult = (uint32_t)hr;
+}
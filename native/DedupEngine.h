@@ -0,0 +1,502 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "cor.h"
+#include "corprof.h"
+#include "CanonicalStringTable.h"
+#include "CountMinSketch.h"
+#include "DedupReport.h"
+#include "DedupStatistics.h"
+#include "EventLog.h"
+#include "GenerationRangeIndex.h"
+#include "HeavyHitters.h"
+#include "HyperLogLog.h"
+#include "ManagedHeapInfo.h"
+#include "MethodTableCache.h"
+#include "ObjectIdSet.h"
+#include "WorkerPool.h"
+
+// A gen2 string reference found by the walk, waiting to be resolved against the
+// canonical table that owns its hash.
+struct DedupCandidate
+{
+    ObjectID *Slot;
+    ObjectID String;
+    uint64_t Hash;
+    ULONG Length;
+};
+
+// A slot whose string was found to have an earlier equal copy.
+struct DedupRewrite
+{
+    ObjectID *Slot;
+    ObjectID Canonical;
+};
+
+// An object-aligned slice of a generation range: Start is the first object in the
+// chunk and End is the first object after it.
+struct HeapChunk
+{
+    ObjectID Start;
+    ObjectID End;
+};
+
+// A range of objects reported by MovedReferences2 or SurvivingReferences2. Surviving
+// ranges have NewStart == OldStart.
+struct RelocationRange
+{
+    ObjectID OldStart;
+    ObjectID NewStart;
+    SIZE_T Length;
+};
+
+// Where a budgeted pass stopped: the next object to walk and the index, among the
+// gen2 ranges sorted by address, of the range that contains it. Object == 0 means the
+// next pass starts from the lowest range.
+struct WalkCursor
+{
+    SIZE_T RangeIndex;
+    ObjectID Object;
+};
+
+// Result of the sampling pre-pass of the last pass, all zero if it did not run.
+struct DedupSampleEstimate
+{
+    DedupSampleEstimate() : SampledReferences(0), DistinctStrings(0), DuplicateRatio(0)
+    {
+    }
+
+    SIZE_T SampledReferences;
+    double DistinctStrings;
+    double DuplicateRatio;
+};
+
+// Which of several equal strings becomes the canonical copy, among those not seeded
+// from frozen segments.
+enum class DedupCanonicalPolicy : uint32_t
+{
+    // the first one a worker resolves, which follows the walk order
+    FirstSeen,
+    // the one at the lowest address, which does not depend on the walk order and,
+    // on a segmented heap that compacts by sliding, is the oldest
+    LowestAddress,
+};
+
+// Empty strings and one-character ASCII strings are folded into singletons indexed by
+// their length and character rather than resolved against the canonical table.
+static const SIZE_T ShortStringCount = 1 + 128;
+
+class DedupEngine;
+
+struct WalkObjectContext
+{
+    WalkObjectContext(const GenerationRangeIndex *generationIndex, SIZE_T stringMethodTable, ULONG stringLengthOffset, ULONG stringBufferOffset, ULONG minimumLength, ULONG maximumLength, std::vector<DedupCandidate> *candidates, const ObjectIdSet *knownStrings, std::atomic<ObjectID> *shortStrings, MethodTableCache *methodTables, DedupEngine *engine, int worker, SIZE_T candidateLimit, DedupPassCounters *counters) : GenerationIndex(generationIndex), StringMethodTable(stringMethodTable), StringLengthOffset(stringLengthOffset), StringBufferOffset(stringBufferOffset), MinimumLength(minimumLength), MaximumLength(maximumLength), Candidates(candidates), KnownStrings(knownStrings), ShortStrings(shortStrings), MethodTables(methodTables), Engine(engine), Worker(worker), CandidateLimit(candidateLimit), Counters(counters)
+    {
+    }
+
+    const GenerationRangeIndex *GenerationIndex;
+    SIZE_T StringMethodTable;
+    ULONG StringLengthOffset;
+    ULONG StringBufferOffset;
+    ULONG MinimumLength;
+    ULONG MaximumLength;
+    std::vector<DedupCandidate> *Candidates;
+    const ObjectIdSet *KnownStrings;
+    // ShortStringCount singletons, or null if short strings are not folded
+    std::atomic<ObjectID> *ShortStrings;
+    MethodTableCache *MethodTables;
+    DedupEngine *Engine;
+    int Worker;
+    SIZE_T CandidateLimit;
+    DedupPassCounters *Counters;
+};
+
+// Runs a deduping pass over the gen2 and LOH ranges on a pool of workers.
+//
+// The pass has four phases, each of which is spread over the pool:
+//   1. large ranges are cut into object-aligned chunks by stepping over object sizes,
+//   2. chunks are walked and their reference slots batched; each batch is classified
+//      with the target objects prefetched ahead, and every gen2 string reference is
+//      hashed and appended to the buffer of the worker that found it,
+//   3. each worker resolves its own buffer against the shared lock-free canonical
+//      table, prefetching table slots and canonical strings ahead of the lookups,
+//   4. the slots whose string has an earlier equal copy are rewritten.
+// Resolving by worker rather than by hash shard keeps the load even when a few
+// strings account for most references. Keeping each phase to one kind of random
+// access lets the prefetches overlap the heap cache misses.
+//
+// With a time budget the walk stops at the first chunk boundary past the budget and
+// the next pass resumes from a cursor, so a pass only covers part of a large heap.
+// Chunks are then cut serially from the cursor as workers ask for them instead of
+// partitioning every range up front. Gen2 collections that move or sweep objects
+// translate the cursor through the reported survivor ranges. Without persistent mode
+// the canonical table only spans one pass, so strings are only deduped against the
+// part of the heap walked in the same pass.
+//
+// Memory is reserved when the runtime resumes (PrepareNextPass), sized from the
+// previous pass, so the pass itself normally does not allocate. With a memory limit
+// the table never grows during a pass: workers claim its free slots in blocks and once
+// they are used up only fold strings into canonical copies that are already known.
+// The candidate buffers are bounded too, and a worker resolves its buffer as soon as
+// it fills up. The transient buffers used to relocate a persistent table are not
+// counted against the limit. Lowering the limit shrinks the table when the runtime
+// next resumes, and a persistent table keeps only the canonical strings that fit.
+// Without a limit the table is sized once the walk has counted the candidates, so a
+// pass that finds more strings than the last one reallocates it while the runtime is
+// suspended; each such resize is logged as a TableResized event.
+//
+// In report-only mode the pass resolves candidates as usual but writes nothing into the
+// heap. Each worker summarizes the duplicates it finds in a fixed-size
+// DedupReportBuilder, allocated when report-only mode is set, and they are merged into
+// a DedupReport that is taken once the runtime resumes.
+//
+// In heavy-hitter mode the walk counts every gen2 string reference in a Count-Min
+// sketch and keeps the most referenced hashes in a top-K list, but only references to
+// strings found hot by earlier passes become candidates. The counts are merged and
+// aged, and the hot list rebuilt, when the runtime resumes. The canonical table then
+// stays at a fixed size of a few times K, so the first pass dedupes nothing and
+// strings that only become hot later are folded into canonical copies later too.
+//
+// In persistent mode the canonical table is kept between passes. Every gen2 collection
+// reports the objects that moved or survived, and the table is relocated (and dead
+// canonical strings evicted) before the next pass. References that already point at
+// a known canonical string are then skipped without hashing.
+//
+// In extended mode the pass goes on, after the gen2 slots are rewritten, to the strong
+// handles reported by RootReferences2 and then to the gen1 and gen0 ranges, and
+// rewrites their references to gen2 strings that have a canonical copy. These are only
+// looked up in the table, never inserted, so the table keeps the size the gen2 walk
+// gave it and a young reference costs no more than a lookup. Both sides of every such
+// rewrite are in gen2, so no card or handle age has to change. Handle slots are taken
+// from the root IDs, which CoreCLR sets to the slot's address for handle roots; the
+// profiling API does not promise that. Stack roots are not covered: the profiling API
+// reports what they point at but not where they are. The young ranges are cut into
+// small chunks, and with a budget no chunk is started once it has run out.
+//
+// With frozen seeding the strings in frozen segments are inserted before the walk, so
+// any heap string equal to one of them is folded into it: frozen strings never move
+// or die, and the runtime allocates string literals there. Interned strings that are
+// not frozen cannot be listed through the profiling API and are treated like any
+// other. Under the LowestAddress policy every worker first elects the lowest of the
+// equal strings it found, replacing a higher canonical copy in the table, and the
+// candidates are only resolved once all of them are done. Seeded strings and, in
+// persistent mode, those of earlier passes are never replaced, since references to
+// them are no longer tracked. A buffer resolved early under a memory limit only takes
+// part in the election with what the table holds at that point.
+//
+// References to empty strings and to one-character ASCII strings are folded while the
+// chunk is walked: the first such string a pass finds (or a frozen one, when seeding)
+// becomes the singleton for its character, and later references are queued for
+// rewriting at once, without a hash or a table probe. Parsers make many of these, and
+// the table would otherwise hold one entry for each. Other one-character strings are
+// resolved like longer ones. With LowestAddress the lowest such string becomes the
+// singleton instead, and the slots are queued with the candidates until it is settled.
+class DedupEngine
+{
+  public:
+    DedupEngine();
+
+    void Initialize(ManagedHeapInfo *heapInfo, SIZE_T stringMethodTable, ULONG stringLengthOffset, ULONG stringBufferOffset);
+
+    bool StartWorkers(int workerCount);
+    void StopWorkers();
+
+    int GetWorkerCount() const
+    {
+        return this->workerPool.GetWorkerCount();
+    }
+
+    HRESULT Run(const std::vector<COR_PRF_GC_GENERATION_RANGE> &objectRanges);
+
+    // Each pass logs a PassFinished event to log, if set, with the duration, string
+    // references, dedupes and bytes reclaimed as counted in DedupPassCounters.
+    void SetEventLog(EventLog *log)
+    {
+        this->eventLog = log;
+    }
+
+    // Copies the counters of the last pass and of all passes so far, up to
+    // statistics->Size bytes. Safe to call while a pass runs.
+    void GetStatistics(DedupStatistics *statistics);
+
+    // Counts a config whose event mask could not be set.
+    void RecordEventMaskFailure(HRESULT hr);
+
+    void SetPersistent(bool persistent);
+
+    bool IsPersistent() const
+    {
+        return this->persistent;
+    }
+
+    // 0 walks the whole heap on every pass.
+    void SetTimeBudget(uint32_t milliseconds);
+
+    uint32_t GetTimeBudget() const
+    {
+        return this->timeBudgetMilliseconds;
+    }
+
+    // Before walking the whole heap, walks one chunk in chunkStride and estimates the
+    // share of duplicate string references with HyperLogLog. Run returns S_FALSE
+    // without deduping when the share is below minimumDuplicateRatio, and otherwise
+    // sizes the canonical table from the estimate. 0 disables sampling. Budgeted
+    // passes are never sampled.
+    void SetSampling(SIZE_T chunkStride, double minimumDuplicateRatio);
+
+    const DedupSampleEstimate &GetLastSample() const
+    {
+        return this->lastSample;
+    }
+
+    // Only strings of minimumLength to maximumLength characters are hashed; the others
+    // are left as they are. Empty strings are never hashed, and a maximumLength of 0
+    // means no limit.
+    void SetLengthLimits(ULONG minimumLength, ULONG maximumLength);
+
+    // Folds empty and one-character ASCII strings into singletons whatever the length
+    // limits; on by default.
+    void SetFoldShortStrings(bool fold);
+
+    // Leaves the heap untouched and reports what a pass would have saved instead,
+    // listing the topStrings strings whose duplicates hold the most bytes.
+    void SetReportOnly(bool reportOnly, SIZE_T topStrings);
+
+    bool IsReportOnly() const
+    {
+        return this->reportOnly;
+    }
+
+    // Moves the report of the last report-only pass into *report. Returns false if
+    // no pass has run since the last call.
+    bool TakeReport(DedupReport *report);
+
+    // Only dedupes the `count` most referenced strings, as counted over the previous
+    // passes; 0 dedupes every string. Returns false if the counters could not be
+    // allocated, in which case every string is deduped.
+    bool SetHeavyHitters(SIZE_T count);
+
+    SIZE_T GetHeavyHitters() const
+    {
+        return this->heavyHitterCount;
+    }
+
+    // 0 for no limit. Covers the canonical table and the per-pass buffers.
+    void SetMemoryLimit(SIZE_T bytes);
+
+    SIZE_T GetMemoryLimit() const
+    {
+        return this->memoryLimit;
+    }
+
+    void SetExtended(bool extended, uint32_t budgetMicroseconds);
+
+    void SetCanonicalPolicy(DedupCanonicalPolicy policy, bool seedFrozen);
+
+    bool IsExtended() const
+    {
+        return this->extended;
+    }
+
+    // Reserves the memory the next pass is expected to need. Called once the runtime
+    // has resumed, so the allocations stay out of the pause.
+    void PrepareNextPass();
+
+    // Called from GarbageCollectionStarted for collections that condemn gen2.
+    void BeginRelocationTracking();
+
+    template <typename LengthType>
+    void AddMovedReferences(ULONG cRanges, ObjectID oldStart[], ObjectID newStart[], LengthType length[])
+    {
+        std::lock_guard<std::mutex> lock(this->relocationLock);
+        if (!this->relocationTracking)
+        {
+            return;
+        }
+
+        for (ULONG i = 0; i < cRanges; ++i)
+        {
+            this->relocationRanges.push_back(RelocationRange{oldStart[i], newStart[i], (SIZE_T)length[i]});
+        }
+    }
+
+    template <typename LengthType>
+    void AddSurvivingReferences(ULONG cRanges, ObjectID start[], LengthType length[])
+    {
+        this->AddMovedReferences(cRanges, start, start, length);
+    }
+
+    // Called from GarbageCollectionFinished; relocates the persistent tables if the
+    // collection was tracked.
+    void EndRelocationTracking();
+
+    // Called from GarbageCollectionStarted; forgets the roots of the last collection.
+    void BeginRootTracking();
+
+    // Keeps the strong handles among the roots, in extended mode, as slots to rewrite.
+    // The profiling API only calls a root's ID an identifier; that CoreCLR passes the
+    // address of the handle's slot for handle roots is an implementation detail this
+    // relies on. Every other kind is skipped, since its ID is not a slot (a stack
+    // root's is a frame or function), and so are handles with any of ExcludedRootFlags.
+    void AddRootReferences(ULONG cRootRefs, COR_PRF_GC_ROOT_KIND rootKinds[], COR_PRF_GC_ROOT_FLAGS rootFlags[], UINT_PTR rootIds[])
+    {
+        std::lock_guard<std::mutex> lock(this->rootLock);
+        if (!this->rootTracking)
+        {
+            return;
+        }
+
+        for (ULONG i = 0; i < cRootRefs; ++i)
+        {
+            if (rootKinds[i] != COR_PRF_GC_ROOT_HANDLE || (rootFlags[i] & ExcludedRootFlags) != 0 || rootIds[i] == 0)
+            {
+                continue;
+            }
+
+            this->handleSlots.push_back((ObjectID *)rootIds[i]);
+        }
+    }
+
+  private:
+    friend class CandidateSink;
+
+    // A pinned handle's target address may be in use, an interior root does not point
+    // at an object's start, and a weak or ref-counted handle's target may be compared
+    // or handed back to native code.
+    static const DWORD ExcludedRootFlags = COR_PRF_GC_ROOT_PINNING | COR_PRF_GC_ROOT_INTERIOR | COR_PRF_GC_ROOT_WEAKREF | COR_PRF_GC_ROOT_REFCOUNTED;
+
+    HRESULT GetObjectSize(MethodTableCache &methodTables, ObjectID object, const MethodTableInfo **info, SIZE_T *size);
+    HRESULT PartitionRange(MethodTableCache &methodTables, const COR_PRF_GC_GENERATION_RANGE &range, std::vector<HeapChunk> &chunks);
+    HRESULT CutChunk(MethodTableCache &methodTables, const std::vector<COR_PRF_GC_GENERATION_RANGE> &ranges, WalkCursor &position, HeapChunk *chunk);
+    template <typename Sink>
+    HRESULT WalkChunk(WalkObjectContext *context, const HeapChunk &chunk, Sink &sink);
+    template <typename WalkFunc>
+    void WithCandidateSink(WalkObjectContext *context, WalkFunc walk);
+    bool WalkAll(const std::vector<COR_PRF_GC_GENERATION_RANGE> &ranges, std::atomic<HRESULT> &failure);
+    void WalkBudgeted(std::vector<COR_PRF_GC_GENERATION_RANGE> &ranges, std::chrono::steady_clock::time_point deadline, std::atomic<HRESULT> &failure);
+    bool SampleChunks(std::atomic<HRESULT> &failure);
+    void RewriteExtended(const std::vector<COR_PRF_GC_GENERATION_RANGE> &objectRanges, std::atomic<HRESULT> &failure);
+    SIZE_T SeedFrozenStrings(std::atomic<HRESULT> &failure);
+    bool IsFrozen(ObjectID object) const;
+    bool PreferCanonical(ObjectID string, ObjectID existing) const;
+    void ResolveShortStrings(int worker);
+    void ElectCanonicals(int worker);
+    WalkCursor ResumePosition(const std::vector<COR_PRF_GC_GENERATION_RANGE> &ranges) const;
+    void RelocateCursor();
+    void ResolveCandidates(int worker);
+    void RewriteSlots(int worker);
+    void FlushCandidates(int worker);
+    void SetInsertQuotas();
+    SIZE_T ClaimInserts();
+    void UpdateCandidateLimit();
+    SIZE_T GetMaxTableCapacity() const;
+    void ClearTable();
+    void RebuildKnownStrings();
+    void BuildReport();
+    void ReserveTable(SIZE_T expected);
+    void LogTableResized(SIZE_T oldCapacity);
+    void ResetReportBuilders();
+    void FinishPass(HRESULT hr, const DedupPassCounters &times);
+    bool ResetHeavyHitters();
+    void UpdateHeavyHitters();
+
+    ManagedHeapInfo *heapInfo;
+    EventLog *eventLog;
+    SIZE_T stringMethodTable;
+    ULONG stringLengthOffset;
+    ULONG stringBufferOffset;
+
+    WorkerPool workerPool;
+    GenerationRangeIndex generationIndex;
+    CanonicalStringTable table;
+
+    bool persistent;
+    ObjectIdSet knownStrings;
+    std::mutex relocationLock;
+    bool relocationTracking;
+    std::vector<RelocationRange> relocationRanges;
+
+    uint32_t timeBudgetMilliseconds;
+    WalkCursor cursor;
+
+    bool extended;
+    uint32_t extendedBudgetMicroseconds;
+    DedupExtendedCounters extendedCounters;
+    std::mutex rootLock;
+    bool rootTracking;
+    std::vector<ObjectID *> handleSlots;
+
+    bool foldShortStrings;
+    // cleared at the start of every pass, as gen2 collections move the strings
+    std::atomic<ObjectID> shortStrings[ShortStringCount];
+
+    DedupCanonicalPolicy canonicalPolicy;
+    bool seedFrozen;
+    // set while the candidates of the gen2 walk are resolved under LowestAddress
+    bool electing;
+    // sorted by address
+    std::vector<COR_PRF_GC_GENERATION_RANGE> frozenRanges;
+
+    ULONG minimumLength;
+    ULONG maximumLength;
+
+    // held by a pass and by anything that changes the table or buffers between passes
+    std::mutex passLock;
+    SIZE_T memoryLimit;
+    SIZE_T candidateLimit;
+    SIZE_T previousStringCount;
+    SIZE_T previousCandidatePeak;
+
+    // one per worker, kept for the lifetime of the pool
+    std::vector<MethodTableCache> methodTableCaches;
+
+    // one per worker
+    std::vector<std::vector<DedupCandidate>> candidates;
+    std::vector<std::vector<DedupRewrite>> rewrites;
+    // short-string slots and the strings they hold, while canonical copies are elected
+    std::vector<std::vector<DedupRewrite>> shortCandidates;
+    std::vector<std::vector<ObjectID>> newCanonicals;
+    std::vector<std::vector<CanonicalString>> relocatedStrings;
+    std::atomic<SIZE_T> insertPermits;
+    std::vector<SIZE_T> insertQuotas;
+    std::vector<SIZE_T> insertedCounts;
+    std::vector<SIZE_T> refusedCounts;
+    std::vector<SIZE_T> resolvedCounts;
+    std::vector<DedupPassCounters> workerCounters;
+
+    SIZE_T samplingStride;
+    double minimumDuplicateRatio;
+    DedupSampleEstimate lastSample;
+    std::vector<HyperLogLog> samplers;
+    std::vector<std::vector<HeapChunk>> rangeChunks;
+    std::vector<HeapChunk> chunks;
+
+    std::mutex statisticsLock;
+    DedupStatistics statistics;
+
+    bool reportOnly;
+    SIZE_T reportTopStrings;
+    ULONGLONG passCount;
+    bool reportPending;
+    DedupReport report;
+
+    // one per worker
+    std::vector<DedupReportBuilder> reportBuilders;
+
+    SIZE_T heavyHitterCount;
+    bool heavyHittersPending;
+    CountMinSketch hitterCounts;
+    HeavyHitters hotStrings;
+    HeavyHitters nextHotStrings;
+
+    // one per worker
+    std::vector<CountMinSketch> hitterSketches;
+    std::vector<HeavyHitters> hitterCandidates;
+};
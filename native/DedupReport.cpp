@@ -0,0 +1,298 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <cstring>
+#include <string>
+#include "DedupReport.h"
+
+static const char BinaryMagic[4] = {'S', 'D', 'R', 'P'};
+static const uint32_t BinaryVersion = 1;
+
+DedupReport::DedupReport() : Pass(0), StringReferences(0), DistinctStrings(0), DuplicateReferences(0), DuplicateInstances(0), WastedBytes(0), UntrackedReferences(0)
+{
+    memset(this->LengthHistogram, 0, sizeof(this->LengthHistogram));
+}
+
+int DedupReport::BucketFor(ULONG length)
+{
+    int bucket = 0;
+    while (bucket < LengthBuckets - 1 && (length >> (bucket + 1)) != 0)
+    {
+        ++bucket;
+    }
+
+    return bucket;
+}
+
+DedupReportBuilder::DedupReportBuilder() : references(0)
+{
+    memset(this->bucketReferences, 0, sizeof(this->bucketReferences));
+    memset(this->bucketBytes, 0, sizeof(this->bucketBytes));
+}
+
+bool DedupReportBuilder::Reset(SIZE_T topStrings)
+{
+    this->Clear();
+
+    if (topStrings == 0)
+    {
+        this->canonicalCounts = CountMinSketch();
+        this->topCanonicals = HeavyHitters();
+        return true;
+    }
+
+    // tracking a few times as many canonical copies as are reported keeps the ones
+    // that only pass the others late in the walk
+    if (!this->canonicalCounts.Clear() || !this->topCanonicals.SetCapacity(topStrings * 4))
+    {
+        this->canonicalCounts = CountMinSketch();
+        this->topCanonicals = HeavyHitters();
+        return false;
+    }
+
+    return true;
+}
+
+void DedupReportBuilder::Clear()
+{
+    this->references = 0;
+    memset(this->bucketReferences, 0, sizeof(this->bucketReferences));
+    memset(this->bucketBytes, 0, sizeof(this->bucketBytes));
+    for (HyperLogLog &instances : this->instances)
+    {
+        instances.Clear();
+    }
+
+    if (this->canonicalCounts.IsAllocated())
+    {
+        this->canonicalCounts.Clear();
+    }
+
+    this->topCanonicals.Clear();
+}
+
+void DedupReportBuilder::Merge(const DedupReportBuilder &other)
+{
+    this->references += other.references;
+    for (int bucket = 0; bucket < DedupReport::LengthBuckets; ++bucket)
+    {
+        this->bucketReferences[bucket] += other.bucketReferences[bucket];
+        this->bucketBytes[bucket] += other.bucketBytes[bucket];
+        this->instances[bucket].Merge(other.instances[bucket]);
+    }
+
+    if (this->topCanonicals.GetCapacity() == 0)
+    {
+        return;
+    }
+
+    this->canonicalCounts.Merge(other.canonicalCounts);
+    other.topCanonicals.ForEach([this](uint64_t key, uint32_t) {
+        this->topCanonicals.Offer(key, this->canonicalCounts.Estimate(key));
+    });
+}
+
+void DedupReportBuilder::Build(DedupReport *report) const
+{
+    report->DuplicateReferences = this->references;
+
+    for (int bucket = 0; bucket < DedupReport::LengthBuckets; ++bucket)
+    {
+        SIZE_T references = this->bucketReferences[bucket];
+        if (references == 0)
+        {
+            continue;
+        }
+
+        double estimate = this->instances[bucket].Estimate();
+        SIZE_T instances = estimate < 1 ? 1 : estimate >= (double)references ? references : (SIZE_T)(estimate + 0.5);
+
+        DedupReportBucket &entry = report->LengthHistogram[bucket];
+        entry.Instances = instances;
+        entry.WastedBytes = (SIZE_T)((double)this->bucketBytes[bucket] * instances / references);
+
+        report->DuplicateInstances += entry.Instances;
+        report->WastedBytes += entry.WastedBytes;
+    }
+}
+
+// Appends text as a quoted CSV field, converting UTF-16 to UTF-8. Unpaired surrogates
+// are written as U+FFFD.
+static void AppendCsvText(std::string &line, const std::vector<WCHAR> &text)
+{
+    line.push_back('"');
+
+    for (SIZE_T i = 0; i < text.size(); ++i)
+    {
+        uint32_t c = (uint16_t)text[i];
+        if (c >= 0xD800 && c < 0xDC00 && i + 1 < text.size() && (uint16_t)text[i + 1] >= 0xDC00 && (uint16_t)text[i + 1] < 0xE000)
+        {
+            c = 0x10000 + ((c - 0xD800) << 10) + ((uint16_t)text[++i] - 0xDC00);
+        }
+        else if (c >= 0xD800 && c < 0xE000)
+        {
+            c = 0xFFFD;
+        }
+
+        if (c == '"')
+        {
+            line.append("\"\"");
+        }
+        else if (c < 0x80)
+        {
+            line.push_back((char)c);
+        }
+        else if (c < 0x800)
+        {
+            line.push_back((char)(0xC0 | (c >> 6)));
+            line.push_back((char)(0x80 | (c & 0x3F)));
+        }
+        else if (c < 0x10000)
+        {
+            line.push_back((char)(0xE0 | (c >> 12)));
+            line.push_back((char)(0x80 | ((c >> 6) & 0x3F)));
+            line.push_back((char)(0x80 | (c & 0x3F)));
+        }
+        else
+        {
+            line.push_back((char)(0xF0 | (c >> 18)));
+            line.push_back((char)(0x80 | ((c >> 12) & 0x3F)));
+            line.push_back((char)(0x80 | ((c >> 6) & 0x3F)));
+            line.push_back((char)(0x80 | (c & 0x3F)));
+        }
+    }
+
+    line.push_back('"');
+}
+
+DedupReportWriter::DedupReportWriter() : file(nullptr), format(DedupReportFormat::Csv)
+{
+}
+
+DedupReportWriter::~DedupReportWriter()
+{
+    this->Close();
+}
+
+HRESULT DedupReportWriter::Open(const WCHAR *path, DedupReportFormat format)
+{
+    this->Close();
+
+    if (path == nullptr)
+    {
+        this->file = stdout;
+        this->format = DedupReportFormat::Csv;
+        return S_OK;
+    }
+
+    this->file = _wfopen(path, format == DedupReportFormat::Binary ? L"wb" : L"w");
+    if (this->file == nullptr)
+    {
+        return E_FAIL;
+    }
+
+    this->format = format;
+
+    if (format == DedupReportFormat::Binary)
+    {
+        if (fwrite(BinaryMagic, sizeof(BinaryMagic), 1, this->file) != 1 || fwrite(&BinaryVersion, sizeof(BinaryVersion), 1, this->file) != 1)
+        {
+            this->Close();
+            return E_FAIL;
+        }
+    }
+
+    return S_OK;
+}
+
+void DedupReportWriter::Close()
+{
+    if (this->file != nullptr && this->file != stdout)
+    {
+        fclose(this->file);
+    }
+
+    this->file = nullptr;
+}
+
+HRESULT DedupReportWriter::Write(const DedupReport &report)
+{
+    if (this->file == nullptr)
+    {
+        return S_FALSE;
+    }
+
+    HRESULT hr = this->format == DedupReportFormat::Binary ? this->WriteBinary(report) : this->WriteCsv(this->file, report);
+    if (SUCCEEDED(hr) && fflush(this->file) != 0)
+    {
+        hr = E_FAIL;
+    }
+
+    return hr;
+}
+
+HRESULT DedupReportWriter::WriteCsv(FILE *stream, const DedupReport &report)
+{
+    std::string line;
+    char number[192];
+
+    snprintf(number, sizeof(number), "pass,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n", (unsigned long long)report.Pass, (unsigned long long)report.StringReferences, (unsigned long long)report.DistinctStrings, (unsigned long long)report.DuplicateReferences, (unsigned long long)report.DuplicateInstances, (unsigned long long)report.WastedBytes, (unsigned long long)report.UntrackedReferences);
+    line.append(number);
+
+    for (int bucket = 0; bucket < DedupReport::LengthBuckets; ++bucket)
+    {
+        const DedupReportBucket &counts = report.LengthHistogram[bucket];
+        if (counts.Instances == 0)
+        {
+            continue;
+        }
+
+        ULONG maxLength = bucket == DedupReport::LengthBuckets - 1 ? 0xFFFFFFFF : (2u << bucket) - 1;
+        snprintf(number, sizeof(number), "length,%llu,%u,%u,%llu,%llu\n", (unsigned long long)report.Pass, 1u << bucket, maxLength, (unsigned long long)counts.Instances, (unsigned long long)counts.WastedBytes);
+        line.append(number);
+    }
+
+    for (SIZE_T rank = 0; rank < report.TopStrings.size(); ++rank)
+    {
+        const DedupReportString &entry = report.TopStrings[rank];
+        snprintf(number, sizeof(number), "string,%llu,%llu,%u,%llu,%llu,", (unsigned long long)report.Pass, (unsigned long long)rank + 1, entry.Length, (unsigned long long)entry.Instances, (unsigned long long)entry.WastedBytes);
+        line.append(number);
+        AppendCsvText(line, entry.Text);
+        line.push_back('\n');
+    }
+
+    return fwrite(line.data(), 1, line.size(), stream) == line.size() ? S_OK : E_FAIL;
+}
+
+HRESULT DedupReportWriter::WriteBinary(const DedupReport &report)
+{
+    std::vector<uint8_t> record;
+    auto append = [&record](const void *data, SIZE_T size) {
+        record.insert(record.end(), (const uint8_t *)data, (const uint8_t *)data + size);
+    };
+
+    uint64_t fields[] = {report.Pass, report.StringReferences, report.DistinctStrings, report.DuplicateReferences, report.DuplicateInstances, report.WastedBytes, report.UntrackedReferences};
+    append(fields, sizeof(fields));
+
+    for (const DedupReportBucket &counts : report.LengthHistogram)
+    {
+        uint64_t bucket[] = {counts.Instances, counts.WastedBytes};
+        append(bucket, sizeof(bucket));
+    }
+
+    uint32_t stringCount = (uint32_t)report.TopStrings.size();
+    append(&stringCount, sizeof(stringCount));
+
+    for (const DedupReportString &entry : report.TopStrings)
+    {
+        uint32_t length = entry.Length;
+        uint64_t counts[] = {entry.Instances, entry.WastedBytes};
+        uint32_t textLength = (uint32_t)entry.Text.size();
+        append(&length, sizeof(length));
+        append(counts, sizeof(counts));
+        append(&textLength, sizeof(textLength));
+        append(entry.Text.data(), entry.Text.size() * sizeof(WCHAR));
+    }
+
+    return fwrite(record.data(), 1, record.size(), this->file) == record.size() ? S_OK : E_FAIL;
+}
@@ -0,0 +1,185 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "cor.h"
+#include "corprof.h"
+#include "CountMinSketch.h"
+#include "HeavyHitters.h"
+#include "HyperLogLog.h"
+
+// One of the strings with the most bytes held by its duplicates. Text is a copy of at
+// most MaxTextLength characters, taken while the runtime was suspended.
+struct DedupReportString
+{
+    ULONG Length;
+    SIZE_T Instances;
+    SIZE_T WastedBytes;
+    std::vector<WCHAR> Text;
+};
+
+// Duplicates whose length falls in [2^i, 2^(i+1)); the last bucket also holds
+// everything longer.
+struct DedupReportBucket
+{
+    SIZE_T Instances;
+    SIZE_T WastedBytes;
+};
+
+// What a report-only pass found. A duplicate instance is a string object with an
+// earlier equal copy; its whole size counts as wasted, however many references it has.
+// The instance counts and wasted bytes are estimates; see DedupReportBuilder.
+struct DedupReport
+{
+    static const int LengthBuckets = 16;
+    static const ULONG MaxTextLength = 128;
+
+    DedupReport();
+
+    static int BucketFor(ULONG length);
+
+    ULONGLONG Pass;
+    SIZE_T StringReferences;
+    SIZE_T DistinctStrings;
+    SIZE_T DuplicateReferences;
+    SIZE_T DuplicateInstances;
+    SIZE_T WastedBytes;
+    // references whose content was not in the table once the memory limit stopped it
+    // growing; they are in StringReferences, but neither their contents nor any
+    // duplicates among them are counted
+    SIZE_T UntrackedReferences;
+    DedupReportBucket LengthHistogram[LengthBuckets];
+    std::vector<DedupReportString> TopStrings;
+};
+
+// Summarizes the duplicates found by a report-only pass in a fixed amount of memory, so
+// that the pass allocates nothing however many duplicates the heap holds. Each worker
+// adds to its own builder, and the builders are merged once the pass is done.
+//
+// Duplicate instances are counted per length bucket with HyperLogLog over the
+// duplicates' addresses, so an object referenced from several slots is still counted
+// once, within the estimate's error; the bytes of a bucket are its instances times the
+// average size of the duplicates referenced. The strings whose duplicates hold the
+// most bytes come from a Count-Min sketch of the references to each canonical copy and
+// a list of the most referenced ones. Their counts are duplicate references, an upper
+// bound on their instances.
+class DedupReportBuilder
+{
+  public:
+    DedupReportBuilder();
+
+    // Allocates the sketches and empties them. Returns false if they could not be
+    // allocated.
+    bool Reset(SIZE_T topStrings);
+
+    // Empties the sketches for the next pass without allocating.
+    void Clear();
+
+    void Add(ObjectID duplicate, ObjectID canonical, ULONG length, SIZE_T size)
+    {
+        int bucket = DedupReport::BucketFor(length);
+        ++this->references;
+        ++this->bucketReferences[bucket];
+        this->bucketBytes[bucket] += size;
+        this->instances[bucket].Add(MixAddress(duplicate));
+
+        if (this->topCanonicals.GetCapacity() != 0)
+        {
+            uint64_t key = MixAddress(canonical);
+            this->topCanonicals.Offer(key, this->canonicalCounts.Add(key));
+        }
+    }
+
+    // Adds what other counted to this builder.
+    void Merge(const DedupReportBuilder &other);
+
+    // Fills in the duplicate counts and length histogram of report.
+    void Build(DedupReport *report) const;
+
+    // Calls func(canonical, references) for the most referenced canonical copies, in no
+    // particular order. Merge keeps what each builder kept.
+    template <typename Func>
+    void ForEachTop(Func func) const
+    {
+        this->topCanonicals.ForEach([this, &func](uint64_t key, uint32_t) {
+            func(UnmixAddress(key), (SIZE_T)this->canonicalCounts.Estimate(key));
+        });
+    }
+
+  private:
+    // A bijection, so that a canonical copy can be found again from its key
+    static uint64_t MixAddress(ObjectID object)
+    {
+        uint64_t value = (uint64_t)object;
+        value ^= value >> 33;
+        value *= 0xff51afd7ed558ccdull;
+        value ^= value >> 33;
+        value *= 0xc4ceb9fe1a85ec53ull;
+        value ^= value >> 33;
+        return value;
+    }
+
+    static ObjectID UnmixAddress(uint64_t value)
+    {
+        value ^= value >> 33;
+        value *= 0x9cb4b2f8129337dbull;
+        value ^= value >> 33;
+        value *= 0x4f74430c22a54005ull;
+        value ^= value >> 33;
+        return (ObjectID)value;
+    }
+
+    SIZE_T references;
+    SIZE_T bucketReferences[DedupReport::LengthBuckets];
+    SIZE_T bucketBytes[DedupReport::LengthBuckets];
+    HyperLogLog instances[DedupReport::LengthBuckets];
+    CountMinSketch canonicalCounts;
+    HeavyHitters topCanonicals;
+};
+
+enum class DedupReportFormat
+{
+    Csv,
+    Binary,
+};
+
+// Appends reports to a file, or as CSV to stdout. Until it is opened, reports are
+// dropped. The profiler takes the path from the STRING_DEDUP_REPORT environment
+// variable, writing the binary format when it ends in ".bin", and CSV to stdout when
+// it is "-".
+//
+// The CSV has one line per record, and the first field names the record:
+//   pass,<pass>,<string references>,<distinct strings>,<duplicate references>,<duplicate instances>,<wasted bytes>,<untracked references>
+//   length,<pass>,<min length>,<max length>,<duplicate instances>,<wasted bytes>
+//   string,<pass>,<rank>,<length>,<duplicate instances>,<wasted bytes>,"<text, UTF-8>"
+// Empty length buckets are left out.
+//
+// The binary file starts with the magic "SDRP" and a uint32 version (1), followed by
+// one record per pass, all little-endian: the seven pass fields as uint64, LengthBuckets
+// pairs of uint64 (instances, wasted bytes), a uint32 string count, and per string
+// the length as uint32, instances and wasted bytes as uint64, and a uint32 character
+// count followed by that many UTF-16 characters.
+class DedupReportWriter
+{
+  public:
+    DedupReportWriter();
+    ~DedupReportWriter();
+
+    // Writes to path, or as CSV to stdout if null.
+    HRESULT Open(const WCHAR *path, DedupReportFormat format);
+    void Close();
+
+    // Returns S_FALSE without writing if the writer is not open.
+    HRESULT Write(const DedupReport &report);
+
+  private:
+    HRESULT WriteCsv(FILE *stream, const DedupReport &report);
+    HRESULT WriteBinary(const DedupReport &report);
+
+    FILE *file;
+    DedupReportFormat format;
+};
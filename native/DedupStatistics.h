@@ -0,0 +1,156 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Counters of one pass, or summed over every pass. Mirrored by StringDedupPassCounters
+// in managed/StringDedupStatistics.cs.
+struct DedupPassCounters
+{
+    void Add(const DedupPassCounters &other)
+    {
+        this->ObjectsScanned += other.ObjectsScanned;
+        this->ReferencesVisited += other.ReferencesVisited;
+        this->StringReferences += other.StringReferences;
+        this->HashProbes += other.HashProbes;
+        this->HashCollisions += other.HashCollisions;
+        this->Dedupes += other.Dedupes;
+        this->BytesReclaimed += other.BytesReclaimed;
+        this->WalkNanoseconds += other.WalkNanoseconds;
+        this->ResolveNanoseconds += other.ResolveNanoseconds;
+        this->RewriteNanoseconds += other.RewriteNanoseconds;
+        this->TotalNanoseconds += other.TotalNanoseconds;
+    }
+
+    uint64_t ObjectsScanned;
+    // reference slots examined; long runs of slots count their null slots too
+    uint64_t ReferencesVisited;
+    // references to gen2 strings that were hashed
+    uint64_t StringReferences;
+    // canonical table slots examined
+    uint64_t HashProbes;
+    // table strings with the same hash and length but different characters
+    uint64_t HashCollisions;
+    // references rewritten to point at a canonical copy
+    uint64_t Dedupes;
+    // sizes of the strings those references pointed at; a duplicate referenced from
+    // several slots is counted for each, so this is an upper bound
+    uint64_t BytesReclaimed;
+    // walking also covers sampling, and with a memory limit the buffers resolved and
+    // rewritten whenever one fills up
+    uint64_t WalkNanoseconds;
+    uint64_t ResolveNanoseconds;
+    uint64_t RewriteNanoseconds;
+    uint64_t TotalNanoseconds;
+};
+
+// What the extended mode rewrote outside gen2, in one pass or summed over every pass.
+// These rewrites are included in the Dedupes and BytesReclaimed of the pass counters
+// too, and the time in their TotalNanoseconds.
+struct DedupExtendedCounters
+{
+    void Add(const DedupExtendedCounters &other)
+    {
+        this->EphemeralDedupes += other.EphemeralDedupes;
+        this->HandleRoots += other.HandleRoots;
+        this->RootDedupes += other.RootDedupes;
+        this->BudgetExceeded += other.BudgetExceeded;
+        this->Nanoseconds += other.Nanoseconds;
+    }
+
+    // references from gen0 and gen1 objects
+    uint64_t EphemeralDedupes;
+    // strong handles examined, and references from them rewritten
+    uint64_t HandleRoots;
+    uint64_t RootDedupes;
+    // passes where the budget ran out before every young object was walked
+    uint64_t BudgetExceeded;
+    uint64_t Nanoseconds;
+};
+
+// Everything the engine counted so far, as returned by GetStringDedupStatistics.
+// Mirrored by StringDedupStatistics in managed/StringDedupStatistics.cs; new fields
+// are only ever appended, with Version bumped. The caller sets Size to the size of its
+// own structure, and no more than that is written; Version is then the latest version
+// whose fields were all written.
+//
+// PassDurations is a log-linear histogram of pass durations in microseconds, in the
+// manner of HdrHistogram: below DurationSubBuckets each bucket is one microsecond
+// wide, and above it every power of two is split into DurationSubBuckets buckets, so
+// a bucket is within 1/DurationSubBuckets of the durations it holds. The last bucket
+// also holds everything longer.
+struct DedupStatistics
+{
+    static const uint32_t CurrentVersion = 3;
+    static const int DurationSubBucketBits = 3;
+    static const int DurationSubBuckets = 1 << DurationSubBucketBits;
+    static const int DurationBuckets = 256;
+
+    static int DurationBucketFor(uint64_t microseconds)
+    {
+        if (microseconds < (uint64_t)DurationSubBuckets)
+        {
+            return (int)microseconds;
+        }
+
+        int magnitude = 63;
+        while ((microseconds >> magnitude) == 0)
+        {
+            --magnitude;
+        }
+
+        int shift = magnitude - DurationSubBucketBits;
+        uint64_t bucket = (uint64_t)shift * DurationSubBuckets + (microseconds >> shift);
+        return bucket < (uint64_t)DurationBuckets ? (int)bucket : DurationBuckets - 1;
+    }
+
+    // The latest version whose fields all fit in size bytes, or 0 if not even version
+    // 1 does.
+    static uint32_t VersionFitting(size_t size)
+    {
+        if (size >= sizeof(DedupStatistics))
+        {
+            return CurrentVersion;
+        }
+
+        if (size >= offsetof(DedupStatistics, EventMaskFailures))
+        {
+            return 2;
+        }
+
+        return size >= offsetof(DedupStatistics, LastExtended) ? 1 : 0;
+    }
+
+    // The shortest duration, in microseconds, that falls in bucket.
+    static uint64_t DurationBucketLowerBound(int bucket)
+    {
+        if (bucket < 2 * DurationSubBuckets)
+        {
+            return (uint64_t)bucket;
+        }
+
+        int shift = bucket / DurationSubBuckets - 1;
+        return (uint64_t)(bucket - shift * DurationSubBuckets) << shift;
+    }
+
+    uint32_t Size;
+    uint32_t Version;
+    uint64_t Passes;
+    DedupPassCounters LastPass;
+    DedupPassCounters Total;
+    uint64_t PassDurations[DurationBuckets];
+
+    // version 2
+    DedupExtendedCounters LastExtended;
+    DedupExtendedCounters TotalExtended;
+
+    // version 3
+    // configs whose event mask could not be set, and so were applied without the
+    // persistent, extended and time-budget modes, and the HRESULT of the last one
+    uint32_t EventMaskFailures;
+    uint32_t LastEventMaskResult;
+};
+
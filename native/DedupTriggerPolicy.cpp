@@ -0,0 +1,107 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "DedupTriggerPolicy.h"
+
+DedupTriggerPolicy::DedupTriggerPolicy() : gen2Collections(0), gen2BytesAtLastPass(0), hasProcessedPass(false), lastDecision(DedupTriggerDecision::SkippedNotGen2), decisionCounts()
+{
+}
+
+void DedupTriggerPolicy::Configure(const DedupTriggerSettings &settings)
+{
+    this->settings = settings;
+    if (this->settings.EveryNthGen2 == 0)
+    {
+        this->settings.EveryNthGen2 = 1;
+    }
+}
+
+DedupTriggerDecision DedupTriggerPolicy::OnGarbageCollectionStarted(int cGenerations, BOOL generationCollected[], COR_PRF_GC_REASON reason)
+{
+    if (cGenerations <= COR_PRF_GC_GEN_2 || !generationCollected[COR_PRF_GC_GEN_2])
+    {
+        return DedupTriggerDecision::SkippedNotGen2;
+    }
+
+    if (this->settings.Mode == DedupTriggerMode::InducedOnly && reason != COR_PRF_GC_INDUCED)
+    {
+        return DedupTriggerDecision::SkippedNotInduced;
+    }
+
+    return DedupTriggerDecision::Processed;
+}
+
+DedupTriggerDecision DedupTriggerPolicy::OnGarbageCollectionFinished(DedupTriggerDecision started, bool blocking)
+{
+    if (started != DedupTriggerDecision::Processed)
+    {
+        return started;
+    }
+
+    if (!blocking)
+    {
+        return DedupTriggerDecision::SkippedNotBlocking;
+    }
+
+    ++this->gen2Collections;
+
+    if (this->settings.Mode == DedupTriggerMode::EveryNthGen2 && this->gen2Collections % this->settings.EveryNthGen2 != 0)
+    {
+        return DedupTriggerDecision::SkippedNotNthGen2;
+    }
+
+    return DedupTriggerDecision::Processed;
+}
+
+DedupTriggerDecision DedupTriggerPolicy::OnGen2Size(SIZE_T gen2Bytes)
+{
+    if (this->settings.Mode == DedupTriggerMode::Gen2Growth && this->hasProcessedPass)
+    {
+        if (gen2Bytes < this->gen2BytesAtLastPass)
+        {
+            // gen2 shrank since the last pass, measure growth from the new low point
+            this->gen2BytesAtLastPass = gen2Bytes;
+            return DedupTriggerDecision::SkippedInsufficientGrowth;
+        }
+
+        if (gen2Bytes - this->gen2BytesAtLastPass < this->settings.Gen2GrowthBytes)
+        {
+            return DedupTriggerDecision::SkippedInsufficientGrowth;
+        }
+    }
+
+    this->gen2BytesAtLastPass = gen2Bytes;
+    this->hasProcessedPass = true;
+    return DedupTriggerDecision::Processed;
+}
+
+void DedupTriggerPolicy::Record(DedupTriggerDecision decision)
+{
+    this->lastDecision = decision;
+    ++this->decisionCounts[(int)decision];
+}
+
+const char *DedupTriggerPolicy::DecisionToString(DedupTriggerDecision decision)
+{
+    switch (decision)
+    {
+    case DedupTriggerDecision::Processed:
+        return "Processed";
+    case DedupTriggerDecision::SkippedNotBlocking:
+        return "SkippedNotBlocking";
+    case DedupTriggerDecision::SkippedNotGen2:
+        return "SkippedNotGen2";
+    case DedupTriggerDecision::SkippedNotNthGen2:
+        return "SkippedNotNthGen2";
+    case DedupTriggerDecision::SkippedNotInduced:
+        return "SkippedNotInduced";
+    case DedupTriggerDecision::SkippedInsufficientGrowth:
+        return "SkippedInsufficientGrowth";
+    case DedupTriggerDecision::SkippedLowDuplication:
+        return "SkippedLowDuplication";
+    case DedupTriggerDecision::SkippedDisabled:
+        return "SkippedDisabled";
+    default:
+        return "Unknown";
+    }
+}
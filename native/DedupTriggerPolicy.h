@@ -0,0 +1,89 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include "cor.h"
+#include "corprof.h"
+
+// Which gen2 collections are allowed to run a deduping pass. Every mode requires a
+// full blocking gen2 collection; the other modes further thin out those collections,
+// and only blocking gen2 collections count towards EveryNthGen2.
+enum class DedupTriggerMode
+{
+    FullBlockingGen2,
+    EveryNthGen2,
+    InducedOnly,
+    Gen2Growth,
+};
+
+// Why a collection was processed or skipped. Kept as a dense enum so the policy can
+// keep one counter per value.
+enum class DedupTriggerDecision
+{
+    Processed,
+    SkippedNotBlocking,
+    SkippedNotGen2,
+    SkippedNotNthGen2,
+    SkippedNotInduced,
+    SkippedInsufficientGrowth,
+    SkippedLowDuplication,
+    SkippedDisabled,
+    Count,
+};
+
+struct DedupTriggerSettings
+{
+    DedupTriggerSettings() : Mode(DedupTriggerMode::FullBlockingGen2), EveryNthGen2(1), Gen2GrowthBytes(0)
+    {
+    }
+
+    DedupTriggerMode Mode;
+    ULONG EveryNthGen2;
+    SIZE_T Gen2GrowthBytes;
+};
+
+class DedupTriggerPolicy
+{
+  public:
+    DedupTriggerPolicy();
+
+    void Configure(const DedupTriggerSettings &settings);
+
+    // Called from GarbageCollectionStarted; decides based on the generations being
+    // collected and the reason. Whether the collection blocks is only known once it
+    // finishes, so Processed here is provisional and counts nothing.
+    DedupTriggerDecision OnGarbageCollectionStarted(int cGenerations, BOOL generationCollected[], COR_PRF_GC_REASON reason);
+
+    // Called from GarbageCollectionFinished with the decision OnGarbageCollectionStarted
+    // made for the same collection. Only a collection admitted so far that blocked
+    // counts towards EveryNthGen2. Gen2Growth can only be settled once the generation
+    // bounds are known, so it returns Processed and defers to OnGen2Size.
+    DedupTriggerDecision OnGarbageCollectionFinished(DedupTriggerDecision started, bool blocking);
+
+    // Called with the current gen2 + LOH size before a pass that was admitted by
+    // OnGarbageCollectionFinished.
+    DedupTriggerDecision OnGen2Size(SIZE_T gen2Bytes);
+
+    void Record(DedupTriggerDecision decision);
+
+    DedupTriggerDecision GetLastDecision() const
+    {
+        return this->lastDecision;
+    }
+
+    ULONGLONG GetDecisionCount(DedupTriggerDecision decision) const
+    {
+        return this->decisionCounts[(int)decision];
+    }
+
+    static const char *DecisionToString(DedupTriggerDecision decision);
+
+  private:
+    DedupTriggerSettings settings;
+    ULONGLONG gen2Collections;
+    SIZE_T gen2BytesAtLastPass;
+    bool hasProcessedPass;
+    DedupTriggerDecision lastDecision;
+    ULONGLONG decisionCounts[(int)DedupTriggerDecision::Count];
+};
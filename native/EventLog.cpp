@@ -0,0 +1,216 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <new>
+#include <system_error>
+#include "EventLog.h"
+
+static const char FileMagic[4] = {'S', 'D', 'E', 'V'};
+static const uint32_t FileVersion = 1;
+
+// How often the drain thread wakes up to empty the ring
+static const std::chrono::milliseconds DrainInterval(100);
+
+EventLog::EventLog() : mask(0), writePosition(0), readPosition(0), dropped(0), droppedReported(0), running(false), file(nullptr), stopping(false)
+{
+}
+
+EventLog::~EventLog()
+{
+    this->Stop();
+}
+
+HRESULT EventLog::Start(const WCHAR *path, SIZE_T capacity)
+{
+    this->Stop();
+
+    SIZE_T size = 1;
+    while (size < capacity)
+    {
+        size *= 2;
+    }
+
+    this->slots.reset(new (std::nothrow) Slot[size]);
+    if (this->slots == nullptr)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    for (SIZE_T i = 0; i < size; ++i)
+    {
+        this->slots[i].Sequence.store(i, std::memory_order_relaxed);
+    }
+
+    this->mask = size - 1;
+    this->writePosition = 0;
+    this->readPosition = 0;
+    this->dropped = 0;
+    this->droppedReported = 0;
+
+    if (path != nullptr)
+    {
+        this->file = _wfopen(path, L"wb");
+        if (this->file == nullptr)
+        {
+            return E_FAIL;
+        }
+
+        uint32_t eventSize = sizeof(DedupEvent);
+        fwrite(FileMagic, sizeof(FileMagic), 1, this->file);
+        fwrite(&FileVersion, sizeof(FileVersion), 1, this->file);
+        fwrite(&eventSize, sizeof(eventSize), 1, this->file);
+    }
+
+    this->stopping = false;
+
+    try
+    {
+        this->drainThread = std::thread(&EventLog::DrainMain, this);
+    }
+    catch (const std::system_error &)
+    {
+        if (this->file != nullptr)
+        {
+            fclose(this->file);
+            this->file = nullptr;
+        }
+
+        return E_FAIL;
+    }
+
+    this->running = true;
+    return S_OK;
+}
+
+void EventLog::Stop()
+{
+    if (!this->drainThread.joinable())
+    {
+        return;
+    }
+
+    this->running = false;
+
+    {
+        std::lock_guard<std::mutex> lock(this->stopLock);
+        this->stopping = true;
+    }
+
+    this->stopRequested.notify_one();
+    this->drainThread.join();
+
+    if (this->file != nullptr)
+    {
+        fclose(this->file);
+        this->file = nullptr;
+    }
+}
+
+void EventLog::DrainMain()
+{
+    std::unique_lock<std::mutex> lock(this->stopLock);
+
+    while (!this->stopping)
+    {
+        this->stopRequested.wait_for(lock, DrainInterval);
+
+        lock.unlock();
+        this->Drain();
+        lock.lock();
+    }
+
+    lock.unlock();
+
+    // an event still being published by a producer that saw the log running just
+    // before Stop is lost
+    this->Drain();
+}
+
+// Writes every published event in order, stopping at the first slot that was claimed
+// but not yet published.
+void EventLog::Drain()
+{
+    SIZE_T drained = 0;
+
+    while (true)
+    {
+        Slot &slot = this->slots[this->readPosition & this->mask];
+        if (slot.Sequence.load(std::memory_order_acquire) != this->readPosition + 1)
+        {
+            break;
+        }
+
+        DedupEvent event = slot.Event;
+        slot.Sequence.store(this->readPosition + this->mask + 1, std::memory_order_release);
+        ++this->readPosition;
+        ++drained;
+
+        this->WriteEvent(event);
+    }
+
+    uint64_t dropped = this->dropped.load(std::memory_order_relaxed);
+    if (dropped != this->droppedReported)
+    {
+        DedupEvent event = {};
+        event.Timestamp = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        event.Kind = (uint32_t)DedupEventKind::EventsDropped;
+        event.Values[0] = dropped - this->droppedReported;
+        this->droppedReported = dropped;
+        this->WriteEvent(event);
+    }
+
+    if (drained != 0)
+    {
+        fflush(this->file != nullptr ? this->file : stdout);
+    }
+}
+
+void EventLog::WriteEvent(const DedupEvent &event)
+{
+    if (this->file != nullptr)
+    {
+        fwrite(&event, sizeof(event), 1, this->file);
+        return;
+    }
+
+    printf("%llu %s status=0x%x %llu %llu %llu %llu\n", (unsigned long long)event.Timestamp, KindToString((DedupEventKind)event.Kind), event.Status, (unsigned long long)event.Values[0], (unsigned long long)event.Values[1], (unsigned long long)event.Values[2], (unsigned long long)event.Values[3]);
+}
+
+const char *EventLog::KindToString(DedupEventKind kind)
+{
+    switch (kind)
+    {
+    case DedupEventKind::RuntimeSuspendStarted:
+        return "RuntimeSuspendStarted";
+    case DedupEventKind::RuntimeSuspendFinished:
+        return "RuntimeSuspendFinished";
+    case DedupEventKind::RuntimeSuspendAborted:
+        return "RuntimeSuspendAborted";
+    case DedupEventKind::RuntimeResumeStarted:
+        return "RuntimeResumeStarted";
+    case DedupEventKind::RuntimeResumeFinished:
+        return "RuntimeResumeFinished";
+    case DedupEventKind::RuntimeThreadSuspended:
+        return "RuntimeThreadSuspended";
+    case DedupEventKind::RuntimeThreadResumed:
+        return "RuntimeThreadResumed";
+    case DedupEventKind::GarbageCollectionStarted:
+        return "GarbageCollectionStarted";
+    case DedupEventKind::GarbageCollectionFinished:
+        return "GarbageCollectionFinished";
+    case DedupEventKind::PassFinished:
+        return "PassFinished";
+    case DedupEventKind::StringDeduped:
+        return "StringDeduped";
+    case DedupEventKind::EventsDropped:
+        return "EventsDropped";
+    case DedupEventKind::SnapshotCaptured:
+        return "SnapshotCaptured";
+    case DedupEventKind::TableResized:
+        return "TableResized";
+    case DedupEventKind::EventMaskFailed:
+        return "EventMaskFailed";
+    default:
+        return "Unknown";
+    }
+}
@@ -0,0 +1,145 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "cor.h"
+#include "corprof.h"
+
+// Per-string events are compiled in only when this is defined, since a pass can
+// rewrite millions of references.
+// #define DEDUP_TRACE_STRINGS
+
+// What an event records. Status and Values are used as noted; unused ones are 0.
+enum class DedupEventKind : uint32_t
+{
+    RuntimeSuspendStarted,     // Status: COR_PRF_SUSPEND_REASON
+    RuntimeSuspendFinished,
+    RuntimeSuspendAborted,
+    RuntimeResumeStarted,
+    RuntimeResumeFinished,
+    RuntimeThreadSuspended,    // Values[0]: ThreadID
+    RuntimeThreadResumed,      // Values[0]: ThreadID
+    GarbageCollectionStarted,  // Status: COR_PRF_GC_REASON, Values[0]: bit mask of the generations collected
+    GarbageCollectionFinished, // Status: DedupTriggerDecision
+    PassFinished,              // Status: HRESULT, Values: duration in ns, string references, dedupes, bytes reclaimed
+    StringDeduped,             // Values: slot, canonical string, length; only with DEDUP_TRACE_STRINGS
+    EventsDropped,             // Values[0]: events lost because the ring was full; written by the drain thread
+    SnapshotCaptured,          // Status: HRESULT, Values[0]: bytes written
+    TableResized,              // Values: old and new canonical table capacity; only when a pass grows it or PrepareNextPass shrinks it
+    EventMaskFailed,           // Status: HRESULT, Values[0]: the event mask a config needed
+    Count,
+};
+
+// A fixed-size binary event. Timestamp is steady-clock nanoseconds.
+struct DedupEvent
+{
+    uint64_t Timestamp;
+    uint32_t Kind;
+    uint32_t Status;
+    uint64_t Values[4];
+};
+
+// Preallocated ring of events with a background thread that drains it to a file, so
+// that logging from a callback or a pass costs a few stores and no I/O or locks.
+//
+// Producers claim a slot with a compare-exchange on the write position, and each slot
+// carries a sequence number that tells the drain thread when its event is complete;
+// callbacks can come from more than one thread. When the ring is full the event is
+// dropped and counted rather than waiting. The drain thread polls, so producers
+// never signal it.
+//
+// The file starts with the magic "SDEV", a uint32 version (1) and a uint32 event size,
+// followed by DedupEvent records in little-endian. The profiler takes the path from
+// the STRING_DEDUP_EVENT_LOG environment variable; only when that is "-" are the
+// events printed to stdout as text instead.
+class EventLog
+{
+  public:
+    EventLog();
+    ~EventLog();
+
+    // Allocates room for capacity events (rounded up to a power of two) and starts the
+    // drain thread, writing to path, or stdout if null. Events logged before Start or
+    // after it failed are dropped.
+    HRESULT Start(const WCHAR *path, SIZE_T capacity);
+
+    // Drains what is left and stops the drain thread.
+    void Stop();
+
+    void Log(DedupEventKind kind, uint32_t status = 0, uint64_t value0 = 0, uint64_t value1 = 0, uint64_t value2 = 0, uint64_t value3 = 0)
+    {
+        if (!this->running.load(std::memory_order_relaxed))
+        {
+            return;
+        }
+
+        uint64_t position = this->writePosition.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Slot &slot = this->slots[position & this->mask];
+            int64_t lag = (int64_t)(slot.Sequence.load(std::memory_order_acquire) - position);
+
+            if (lag == 0)
+            {
+                if (this->writePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    slot.Event.Timestamp = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+                    slot.Event.Kind = (uint32_t)kind;
+                    slot.Event.Status = status;
+                    slot.Event.Values[0] = value0;
+                    slot.Event.Values[1] = value1;
+                    slot.Event.Values[2] = value2;
+                    slot.Event.Values[3] = value3;
+                    slot.Sequence.store(position + 1, std::memory_order_release);
+                    return;
+                }
+            }
+            else if (lag < 0)
+            {
+                // the slot still holds an event from one lap ago that was not drained
+                this->dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            else
+            {
+                position = this->writePosition.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    static const char *KindToString(DedupEventKind kind);
+
+  private:
+    struct Slot
+    {
+        std::atomic<uint64_t> Sequence;
+        DedupEvent Event;
+    };
+
+    void DrainMain();
+    void Drain();
+    void WriteEvent(const DedupEvent &event);
+
+    std::unique_ptr<Slot[]> slots;
+    SIZE_T mask;
+    std::atomic<uint64_t> writePosition;
+    uint64_t readPosition;
+    std::atomic<uint64_t> dropped;
+    uint64_t droppedReported;
+    std::atomic<bool> running;
+
+    FILE *file;
+    std::thread drainThread;
+    std::mutex stopLock;
+    std::condition_variable stopRequested;
+    bool stopping;
+};
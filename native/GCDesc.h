@@ -1,19 +1,6 @@
 #pragma once
 
-struct WalkObjectContext
-{
-    WalkObjectContext(ICorProfilerInfo10 *corProfilerInfo, SIZE_T stringMethodTable, std::unordered_map<ULONG, ObjectID> *hashToObjectIDMap, ULONG stringLengthOffset, ULONG stringBufferOffset) : CorProfilerInfo(corProfilerInfo), StringMethodTable(stringMethodTable), HashToObjectIDMap(hashToObjectIDMap), StringLengthOffset(stringLengthOffset), StringBufferOffset(stringBufferOffset)
-    {
-    }
-
-    ICorProfilerInfo10 *CorProfilerInfo;
-    SIZE_T StringMethodTable;
-    std::unordered_map<ULONG, ObjectID> *HashToObjectIDMap;
-    ULONG StringLengthOffset;
-    ULONG StringBufferOffset;
-};
-
-typedef HRESULT (*WalkObjectFunc)(WalkObjectContext *, ObjectID, int32_t);
+#include "MethodTableCache.h"
 
 static int ComputeSize(int series)
 {
@@ -88,7 +75,60 @@ class GCDesc
     {
     }
 
-    void WalkObject(PBYTE addr, SIZE_T size, WalkObjectContext *context, WalkObjectFunc refCallback)
+    // The GCDesc is stored immediately before the MethodTable: the series count in the
+    // preceding pointer-sized slot, and the series before that.
+    static GCDesc ForMethodTable(SIZE_T methodTable)
+    {
+        int entries = *(DWORD *)((SIZE_T)methodTable - sizeof(SIZE_T));
+        if (entries < 0)
+        {
+            entries = -entries;
+        }
+
+        int slots = 1 + entries * 2;
+
+        return GCDesc((uint8_t *)((SIZE_T)methodTable - (slots * sizeof(SIZE_T))), slots * sizeof(SIZE_T));
+    }
+
+    // Decodes the series into the flat form walked by WalkCachedObject. Positive series
+    // are appended to series; a repeating series appends its items to repeats and
+    // returns its start offset in repeatOffset.
+    void Decode(std::vector<PointerSeries> &series, std::vector<PointerRepeat> &repeats, SIZE_T *repeatOffset)
+    {
+        int32_t count = this->GetNumSeries();
+        int32_t highest = this->GetHighestSeries();
+        int32_t curr = highest;
+
+        *repeatOffset = 0;
+
+        if (count > 0)
+        {
+            int32_t lowest = this->GetLowestSeries();
+            do
+            {
+                PointerSeries decoded;
+                decoded.Offset = (SIZE_T)this->GetSeriesOffset(curr);
+                decoded.Size = this->GetSeriesSize(curr);
+                series.push_back(decoded);
+
+                curr -= sizeof(SIZE_T) * 2;
+            } while (curr >= lowest);
+        }
+        else
+        {
+            *repeatOffset = (SIZE_T)this->GetSeriesOffset(curr);
+            for (int32_t i = 0; i > count; i--)
+            {
+                PointerRepeat decoded;
+                decoded.Pointers = this->GetPointers(curr, i);
+                decoded.Skip = this->GetSkip(curr, i);
+                repeats.push_back(decoded);
+            }
+        }
+    }
+
+    template <typename Visitor>
+    void WalkObject(PBYTE addr, SIZE_T size, Visitor &visitor)
     {
         int32_t series = this->GetNumSeries();
         int32_t highest = this->GetHighestSeries();
@@ -107,7 +147,7 @@ class GCDesc
                     auto ret = *(SIZE_T *)ptr;
                     if (ret != 0)
                     {
-                        refCallback(context, (ObjectID)addr, (int32_t)(ptr - addr));
+                        visitor.Visit((ObjectID *)ptr);
                     }
 
                     ptr += sizeof(SIZE_T);
@@ -132,7 +172,7 @@ class GCDesc
                         auto ret = *(SIZE_T *)ptr;
                         if (ret != 0)
                         {
-                            refCallback(context, (ObjectID)addr, (int32_t)(ptr - addr));
+                            visitor.Visit((ObjectID *)ptr);
                         }
 
                         ptr += sizeof(SIZE_T);
@@ -143,4 +183,52 @@ class GCDesc
             }
         }
     }
-};
\ No newline at end of file
+};
+
+// Same traversal as GCDesc::WalkObject over series decoded once per MethodTable. A
+// positive series is one contiguous run of slots, which is handed to the visitor as a
+// whole so it can scan long runs such as object arrays in bulk.
+//
+// The visitor provides Visit(ObjectID *slot) for a single non-null slot and
+// VisitRun(ObjectID *slots, SIZE_T count) for a run that may contain nulls.
+template <typename Visitor>
+inline void WalkCachedObject(const MethodTableCache &methodTables, const MethodTableInfo *info, PBYTE addr, SIZE_T size, Visitor &visitor)
+{
+    if (info->RepeatCount == 0)
+    {
+        const PointerSeries *series = methodTables.GetSeries(info);
+        for (uint32_t s = 0; s < info->SeriesCount; ++s)
+        {
+            auto ptr = addr + series[s].Offset;
+            auto stop = ptr + series[s].Size + size;
+
+            if (ptr < stop)
+            {
+                visitor.VisitRun((ObjectID *)ptr, (SIZE_T)(stop - ptr) / sizeof(SIZE_T));
+            }
+        }
+    }
+    else
+    {
+        const PointerRepeat *repeats = methodTables.GetRepeats(info);
+        auto ptr = addr + info->RepeatOffset;
+        while (ptr < addr + size - sizeof(SIZE_T))
+        {
+            for (uint32_t i = 0; i < info->RepeatCount; ++i)
+            {
+                auto stop = ptr + (repeats[i].Pointers * sizeof(SIZE_T));
+                do
+                {
+                    if (*(SIZE_T *)ptr != 0)
+                    {
+                        visitor.Visit((ObjectID *)ptr);
+                    }
+
+                    ptr += sizeof(SIZE_T);
+                } while (ptr < stop);
+
+                ptr += repeats[i].Skip;
+            }
+        }
+    }
+}
@@ -0,0 +1,29 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <algorithm>
+#include "GenerationRangeIndex.h"
+
+void GenerationRangeIndex::Build(const std::vector<COR_PRF_GC_GENERATION_RANGE> &objectRanges)
+{
+    this->sorted.assign(objectRanges.begin(), objectRanges.end());
+    std::sort(this->sorted.begin(), this->sorted.end(), [](const COR_PRF_GC_GENERATION_RANGE &left, const COR_PRF_GC_GENERATION_RANGE &right) {
+        return left.rangeStart < right.rangeStart;
+    });
+
+    this->starts.clear();
+    this->ends.clear();
+    this->generations.clear();
+
+    for (auto &s : this->sorted)
+    {
+        if (s.rangeLength == 0)
+        {
+            continue;
+        }
+
+        this->starts.push_back(s.rangeStart);
+        this->ends.push_back(s.rangeStart + s.rangeLength);
+        this->generations.push_back((int)s.generation);
+    }
+}
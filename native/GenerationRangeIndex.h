@@ -0,0 +1,54 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "cor.h"
+#include "corprof.h"
+
+// Sorted copy of the generation bounds for the current collection, so the walk can
+// classify an ObjectID without calling GetObjectGeneration. Built once per pass;
+// lookups are a branch-free binary search over the range starts.
+class GenerationRangeIndex
+{
+  public:
+    static const int NoGeneration = -1;
+
+    void Build(const std::vector<COR_PRF_GC_GENERATION_RANGE> &objectRanges);
+
+    // Returns the COR_PRF_GC_GENERATION of the range holding object, or NoGeneration
+    // if it is outside every range (for example in a frozen segment).
+    int GetGeneration(ObjectID object) const
+    {
+        SIZE_T count = this->starts.size();
+        if (count == 0)
+        {
+            return NoGeneration;
+        }
+
+        // find the last range whose start is <= object
+        const ObjectID *base = this->starts.data();
+        while (count > 1)
+        {
+            SIZE_T half = count / 2;
+            base = (base[half] <= object) ? base + half : base;
+            count -= half;
+        }
+
+        SIZE_T index = base - this->starts.data();
+        if (object < *base || object >= this->ends[index])
+        {
+            return NoGeneration;
+        }
+
+        return this->generations[index];
+    }
+
+  private:
+    std::vector<ObjectID> starts;
+    std::vector<ObjectID> ends;
+    std::vector<int> generations;
+    std::vector<COR_PRF_GC_GENERATION_RANGE> sorted;
+};
@@ -0,0 +1,261 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <unordered_set>
+#include "HeapSnapshot.h"
+#include "MethodTableCache.h"
+#include "StringDedupingProfiler.h"
+
+static uint64_t AlignDown(uint64_t value)
+{
+    return value & ~(HeapSnapshotAlignment - 1);
+}
+
+static uint64_t AlignUp(uint64_t value)
+{
+    return align_up(value, HeapSnapshotAlignment);
+}
+
+static bool WriteBytes(FILE *file, const void *data, uint64_t size)
+{
+    return size == 0 || fwrite(data, (size_t)size, 1, file) == 1;
+}
+
+static bool WriteZeros(FILE *file, uint64_t size)
+{
+    static const char zeros[4096] = {};
+    while (size != 0)
+    {
+        size_t chunk = size < sizeof(zeros) ? (size_t)size : sizeof(zeros);
+        if (fwrite(zeros, chunk, 1, file) != 1)
+        {
+            return false;
+        }
+
+        size -= chunk;
+    }
+
+    return true;
+}
+
+// Walks the objects of every range and collects the MethodTables they use, and the sizes
+// of the objects whose size has to come from the runtime.
+static HRESULT CollectMethodTables(const std::vector<COR_PRF_GC_GENERATION_RANGE> &ranges, ManagedHeapInfo *heapInfo, std::vector<HeapSnapshotMethodTable> *methodTables, std::vector<HeapSnapshotObjectSize> *objectSizes)
+{
+    MethodTableCache cache;
+    std::unordered_set<SIZE_T> seen;
+
+    for (auto &range : ranges)
+    {
+        ObjectID curr = range.rangeStart;
+        ObjectID end = range.rangeStart + range.rangeLength;
+        SIZE_T last = 0;
+
+        while (curr < end)
+        {
+            SIZE_T methodTable = *(SIZE_T *)curr;
+            const MethodTableInfo *info = cache.Lookup(methodTable);
+
+            SIZE_T size;
+            if (!MethodTableCache::TryGetObjectSize(info, curr, &size))
+            {
+                HRESULT hr = heapInfo->GetObjectSize(curr, &size);
+                if (FAILED(hr))
+                {
+                    return hr;
+                }
+
+                objectSizes->push_back({(uint64_t)curr, (uint64_t)size});
+            }
+
+            if (size == 0)
+            {
+                return E_FAIL;
+            }
+
+            if (methodTable != last && seen.insert(methodTable).second)
+            {
+                SIZE_T start = methodTable;
+                if (info->ContainsPointerOrCollectible)
+                {
+                    int entries = *(DWORD *)(methodTable - sizeof(SIZE_T));
+                    if (entries < 0)
+                    {
+                        entries = -entries;
+                    }
+
+                    start = methodTable - (1 + entries * 2) * sizeof(SIZE_T);
+                }
+
+                HeapSnapshotMethodTable entry = {};
+                entry.Address = start;
+                entry.MethodTable = methodTable;
+                entry.Length = methodTable - start + sizeof(DWORD) * 2;
+                methodTables->push_back(entry);
+            }
+
+            last = methodTable;
+            curr = (ObjectID)(align_up((SIZE_T)curr + size, sizeof(SIZE_T)));
+        }
+    }
+
+    std::sort(objectSizes->begin(), objectSizes->end(), [](const HeapSnapshotObjectSize &left, const HeapSnapshotObjectSize &right) { return left.Object < right.Object; });
+    return S_OK;
+}
+
+// Rounds the ranges out to the alignment and merges those that then touch, so that no
+// two extents share an aligned block.
+static void BuildExtents(const std::vector<HeapSnapshotRange> &ranges, std::vector<HeapSnapshotExtent> *extents)
+{
+    std::vector<HeapSnapshotRange> sorted;
+    for (auto &range : ranges)
+    {
+        if (range.Length != 0)
+        {
+            sorted.push_back(range);
+        }
+    }
+
+    std::sort(sorted.begin(), sorted.end(), [](const HeapSnapshotRange &left, const HeapSnapshotRange &right) { return left.Start < right.Start; });
+
+    for (auto &range : sorted)
+    {
+        uint64_t start = AlignDown(range.Start);
+        uint64_t end = AlignUp(range.Start + range.Length);
+
+        if (!extents->empty() && start <= extents->back().Address + extents->back().Length)
+        {
+            HeapSnapshotExtent &previous = extents->back();
+            previous.Length = std::max(previous.Address + previous.Length, end) - previous.Address;
+            continue;
+        }
+
+        extents->push_back({start, end - start, 0});
+    }
+}
+
+HRESULT HeapSnapshotWriter::Write(const WCHAR *path, const std::vector<COR_PRF_GC_GENERATION_RANGE> &ranges, SIZE_T stringMethodTable, ULONG stringLengthOffset, ULONG stringBufferOffset, ManagedHeapInfo *heapInfo, uint64_t *bytesWritten)
+{
+    *bytesWritten = 0;
+
+    std::vector<HeapSnapshotRange> snapshotRanges;
+    std::vector<HeapSnapshotExtent> extents;
+    std::vector<HeapSnapshotMethodTable> methodTables;
+    std::vector<HeapSnapshotObjectSize> objectSizes;
+
+    try
+    {
+        for (auto &range : ranges)
+        {
+            BOOL frozen = FALSE;
+            if (range.rangeLength != 0)
+            {
+                heapInfo->IsFrozenObject(range.rangeStart, &frozen);
+            }
+
+            snapshotRanges.push_back({(uint64_t)range.rangeStart, (uint64_t)range.rangeLength, (uint32_t)range.generation, frozen ? (uint32_t)HeapSnapshotRangeFrozen : 0u});
+        }
+
+        HRESULT hr = CollectMethodTables(ranges, heapInfo, &methodTables, &objectSizes);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        BuildExtents(snapshotRanges, &extents);
+    }
+    catch (const std::bad_alloc &)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    HeapSnapshotHeader header = {};
+    memcpy(header.Magic, HeapSnapshotMagic, sizeof(header.Magic));
+    header.Version = HeapSnapshotVersion;
+    header.PointerSize = sizeof(SIZE_T);
+    header.HeaderSize = sizeof(HeapSnapshotHeader);
+    header.StringMethodTable = stringMethodTable;
+    header.StringLengthOffset = stringLengthOffset;
+    header.StringBufferOffset = stringBufferOffset;
+    header.RangeCount = (uint32_t)snapshotRanges.size();
+    header.ExtentCount = (uint32_t)extents.size();
+    header.MethodTableCount = (uint32_t)methodTables.size();
+    header.ObjectSizeCount = (uint32_t)objectSizes.size();
+    header.RangesOffset = sizeof(HeapSnapshotHeader);
+    header.ExtentsOffset = header.RangesOffset + snapshotRanges.size() * sizeof(HeapSnapshotRange);
+    header.MethodTablesOffset = header.ExtentsOffset + extents.size() * sizeof(HeapSnapshotExtent);
+    header.ObjectSizesOffset = header.MethodTablesOffset + methodTables.size() * sizeof(HeapSnapshotMethodTable);
+
+    uint64_t offset = header.ObjectSizesOffset + objectSizes.size() * sizeof(HeapSnapshotObjectSize);
+    for (auto &methodTable : methodTables)
+    {
+        methodTable.FileOffset = offset;
+        offset += methodTable.Length;
+    }
+
+    uint64_t metadataEnd = offset;
+    offset = AlignUp(offset);
+    header.ExtentDataOffset = offset;
+    for (auto &extent : extents)
+    {
+        extent.FileOffset = offset;
+        offset += extent.Length;
+    }
+
+    header.FileSize = offset;
+
+    FILE *file = _wfopen(path, L"wb");
+    if (file == nullptr)
+    {
+        return E_FAIL;
+    }
+
+    bool written = WriteBytes(file, &header, sizeof(header)) &&
+                   WriteBytes(file, snapshotRanges.data(), snapshotRanges.size() * sizeof(HeapSnapshotRange)) &&
+                   WriteBytes(file, extents.data(), extents.size() * sizeof(HeapSnapshotExtent)) &&
+                   WriteBytes(file, methodTables.data(), methodTables.size() * sizeof(HeapSnapshotMethodTable)) &&
+                   WriteBytes(file, objectSizes.data(), objectSizes.size() * sizeof(HeapSnapshotObjectSize));
+
+    for (auto &methodTable : methodTables)
+    {
+        written = written && WriteBytes(file, (const void *)methodTable.Address, methodTable.Length);
+    }
+
+    written = written && WriteZeros(file, AlignUp(metadataEnd) - metadataEnd);
+
+    // ranges are written in address order, with zeros around them up to the extent bounds
+    std::vector<HeapSnapshotRange> sorted(snapshotRanges);
+    std::sort(sorted.begin(), sorted.end(), [](const HeapSnapshotRange &left, const HeapSnapshotRange &right) { return left.Start < right.Start; });
+
+    SIZE_T next = 0;
+    for (auto &extent : extents)
+    {
+        uint64_t position = extent.Address;
+        uint64_t end = extent.Address + extent.Length;
+
+        for (; next < sorted.size() && sorted[next].Start < end; ++next)
+        {
+            if (sorted[next].Length == 0)
+            {
+                continue;
+            }
+
+            written = written && WriteZeros(file, sorted[next].Start - position) && WriteBytes(file, (const void *)sorted[next].Start, sorted[next].Length);
+            position = sorted[next].Start + sorted[next].Length;
+        }
+
+        written = written && WriteZeros(file, end - position);
+    }
+
+    if (fclose(file) != 0 || !written)
+    {
+        return E_FAIL;
+    }
+
+    *bytesWritten = header.FileSize;
+    return S_OK;
+}
@@ -0,0 +1,98 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "cor.h"
+#include "corprof.h"
+#include "ManagedHeapInfo.h"
+
+// A heap snapshot file, written during a suspended pass and mapped by the replay tool
+// in benchmarks/SnapshotHeap.h. All fields are little-endian and addresses are those of
+// the captured process.
+//
+// The file starts with a HeapSnapshotHeader, followed at the offsets it gives by the
+// range, extent, MethodTable and object size tables and the bytes of the MethodTables.
+// The extents come last, each at a file offset that is a multiple of
+// HeapSnapshotAlignment, so that they can be mapped copy-on-write at the addresses
+// they were captured from. An extent covers one or more generation ranges, rounded out
+// to the alignment; the bytes between ranges are zero.
+//
+// Every range the runtime reports is captured, not only gen2: references from gen2
+// point into the younger generations and into frozen segments, and the walk reads the
+// MethodTable of whatever they point at.
+static const char HeapSnapshotMagic[4] = {'S', 'D', 'H', 'S'};
+static const uint32_t HeapSnapshotVersion = 1;
+static const uint64_t HeapSnapshotAlignment = 0x10000;
+
+enum HeapSnapshotRangeFlags : uint32_t
+{
+    HeapSnapshotRangeFrozen = 0x1,
+};
+
+struct HeapSnapshotHeader
+{
+    char Magic[4];
+    uint32_t Version;
+    uint32_t PointerSize;
+    uint32_t HeaderSize;
+    uint64_t StringMethodTable;
+    uint32_t StringLengthOffset;
+    uint32_t StringBufferOffset;
+    uint32_t RangeCount;
+    uint32_t ExtentCount;
+    uint32_t MethodTableCount;
+    uint32_t ObjectSizeCount;
+    uint64_t RangesOffset;
+    uint64_t ExtentsOffset;
+    uint64_t MethodTablesOffset;
+    uint64_t ObjectSizesOffset;
+    // where the first extent starts; everything before it is small enough to read
+    uint64_t ExtentDataOffset;
+    uint64_t FileSize;
+};
+
+struct HeapSnapshotRange
+{
+    uint64_t Start;
+    uint64_t Length;
+    uint32_t Generation;
+    uint32_t Flags;
+};
+
+struct HeapSnapshotExtent
+{
+    uint64_t Address;
+    uint64_t Length;
+    uint64_t FileOffset;
+};
+
+// The bytes at [Address, Address + Length) hold the GCDesc of the MethodTable, if it
+// has one, followed by the flags and base size the walk reads.
+struct HeapSnapshotMethodTable
+{
+    uint64_t Address;
+    uint64_t MethodTable;
+    uint64_t Length;
+    uint64_t FileOffset;
+};
+
+// The size of an object whose MethodTable MethodTableCache cannot compute a size from,
+// as the runtime reported it. Sorted by Object.
+struct HeapSnapshotObjectSize
+{
+    uint64_t Object;
+    uint64_t Size;
+};
+
+class HeapSnapshotWriter
+{
+  public:
+    // Writes every range in ranges, with the MethodTables of the objects in them, to
+    // path. The runtime must be suspended. Writing copies the whole heap to the file, so
+    // the pause it runs in grows by as much; it is meant for capturing a heap to tune
+    // against, not for every pass.
+    static HRESULT Write(const WCHAR *path, const std::vector<COR_PRF_GC_GENERATION_RANGE> &ranges, SIZE_T stringMethodTable, ULONG stringLengthOffset, ULONG stringBufferOffset, ManagedHeapInfo *heapInfo, uint64_t *bytesWritten);
+};
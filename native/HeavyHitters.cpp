@@ -0,0 +1,173 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <algorithm>
+#include <new>
+#include "HeavyHitters.h"
+
+HeavyHitters::HeavyHitters() : capacity(0), shift(0)
+{
+}
+
+bool HeavyHitters::SetCapacity(SIZE_T capacity)
+{
+    int newShift = 1;
+    while (((SIZE_T)1 << newShift) < capacity * 2)
+    {
+        ++newShift;
+    }
+
+    try
+    {
+        this->heap.clear();
+        this->heap.reserve(capacity);
+        this->keys.assign((SIZE_T)1 << newShift, 0);
+        this->positions.assign((SIZE_T)1 << newShift, 0);
+    }
+    catch (const std::bad_alloc &)
+    {
+        this->capacity = 0;
+        this->heap.clear();
+        return false;
+    }
+
+    this->capacity = capacity;
+    this->shift = newShift;
+    return true;
+}
+
+void HeavyHitters::Clear()
+{
+    if (!this->heap.empty())
+    {
+        this->heap.clear();
+        std::fill(this->keys.begin(), this->keys.end(), 0);
+    }
+}
+
+void HeavyHitters::Insert(uint64_t hash, uint32_t count)
+{
+    uint64_t key = KeyFor(hash);
+    SIZE_T slot = this->FindSlot(key);
+
+    if (this->keys[slot] == key)
+    {
+        SIZE_T index = this->positions[slot];
+        if (count > this->heap[index].Count)
+        {
+            this->heap[index].Count = count;
+            this->SiftDown(index);
+        }
+
+        return;
+    }
+
+    if (this->heap.size() < this->capacity)
+    {
+        this->keys[slot] = key;
+        this->positions[slot] = (uint32_t)this->heap.size();
+        this->heap.push_back(Entry{key, count, (uint32_t)slot});
+        this->SiftUp(this->heap.size() - 1);
+        return;
+    }
+
+    // Offer only gets here with a count above the minimum; removing the minimum may
+    // shift the free slot found above, so it is looked up again
+    this->RemoveSlot(this->heap[0].Slot);
+    slot = this->FindSlot(key);
+
+    this->keys[slot] = key;
+    this->positions[slot] = 0;
+    this->heap[0] = Entry{key, count, (uint32_t)slot};
+    this->SiftDown(0);
+}
+
+// Returns the slot holding key, or the free slot where it would be inserted.
+SIZE_T HeavyHitters::FindSlot(uint64_t key) const
+{
+    SIZE_T mask = this->keys.size() - 1;
+    SIZE_T index = this->IndexFor(key);
+
+    while (this->keys[index] != 0 && this->keys[index] != key)
+    {
+        index = (index + 1) & mask;
+    }
+
+    return index;
+}
+
+// Frees slot and moves later keys of the same probe run back into the gap, so that
+// lookups never stop early at it.
+void HeavyHitters::RemoveSlot(SIZE_T slot)
+{
+    SIZE_T mask = this->keys.size() - 1;
+    SIZE_T next = (slot + 1) & mask;
+
+    while (this->keys[next] != 0)
+    {
+        SIZE_T home = this->IndexFor(this->keys[next]);
+        if (((next - home) & mask) >= ((next - slot) & mask))
+        {
+            this->keys[slot] = this->keys[next];
+            this->positions[slot] = this->positions[next];
+            this->heap[this->positions[slot]].Slot = (uint32_t)slot;
+            slot = next;
+        }
+
+        next = (next + 1) & mask;
+    }
+
+    this->keys[slot] = 0;
+}
+
+void HeavyHitters::Swap(SIZE_T left, SIZE_T right)
+{
+    std::swap(this->heap[left], this->heap[right]);
+    this->positions[this->heap[left].Slot] = (uint32_t)left;
+    this->positions[this->heap[right].Slot] = (uint32_t)right;
+}
+
+void HeavyHitters::SiftUp(SIZE_T index)
+{
+    while (index > 0)
+    {
+        SIZE_T parent = (index - 1) / 2;
+        if (this->heap[parent].Count <= this->heap[index].Count)
+        {
+            break;
+        }
+
+        this->Swap(parent, index);
+        index = parent;
+    }
+}
+
+void HeavyHitters::SiftDown(SIZE_T index)
+{
+    SIZE_T count = this->heap.size();
+
+    while (true)
+    {
+        SIZE_T smallest = index;
+        SIZE_T left = index * 2 + 1;
+        SIZE_T right = left + 1;
+
+        if (left < count && this->heap[left].Count < this->heap[smallest].Count)
+        {
+            smallest = left;
+        }
+
+        if (right < count && this->heap[right].Count < this->heap[smallest].Count)
+        {
+            smallest = right;
+        }
+
+        if (smallest == index)
+        {
+            break;
+        }
+
+        this->Swap(smallest, index);
+        index = smallest;
+    }
+}
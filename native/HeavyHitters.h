@@ -0,0 +1,115 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "cor.h"
+#include "corprof.h"
+
+// The hashes with the highest counts offered so far, at most a fixed number of them.
+// A min-heap on the count finds the entry to evict, and an open-addressing index on
+// the hash finds an entry to update. Offers that cannot make the list return after a
+// single comparison, so counts can be offered for every reference walked.
+class HeavyHitters
+{
+  public:
+    HeavyHitters();
+
+    // Makes room for `capacity` hashes and empties the list.
+    bool SetCapacity(SIZE_T capacity);
+
+    void Clear();
+
+    // Records that hash was seen about count times. The hash is kept if its count is
+    // among the highest, and an entry only ever has its count raised.
+    void Offer(uint64_t hash, uint32_t count)
+    {
+        if (this->heap.size() == this->capacity && (this->capacity == 0 || count <= this->heap[0].Count))
+        {
+            return;
+        }
+
+        this->Insert(hash, count);
+    }
+
+    bool Contains(uint64_t hash) const
+    {
+        if (this->heap.empty())
+        {
+            return false;
+        }
+
+        uint64_t key = KeyFor(hash);
+        SIZE_T mask = this->keys.size() - 1;
+        SIZE_T index = this->IndexFor(key);
+
+        while (true)
+        {
+            uint64_t slot = this->keys[index];
+            if (slot == key)
+            {
+                return true;
+            }
+
+            if (slot == 0)
+            {
+                return false;
+            }
+
+            index = (index + 1) & mask;
+        }
+    }
+
+    SIZE_T GetCount() const
+    {
+        return this->heap.size();
+    }
+
+    SIZE_T GetCapacity() const
+    {
+        return this->capacity;
+    }
+
+    template <typename Func>
+    void ForEach(Func func) const
+    {
+        for (const Entry &entry : this->heap)
+        {
+            func(entry.Key, entry.Count);
+        }
+    }
+
+  private:
+    struct Entry
+    {
+        uint64_t Key;
+        uint32_t Count;
+        uint32_t Slot;
+    };
+
+    void Insert(uint64_t hash, uint32_t count);
+    SIZE_T FindSlot(uint64_t key) const;
+    void RemoveSlot(SIZE_T slot);
+    void Swap(SIZE_T left, SIZE_T right);
+    void SiftUp(SIZE_T index);
+    void SiftDown(SIZE_T index);
+
+    // 0 marks an empty slot, so a hash of 0 is stored as 1
+    static uint64_t KeyFor(uint64_t hash)
+    {
+        return hash != 0 ? hash : 1;
+    }
+
+    SIZE_T IndexFor(uint64_t key) const
+    {
+        return (SIZE_T)(key >> (64 - this->shift));
+    }
+
+    SIZE_T capacity;
+    int shift;
+    std::vector<Entry> heap;
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> positions;
+};
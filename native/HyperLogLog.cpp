@@ -0,0 +1,54 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <cmath>
+#include <cstring>
+#include "HyperLogLog.h"
+
+HyperLogLog::HyperLogLog()
+{
+    this->Clear();
+}
+
+void HyperLogLog::Clear()
+{
+    memset(this->registers, 0, sizeof(this->registers));
+}
+
+void HyperLogLog::Merge(const HyperLogLog &other)
+{
+    for (int i = 0; i < RegisterCount; ++i)
+    {
+        if (other.registers[i] > this->registers[i])
+        {
+            this->registers[i] = other.registers[i];
+        }
+    }
+}
+
+double HyperLogLog::Estimate() const
+{
+    const double m = RegisterCount;
+    const double alpha = 0.7213 / (1.0 + 1.079 / m);
+
+    double sum = 0;
+    int zeros = 0;
+    for (int i = 0; i < RegisterCount; ++i)
+    {
+        sum += std::ldexp(1.0, -this->registers[i]);
+        if (this->registers[i] == 0)
+        {
+            ++zeros;
+        }
+    }
+
+    double estimate = alpha * m * m / sum;
+
+    // small cardinalities are estimated better by counting empty registers
+    if (estimate <= 2.5 * m && zeros != 0)
+    {
+        estimate = m * std::log(m / zeros);
+    }
+
+    return estimate;
+}
@@ -0,0 +1,66 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <cstdint>
+#include "cor.h"
+#include "corprof.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// HyperLogLog estimate of the number of distinct hashes added, in 4 KB of registers
+// with a standard error of about 1.6%. Expects well-mixed 64-bit hashes such as the
+// ones from StringHash.
+class HyperLogLog
+{
+  public:
+    static const int IndexBits = 12;
+    static const int RegisterCount = 1 << IndexBits;
+
+    HyperLogLog();
+
+    void Clear();
+
+    void Add(uint64_t hash)
+    {
+        SIZE_T index = (SIZE_T)(hash >> (64 - IndexBits));
+        uint64_t rest = hash << IndexBits;
+
+        // position of the first set bit in the remaining bits, capped past the end
+        uint8_t rank = rest == 0 ? (uint8_t)(64 - IndexBits + 1) : (uint8_t)(CountLeadingZeros(rest) + 1);
+        if (rank > this->registers[index])
+        {
+            this->registers[index] = rank;
+        }
+    }
+
+    void Merge(const HyperLogLog &other);
+
+    double Estimate() const;
+
+  private:
+    static int CountLeadingZeros(uint64_t value)
+    {
+#if defined(_MSC_VER) && defined(_WIN64)
+        unsigned long index;
+        _BitScanReverse64(&index, value);
+        return 63 - (int)index;
+#elif defined(_MSC_VER)
+        unsigned long index;
+        if (_BitScanReverse(&index, (unsigned long)(value >> 32)))
+        {
+            return 31 - (int)index;
+        }
+
+        _BitScanReverse(&index, (unsigned long)value);
+        return 63 - (int)index;
+#else
+        return __builtin_clzll(value);
+#endif
+    }
+
+    uint8_t registers[RegisterCount];
+};
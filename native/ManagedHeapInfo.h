@@ -0,0 +1,50 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include "cor.h"
+#include "corprof.h"
+
+// What the engine asks the runtime about heap objects. Everything else it reads from
+// the objects and their MethodTables directly, so a heap laid out like the runtime's
+// only has to answer these to be walked: the profiler forwards them to
+// ICorProfilerInfo10, and the benchmarks answer them from a synthetic heap.
+class ManagedHeapInfo
+{
+  public:
+    virtual ~ManagedHeapInfo()
+    {
+    }
+
+    // Only called for objects whose size MethodTableCache cannot compute itself.
+    virtual HRESULT GetObjectSize(ObjectID object, SIZE_T *size) = 0;
+
+    virtual HRESULT IsFrozenObject(ObjectID object, BOOL *frozen) = 0;
+};
+
+class ProfilerHeapInfo : public ManagedHeapInfo
+{
+  public:
+    ProfilerHeapInfo() : corProfilerInfo(nullptr)
+    {
+    }
+
+    void Initialize(ICorProfilerInfo10 *corProfilerInfo)
+    {
+        this->corProfilerInfo = corProfilerInfo;
+    }
+
+    HRESULT GetObjectSize(ObjectID object, SIZE_T *size) override
+    {
+        return this->corProfilerInfo->GetObjectSize2(object, size);
+    }
+
+    HRESULT IsFrozenObject(ObjectID object, BOOL *frozen) override
+    {
+        return this->corProfilerInfo->IsFrozenObject(object, frozen);
+    }
+
+  private:
+    ICorProfilerInfo10 *corProfilerInfo;
+};
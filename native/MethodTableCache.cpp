@@ -0,0 +1,141 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <algorithm>
+#include <new>
+#include "MethodTableCache.h"
+#include "GCDesc.h"
+
+static const int InitialShift = 9;
+
+// Smallest base size of a real object: header, MethodTable pointer and the 4-byte
+// string length
+static const DWORD MinimumBaseSize = sizeof(SIZE_T) * 2 + sizeof(DWORD);
+
+MethodTableCache::MethodTableCache() : count(0), shift(0), last(nullptr), uncached()
+{
+}
+
+void MethodTableCache::Clear()
+{
+    if (this->count != 0)
+    {
+        std::fill(this->slots.begin(), this->slots.end(), MethodTableInfo());
+        this->count = 0;
+    }
+
+    this->series.clear();
+    this->repeats.clear();
+
+    this->last = nullptr;
+}
+
+void MethodTableCache::Decode(SIZE_T methodTable, MethodTableInfo *info)
+{
+    DWORD flags = *(DWORD *)methodTable;
+    DWORD baseSize = *(DWORD *)(methodTable + sizeof(DWORD));
+
+    info->MethodTable = methodTable;
+    info->BaseSize = baseSize;
+    info->ComponentSize = (flags & MethodTableFlags_HasComponentSize) ? (flags & MethodTableFlags_ComponentSizeMask) : 0;
+    info->ContainsPointerOrCollectible = (flags & (MethodTableFlags_ContainsPointers | MethodTableFlags_Collectible)) != 0;
+    info->SizeDecodable = baseSize >= MinimumBaseSize;
+    info->SeriesDecoded = false;
+    info->SeriesStart = 0;
+    info->SeriesCount = 0;
+    info->RepeatStart = 0;
+    info->RepeatCount = 0;
+    info->RepeatOffset = 0;
+}
+
+void MethodTableCache::DecodeSeries(MethodTableInfo *info)
+{
+    if (!info->ContainsPointerOrCollectible)
+    {
+        return;
+    }
+
+    info->SeriesStart = (uint32_t)this->series.size();
+    info->RepeatStart = (uint32_t)this->repeats.size();
+
+    try
+    {
+        GCDesc::ForMethodTable(info->MethodTable).Decode(this->series, this->repeats, &info->RepeatOffset);
+    }
+    catch (const std::bad_alloc &)
+    {
+        this->series.resize(info->SeriesStart);
+        this->repeats.resize(info->RepeatStart);
+        return;
+    }
+
+    info->SeriesCount = (uint32_t)this->series.size() - info->SeriesStart;
+    info->RepeatCount = (uint32_t)this->repeats.size() - info->RepeatStart;
+    info->SeriesDecoded = true;
+}
+
+const MethodTableInfo *MethodTableCache::Insert(SIZE_T methodTable)
+{
+    DWORD flags = *(DWORD *)methodTable;
+
+    // a collectible MethodTable can be freed and its address reused once its
+    // LoaderAllocator is collected, so it is decoded on every use
+    if ((flags & MethodTableFlags_Collectible) != 0 || ((this->count + 1) * 2 > this->slots.size() && !this->Grow()))
+    {
+        Decode(methodTable, &this->uncached);
+        this->last = nullptr;
+        return &this->uncached;
+    }
+
+    SIZE_T mask = this->slots.size() - 1;
+    SIZE_T index = this->IndexFor(methodTable);
+    while (this->slots[index].MethodTable != 0)
+    {
+        index = (index + 1) & mask;
+    }
+
+    Decode(methodTable, &this->slots[index]);
+    this->DecodeSeries(&this->slots[index]);
+    ++this->count;
+
+    this->last = &this->slots[index];
+    return this->last;
+}
+
+bool MethodTableCache::Grow()
+{
+    int newShift = this->shift == 0 ? InitialShift : this->shift + 1;
+
+    std::vector<MethodTableInfo> newSlots;
+    try
+    {
+        newSlots.resize((SIZE_T)1 << newShift);
+    }
+    catch (const std::bad_alloc &)
+    {
+        return false;
+    }
+
+    std::swap(this->slots, newSlots);
+    this->shift = newShift;
+    this->last = nullptr;
+
+    SIZE_T mask = this->slots.size() - 1;
+    for (auto &info : newSlots)
+    {
+        if (info.MethodTable == 0)
+        {
+            continue;
+        }
+
+        SIZE_T index = this->IndexFor(info.MethodTable);
+        while (this->slots[index].MethodTable != 0)
+        {
+            index = (index + 1) & mask;
+        }
+
+        this->slots[index] = info;
+    }
+
+    return true;
+}
@@ -0,0 +1,141 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "cor.h"
+#include "corprof.h"
+
+// Bits of MethodTable::m_dwFlags read by the walk. The low word holds the component
+// size when HasComponentSize is set.
+enum MethodTableFlags : DWORD
+{
+    MethodTableFlags_ComponentSizeMask = 0x0000FFFF,
+    MethodTableFlags_ContainsPointers = 0x01000000,
+    MethodTableFlags_Collectible = 0x10000000,
+    MethodTableFlags_HasComponentSize = 0x80000000,
+};
+
+// A run of pointer slots from a positive GCDesc series. The run covers
+// [Offset, Offset + Size + object size); Size is usually negative.
+struct PointerSeries
+{
+    SIZE_T Offset;
+    intptr_t Size;
+};
+
+// One item of a repeating GCDesc series, as used by arrays of value types that contain
+// references: Pointers slots followed by Skip bytes.
+struct PointerRepeat
+{
+    uint32_t Pointers;
+    uint32_t Skip;
+};
+
+struct MethodTableInfo
+{
+    SIZE_T MethodTable;
+    DWORD BaseSize;
+    DWORD ComponentSize;
+    bool ContainsPointerOrCollectible;
+
+    // false when the layout is not one the inline size computation understands, in
+    // which case callers fall back to GetObjectSize2
+    bool SizeDecodable;
+
+    // Decoded GCDesc, indexes into the owning cache. Only valid when SeriesDecoded.
+    bool SeriesDecoded;
+    uint32_t SeriesStart;
+    uint32_t SeriesCount;
+    uint32_t RepeatStart;
+    uint32_t RepeatCount;
+    SIZE_T RepeatOffset;
+};
+
+// Per-worker cache of decoded MethodTable descriptors, keyed by MethodTable address.
+// Sizes are computed inline as BaseSize + ComponentSize * component count, the count
+// being the DWORD that follows the MethodTable pointer in arrays and strings. The
+// GCDesc of a type with references is decoded the first time the type is seen and
+// kept, like the rest of the entry, for as long as the cache lives.
+class MethodTableCache
+{
+  public:
+    MethodTableCache();
+
+    void Clear();
+
+    const MethodTableInfo *Lookup(SIZE_T methodTable)
+    {
+        if (this->last != nullptr && this->last->MethodTable == methodTable)
+        {
+            return this->last;
+        }
+
+        if (this->count != 0)
+        {
+            SIZE_T mask = this->slots.size() - 1;
+            SIZE_T index = this->IndexFor(methodTable);
+            while (this->slots[index].MethodTable != 0)
+            {
+                if (this->slots[index].MethodTable == methodTable)
+                {
+                    this->last = &this->slots[index];
+                    return this->last;
+                }
+
+                index = (index + 1) & mask;
+            }
+        }
+
+        return this->Insert(methodTable);
+    }
+
+    // Returns false if the size must come from GetObjectSize2 instead.
+    static bool TryGetObjectSize(const MethodTableInfo *info, ObjectID object, SIZE_T *size)
+    {
+        if (!info->SizeDecodable)
+        {
+            return false;
+        }
+
+        SIZE_T result = info->BaseSize;
+        if (info->ComponentSize != 0)
+        {
+            result += (SIZE_T)info->ComponentSize * *(DWORD *)((PBYTE)object + sizeof(SIZE_T));
+        }
+
+        *size = result;
+        return true;
+    }
+
+    const PointerSeries *GetSeries(const MethodTableInfo *info) const
+    {
+        return this->series.data() + info->SeriesStart;
+    }
+
+    const PointerRepeat *GetRepeats(const MethodTableInfo *info) const
+    {
+        return this->repeats.data() + info->RepeatStart;
+    }
+
+  private:
+    SIZE_T IndexFor(SIZE_T methodTable) const
+    {
+        return (SIZE_T)(((uint64_t)methodTable * 0x9E3779B97F4A7C15ull) >> (64 - this->shift));
+    }
+
+    const MethodTableInfo *Insert(SIZE_T methodTable);
+    bool Grow();
+    static void Decode(SIZE_T methodTable, MethodTableInfo *info);
+    void DecodeSeries(MethodTableInfo *info);
+
+    std::vector<MethodTableInfo> slots;
+    SIZE_T count;
+    int shift;
+    const MethodTableInfo *last;
+    MethodTableInfo uncached;
+    std::vector<PointerSeries> series;
+    std::vector<PointerRepeat> repeats;
+};
@@ -0,0 +1,97 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <algorithm>
+#include <new>
+#include "ObjectIdSet.h"
+
+static const int InitialShift = 10;
+
+ObjectIdSet::ObjectIdSet() : count(0), shift(0)
+{
+}
+
+void ObjectIdSet::Clear()
+{
+    if (this->count != 0)
+    {
+        std::fill(this->slots.begin(), this->slots.end(), (ObjectID)0);
+        this->count = 0;
+    }
+}
+
+bool ObjectIdSet::Insert(ObjectID object)
+{
+    if ((this->count + 1) * 2 > this->slots.size() && !this->Grow())
+    {
+        return false;
+    }
+
+    SIZE_T mask = this->slots.size() - 1;
+    SIZE_T index = this->IndexFor(object);
+
+    while (this->slots[index] != 0)
+    {
+        if (this->slots[index] == object)
+        {
+            return true;
+        }
+
+        index = (index + 1) & mask;
+    }
+
+    this->slots[index] = object;
+    ++this->count;
+    return true;
+}
+
+bool ObjectIdSet::Reserve(SIZE_T count)
+{
+    int newShift = this->shift == 0 ? InitialShift : this->shift;
+    while ((count + 1) * 2 > ((SIZE_T)1 << newShift))
+    {
+        ++newShift;
+    }
+
+    return newShift == this->shift || this->Resize(newShift);
+}
+
+bool ObjectIdSet::Grow()
+{
+    return this->Resize(this->shift == 0 ? InitialShift : this->shift + 1);
+}
+
+bool ObjectIdSet::Resize(int newShift)
+{
+    std::vector<ObjectID> newSlots;
+    try
+    {
+        newSlots.resize((SIZE_T)1 << newShift);
+    }
+    catch (const std::bad_alloc &)
+    {
+        return false;
+    }
+
+    std::swap(this->slots, newSlots);
+    this->shift = newShift;
+
+    SIZE_T mask = this->slots.size() - 1;
+    for (auto object : newSlots)
+    {
+        if (object == 0)
+        {
+            continue;
+        }
+
+        SIZE_T index = this->IndexFor(object);
+        while (this->slots[index] != 0)
+        {
+            index = (index + 1) & mask;
+        }
+
+        this->slots[index] = object;
+    }
+
+    return true;
+}
@@ -0,0 +1,68 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "cor.h"
+#include "corprof.h"
+
+// Open-addressing set of object addresses, used to recognize references that
+// already point at a canonical string without hashing the string.
+class ObjectIdSet
+{
+  public:
+    ObjectIdSet();
+
+    void Clear();
+    bool Insert(ObjectID object);
+
+    // Grows the set once so that it can hold `count` objects without growing again.
+    bool Reserve(SIZE_T count);
+
+    bool Contains(ObjectID object) const
+    {
+        if (this->count == 0)
+        {
+            return false;
+        }
+
+        SIZE_T mask = this->slots.size() - 1;
+        SIZE_T index = this->IndexFor(object);
+
+        while (true)
+        {
+            ObjectID slot = this->slots[index];
+            if (slot == object)
+            {
+                return true;
+            }
+
+            if (slot == 0)
+            {
+                return false;
+            }
+
+            index = (index + 1) & mask;
+        }
+    }
+
+    SIZE_T GetCount() const
+    {
+        return this->count;
+    }
+
+  private:
+    SIZE_T IndexFor(ObjectID object) const
+    {
+        return (SIZE_T)(((uint64_t)object * 0x9E3779B97F4A7C15ull) >> (64 - this->shift));
+    }
+
+    bool Grow();
+    bool Resize(int newShift);
+
+    std::vector<ObjectID> slots;
+    SIZE_T count;
+    int shift;
+};
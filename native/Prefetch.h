@@ -0,0 +1,34 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#elif defined(_MSC_VER) && defined(_M_ARM64)
+#include <intrin.h>
+#endif
+
+// Software prefetch hints. Used where the pass knows the next random heap addresses
+// it will touch well before it touches them.
+inline void PrefetchRead(const void *address)
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    _mm_prefetch((const char *)address, _MM_HINT_T0);
+#elif defined(_MSC_VER) && defined(_M_ARM64)
+    __prefetch(address);
+#elif defined(__GNUC__)
+    __builtin_prefetch(address, 0, 3);
+#endif
+}
+
+inline void PrefetchWrite(void *address)
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    _mm_prefetch((const char *)address, _MM_HINT_T0);
+#elif defined(_MSC_VER) && defined(_M_ARM64)
+    __prefetchw(address);
+#elif defined(__GNUC__)
+    __builtin_prefetch(address, 1, 3);
+#endif
+}
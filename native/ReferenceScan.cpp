@@ -0,0 +1,72 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "ReferenceScan.h"
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define REFERENCESCAN_GATHER
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__)
+#define REFERENCESCAN_TARGET(isa) __attribute__((target(isa)))
+#else
+#define REFERENCESCAN_TARGET(isa)
+#endif
+
+static uint64_t MatchMethodTableScalar(const ObjectID *slots, SIZE_T count, SIZE_T methodTable)
+{
+    uint64_t matches = 0;
+    for (SIZE_T i = 0; i < count; ++i)
+    {
+        ObjectID object = slots[i];
+        if (object != 0 && *(SIZE_T *)object == methodTable)
+        {
+            matches |= (uint64_t)1 << i;
+        }
+    }
+
+    return matches;
+}
+
+#ifdef REFERENCESCAN_GATHER
+
+// Loads four slots, gathers the MethodTable of every non-null one in a single
+// instruction and compares all four against methodTable.
+REFERENCESCAN_TARGET("avx2")
+static uint64_t MatchMethodTableAvx2(const ObjectID *slots, SIZE_T count, SIZE_T methodTable)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i expected = _mm256_set1_epi64x((long long)methodTable);
+
+    uint64_t matches = 0;
+    SIZE_T i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m256i objects = _mm256_loadu_si256((const __m256i *)(slots + i));
+        __m256i nonNull = _mm256_xor_si256(_mm256_cmpeq_epi64(objects, zero), _mm256_set1_epi64x(-1));
+        __m256i methodTables = _mm256_mask_i64gather_epi64(zero, (const long long *)nullptr, objects, nonNull, 1);
+        __m256i equal = _mm256_and_si256(_mm256_cmpeq_epi64(methodTables, expected), nonNull);
+        matches |= (uint64_t)_mm256_movemask_pd(_mm256_castsi256_pd(equal)) << i;
+    }
+
+    if (i < count)
+    {
+        matches |= MatchMethodTableScalar(slots + i, count - i, methodTable) << i;
+    }
+
+    return matches;
+}
+
+#endif
+
+ReferenceScan::MatchFunc ReferenceScan::matchFunc = &MatchMethodTableScalar;
+
+void ReferenceScan::Initialize(bool useAvx2)
+{
+#ifdef REFERENCESCAN_GATHER
+    matchFunc = useAvx2 ? &MatchMethodTableAvx2 : &MatchMethodTableScalar;
+#else
+    matchFunc = &MatchMethodTableScalar;
+#endif
+}
@@ -0,0 +1,57 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <cstdint>
+#include "cor.h"
+#include "corprof.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Compares the MethodTables of a run of reference slots against one MethodTable,
+// several slots at a time. Used for the long contiguous runs found in object arrays,
+// where every slot would otherwise be a separate dependent load and compare.
+class ReferenceScan
+{
+  public:
+    // Runs shorter than this are not worth a vector setup
+    static const SIZE_T MinimumRun = 8;
+    static const SIZE_T BatchSize = 64;
+
+    static void Initialize(bool useAvx2);
+
+    // Bit i of the result is set when slots[i] is not null and the object it points
+    // at has the given MethodTable. count must not exceed BatchSize.
+    static uint64_t MatchMethodTable(const ObjectID *slots, SIZE_T count, SIZE_T methodTable)
+    {
+        return matchFunc(slots, count, methodTable);
+    }
+
+    static int LowestSetBit(uint64_t value)
+    {
+#if defined(_MSC_VER) && defined(_WIN64)
+        unsigned long index;
+        _BitScanForward64(&index, value);
+        return (int)index;
+#elif defined(_MSC_VER)
+        unsigned long index;
+        if (_BitScanForward(&index, (unsigned long)value))
+        {
+            return (int)index;
+        }
+
+        _BitScanForward(&index, (unsigned long)(value >> 32));
+        return (int)index + 32;
+#else
+        return __builtin_ctzll(value);
+#endif
+    }
+
+  private:
+    typedef uint64_t (*MatchFunc)(const ObjectID *, SIZE_T, SIZE_T);
+
+    static MatchFunc matchFunc;
+};
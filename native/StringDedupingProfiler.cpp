@@ -3,9 +3,18 @@
 
 #include <vector>
 #include <cstddef>
+#include <cstring>
 #include "corhlpr.h"
 #include "StringDedupingProfiler.h"
-#include "GCDesc.h"
+#include "HeapSnapshot.h"
+#include "ReferenceScan.h"
+#include "StringHash.h"
+
+// Events the ring holds before the drain thread has to catch up
+static const SIZE_T EventLogCapacity = 16384;
+
+// The profiler once attached, for the exports managed code calls afterwards
+static std::atomic<StringDedupingProfiler *> attachedProfiler(nullptr);
 
 extern "C" HRESULT InitializeStringDeduper(LPCWSTR profilerPath, SIZE_T stringMethodTable, void *clrProfiling)
 {
@@ -13,130 +22,131 @@ extern "C" HRESULT InitializeStringDeduper(LPCWSTR profilerPath, SIZE_T stringMe
     return ((ICLRProfiling *)clrProfiling)->AttachProfiler(GetCurrentProcessId(), 1000, &CLSID_CorProfiler, profilerPath, (void *)&stringMethodTable, sizeof(SIZE_T));
 }
 
-static ULONG hashFunction(ULONG length, const PBYTE str)
+// The config follows the string MethodTable in the client data; config->Size must be
+// set to the size of the caller's structure.
+extern "C" HRESULT InitializeStringDeduperWithConfig(LPCWSTR profilerPath, SIZE_T stringMethodTable, const DedupConfig *config, void *clrProfiling)
 {
-    ULONG hash = 5381;
-
-    for (ULONG i = 0; i < length; ++i)
+    if (config == nullptr || config->Size < offsetof(DedupConfig, Flags))
     {
-        hash = ((hash << 5) + hash) + str[i];
+        return E_INVALIDARG;
     }
 
-    return hash;
+    std::vector<BYTE> clientData(sizeof(SIZE_T) + config->Size);
+    memcpy(clientData.data(), &stringMethodTable, sizeof(SIZE_T));
+    memcpy(clientData.data() + sizeof(SIZE_T), config, config->Size);
+
+    const GUID CLSID_CorProfiler = {0x4175c64e, 0x5ae0, 0x45df, {0xab, 0x4f, 0x06, 0xd9, 0xc4, 0xc6, 0x79, 0x5c}};
+    return ((ICLRProfiling *)clrProfiling)->AttachProfiler(GetCurrentProcessId(), 1000, &CLSID_CorProfiler, profilerPath, clientData.data(), (UINT)clientData.size());
 }
 
-static HRESULT EachObjectReference(WalkObjectContext *context, ObjectID curr, int32_t offset)
+// Replaces the config of the attached profiler. Settings that affect a pass are read
+// when the next collection starts; the worker count, memory limit, heavy hitters,
+// report mode, persistence and time budget once the runtime has resumed after it.
+extern "C" HRESULT UpdateStringDedupConfig(const DedupConfig *config)
 {
-    auto hashToObjectIDMap = context->HashToObjectIDMap;
+    DedupConfig update;
+    if (config == nullptr || !DedupConfig::Read(config, config->Size, &update))
+    {
+        return E_INVALIDARG;
+    }
 
-    ObjectID objectReference = (ObjectID)(*(ObjectID *)((PBYTE)curr + offset));
-    auto methodTable = *(SIZE_T *)objectReference;
+    StringDedupingProfiler *profiler = attachedProfiler.load();
+    if (profiler == nullptr)
+    {
+        return E_FAIL;
+    }
 
-    if (methodTable == context->StringMethodTable)
+    profiler->PublishConfig(update);
+    return S_OK;
+}
+
+// statistics->Size must be set to the size of the caller's structure, which can be
+// that of an older version.
+extern "C" HRESULT GetStringDedupStatistics(DedupStatistics *statistics)
+{
+    if (statistics == nullptr || statistics->Size < offsetof(DedupStatistics, Passes))
     {
-        COR_PRF_GC_GENERATION_RANGE range;
-        IfFailRet(context->CorProfilerInfo->GetObjectGeneration(objectReference, &range));
-        if (range.generation > 1)   
-        {
-            ULONG objectReferenceStringLength = *(PULONG)((PBYTE)objectReference + context->StringLengthOffset);
-            PBYTE objectReferenceStringData = (PBYTE)objectReference + context->StringBufferOffset;
-
-            ULONG hash = hashFunction(objectReferenceStringLength, objectReferenceStringData);
-            auto iter = hashToObjectIDMap->find(hash);
-            if (iter == hashToObjectIDMap->end())
-            {
-                 hashToObjectIDMap->insert(std::pair<ULONG, ObjectID>(hash, objectReference));
-            }
-            else
-            {
-                ObjectID existingObjectId = iter->second;
-
-                if (existingObjectId != objectReference)
-                {
-                    ULONG existingStringLength = *(PULONG)((PBYTE)existingObjectId + context->StringLengthOffset);
-                    PBYTE existingStringData = (PBYTE)existingObjectId + context->StringBufferOffset;
-
-                    if (objectReferenceStringLength == existingStringLength && existingStringLength != 0)
-                    {
-                        wprintf(L"Deduping: %s\n", (WCHAR*)objectReferenceStringData);
-                        if (memcmp(objectReferenceStringData, existingStringData, (SIZE_T)existingStringLength) == 0)
-                        {
-                            *(ObjectID*)((PBYTE)curr + offset) = existingObjectId;
-                        }
-                    }
-                }
-            }
-        }
+        return E_INVALIDARG;
     }
 
+    StringDedupingProfiler *profiler = attachedProfiler.load();
+    if (profiler == nullptr)
+    {
+        return E_FAIL;
+    }
+
+    profiler->GetStatistics(statistics);
     return S_OK;
 }
 
-HRESULT StringDedupingProfiler::GarbageCollectionStartedCore(int cGenerations)
+// Writes a heap snapshot to path during the next pass, for the replay tool in
+// benchmarks. The file is as large as the managed heap.
+extern "C" HRESULT CaptureStringDedupSnapshot(LPCWSTR path)
 {
-    if (cGenerations < 3)
+    if (path == nullptr || *path == 0)
     {
-        return S_FALSE;
+        return E_INVALIDARG;
     }
 
+    StringDedupingProfiler *profiler = attachedProfiler.load();
+    if (profiler == nullptr)
+    {
+        return E_FAIL;
+    }
+
+    profiler->RequestSnapshot(path);
+    return S_OK;
+}
+
+HRESULT StringDedupingProfiler::GarbageCollectionStartedCore()
+{
     ULONG cObjectRanges = 0;
     IfFailRet(this->corProfilerInfo->GetGenerationBounds(cObjectRanges, &cObjectRanges, nullptr));
     std::vector<COR_PRF_GC_GENERATION_RANGE> objectRanges(cObjectRanges);
     IfFailRet(this->corProfilerInfo->GetGenerationBounds(cObjectRanges, &cObjectRanges, objectRanges.data()));
 
-    WalkObjectContext context(this->corProfilerInfo, this->stringMethodTable, &this->hashToObjectMap, this->stringLengthOffset, this->stringBufferOffset);
-
+    SIZE_T gen2Bytes = 0;
     for (auto &s : objectRanges)
     {
-        if (s.generation < COR_PRF_GC_GEN_2)
-        {
-            continue;
-        }
-
-        BOOL frozen;
-        IfFailRet(this->corProfilerInfo->IsFrozenObject(s.rangeStart, &frozen));
-
-        if (frozen)
+        if (s.generation >= COR_PRF_GC_GEN_2)
         {
-            continue;
+            gen2Bytes += s.rangeLength;
         }
+    }
 
-        ObjectID curr = s.rangeStart;
-        ObjectID end = s.rangeStart + s.rangeLength;
-
-        while (curr < end)
-        {
-            SIZE_T size;
-            IfFailRet(this->corProfilerInfo->GetObjectSize2(curr, &size));
-
-            auto methodTable = *(SIZE_T *)curr;
-            auto flags = *(DWORD *)methodTable;
-            bool containsPointerOrCollectible = (flags & 0x10000000) || (flags & 0x1000000);
+    auto decision = this->triggerPolicy.OnGen2Size(gen2Bytes);
+    if (decision != DedupTriggerDecision::Processed)
+    {
+        this->triggerPolicy.Record(decision);
+        return S_FALSE;
+    }
 
-            if (containsPointerOrCollectible)
-            {
-                int entries = *(DWORD *)((SIZE_T)methodTable - sizeof(SIZE_T));
-                if (entries < 0)
-                {
-                    entries = -entries;
-                }
+    if (this->snapshotRequested.exchange(false, std::memory_order_acquire))
+    {
+        this->CaptureSnapshot(objectRanges);
+    }
 
-                int slots = 1 + entries * 2;
+    // S_FALSE: the sampling pre-pass found too few duplicates to be worth a pass
+    HRESULT hr = this->dedupEngine.Run(objectRanges);
+    this->triggerPolicy.Record(hr == S_FALSE ? DedupTriggerDecision::SkippedLowDuplication : DedupTriggerDecision::Processed);
 
-                GCDesc gcdesc((uint8_t *)((SIZE_T)methodTable - (slots * sizeof(SIZE_T))), slots * sizeof(SIZE_T));
-                gcdesc.WalkObject((PBYTE)curr, size, &context, &EachObjectReference);
-            }
+    return hr;
+}
 
-            curr = (ObjectID)(align_up((SIZE_T)curr + size, sizeof(SIZE_T))); // is it SIZE_T alignment on LOH in 32-bit??
-        }
+void StringDedupingProfiler::CaptureSnapshot(const std::vector<COR_PRF_GC_GENERATION_RANGE> &objectRanges)
+{
+    std::basic_string<WCHAR> path;
+    {
+        std::lock_guard<std::mutex> lock(this->snapshotLock);
+        path = this->snapshotPath;
     }
 
-    this->hashToObjectMap.clear();
-
-    return S_OK;
+    uint64_t bytesWritten;
+    HRESULT hr = HeapSnapshotWriter::Write(path.c_str(), objectRanges, this->stringMethodTable, this->stringLengthOffset, this->stringBufferOffset, &this->heapInfo, &bytesWritten);
+    this->eventLog.Log(DedupEventKind::SnapshotCaptured, (uint32_t)hr, bytesWritten);
 }
 
-StringDedupingProfiler::StringDedupingProfiler() : nextGCIsSuspended(false), refCount(0), corProfilerInfo(nullptr), stringMethodTable(0), stringLengthOffset(0), stringBufferOffset(0)
+StringDedupingProfiler::StringDedupingProfiler() : nextGCIsSuspended(false), runtimeResumes(0), pendingCollections(), pendingCollectionCount(0), refCount(0), corProfilerInfo(nullptr), stringMethodTable(0), stringLengthOffset(0), stringBufferOffset(0), configSequence(0), config(DedupConfig::Default()), pendingConfig(DedupConfig::Default()), configPending(false), enabled(true), eventMask(0), snapshotRequested(false)
 {
 }
 
@@ -156,6 +166,13 @@ HRESULT STDMETHODCALLTYPE StringDedupingProfiler::Initialize(IUnknown *pICorProf
 
 HRESULT STDMETHODCALLTYPE StringDedupingProfiler::Shutdown()
 {
+    StringDedupingProfiler *profiler = this;
+    attachedProfiler.compare_exchange_strong(profiler, nullptr);
+
+    this->dedupEngine.StopWorkers();
+    this->eventLog.Stop();
+    this->reportWriter.Close();
+
     if (this->corProfilerInfo != nullptr)
     {
         this->corProfilerInfo->Release();
@@ -352,64 +369,80 @@ HRESULT STDMETHODCALLTYPE StringDedupingProfiler::ManagedToUnmanagedTransition(F
 
 HRESULT STDMETHODCALLTYPE StringDedupingProfiler::RuntimeSuspendStarted(COR_PRF_SUSPEND_REASON suspendReason)
 {
+    this->eventLog.Log(DedupEventKind::RuntimeSuspendStarted, suspendReason);
+
     if (suspendReason == COR_PRF_SUSPEND_FOR_GC)
     {
-        printf("RuntimeSuspendStarted COR_PRF_SUSPEND_FOR_GC\n");
         this->nextGCIsSuspended = true;
     }
 
-    if (suspendReason == COR_PRF_SUSPEND_FOR_GC_PREP)
-    {
-        printf("RuntimeSuspendStarted COR_PRF_SUSPEND_FOR_GC_PREP\n");
-    }
-
     return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE StringDedupingProfiler::RuntimeSuspendFinished()
 {
-    printf("RuntimeSuspendFinished.\n");
+    this->eventLog.Log(DedupEventKind::RuntimeSuspendFinished);
     return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE StringDedupingProfiler::RuntimeSuspendAborted()
 {
-    printf("RuntimeSuspendAborted.\n");
+    this->eventLog.Log(DedupEventKind::RuntimeSuspendAborted);
 
     return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE StringDedupingProfiler::RuntimeResumeStarted()
 {
-    printf("RuntimeResumeStarted\n");
+    this->eventLog.Log(DedupEventKind::RuntimeResumeStarted);
 
     this->nextGCIsSuspended = false;
+    ++this->runtimeResumes;
 
     return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE StringDedupingProfiler::RuntimeResumeFinished()
 {
-    printf("RuntimeResumeFinished\n");
+    this->eventLog.Log(DedupEventKind::RuntimeResumeFinished);
+
+    if (this->configPending.exchange(false, std::memory_order_acquire))
+    {
+        // a failure is logged and counted by ApplyConfig, and the rest of the config
+        // still applies
+        this->ApplyConfig(this->pendingConfig, false);
+    }
+
+    this->dedupEngine.PrepareNextPass();
+
+    // written now rather than from GarbageCollectionFinished to keep the I/O out of
+    // the pause
+    DedupReport report;
+    if (this->dedupEngine.IsReportOnly() && this->dedupEngine.TakeReport(&report))
+    {
+        this->reportWriter.Write(report);
+    }
 
     return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE StringDedupingProfiler::RuntimeThreadSuspended(ThreadID threadId)
 {
-    printf("RuntimeThreadSuspended %llu\n", threadId);
+    this->eventLog.Log(DedupEventKind::RuntimeThreadSuspended, 0, threadId);
 
     return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE StringDedupingProfiler::RuntimeThreadResumed(ThreadID threadId)
 {
-    printf("RuntimeThreadResumed %llu\n", threadId);
+    this->eventLog.Log(DedupEventKind::RuntimeThreadResumed, 0, threadId);
     return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE StringDedupingProfiler::MovedReferences(ULONG cMovedObjectIDRanges, ObjectID oldObjectIDRangeStart[], ObjectID newObjectIDRangeStart[], ULONG cObjectIDRangeLength[])
 {
+    this->dedupEngine.AddMovedReferences(cMovedObjectIDRanges, oldObjectIDRangeStart, newObjectIDRangeStart, cObjectIDRangeLength);
+
     return S_OK;
 }
 
@@ -530,25 +563,87 @@ HRESULT STDMETHODCALLTYPE StringDedupingProfiler::ThreadNameChanged(ThreadID thr
 
 HRESULT STDMETHODCALLTYPE StringDedupingProfiler::GarbageCollectionStarted(int cGenerations, BOOL generationCollected[], COR_PRF_GC_REASON reason)
 {
-    printf("GarbageCollectionStarted\n");
+    uint64_t collected = 0;
+    for (int i = 0; i < cGenerations && i < 64; ++i)
+    {
+        if (generationCollected[i])
+        {
+            collected |= (uint64_t)1 << i;
+        }
+    }
+
+    this->eventLog.Log(DedupEventKind::GarbageCollectionStarted, reason, collected);
+
+    DedupConfig config;
+    if (this->controlBlock.ReadIfChanged(&this->configSequence, &config))
+    {
+        this->ApplyPassConfig(config);
+        this->pendingConfig = config;
+        this->configPending.store(true, std::memory_order_release);
+    }
+
+    DedupPendingCollection collection;
+    collection.Decision = this->triggerPolicy.OnGarbageCollectionStarted(cGenerations, generationCollected, reason);
+    collection.Suspended = this->nextGCIsSuspended;
+    collection.Resumes = this->runtimeResumes;
+    if (!this->enabled && collection.Decision == DedupTriggerDecision::Processed)
+    {
+        collection.Decision = DedupTriggerDecision::SkippedDisabled;
+    }
+
+    // deeper nesting than a background collection with a foreground one inside it is
+    // not expected; the innermost collections are then dropped and skipped as not gen2
+    if (this->pendingCollectionCount < MaxPendingCollections)
+    {
+        this->pendingCollections[this->pendingCollectionCount] = collection;
+    }
+
+    ++this->pendingCollectionCount;
+
+    if (cGenerations > COR_PRF_GC_GEN_2 && generationCollected[COR_PRF_GC_GEN_2])
+    {
+        this->dedupEngine.BeginRelocationTracking();
+    }
+
+    this->dedupEngine.BeginRootTracking();
 
     return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE StringDedupingProfiler::SurvivingReferences(ULONG cSurvivingObjectIDRanges, ObjectID objectIDRangeStart[], ULONG cObjectIDRangeLength[])
 {
+    this->dedupEngine.AddSurvivingReferences(cSurvivingObjectIDRanges, objectIDRangeStart, cObjectIDRangeLength);
+
     return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE StringDedupingProfiler::GarbageCollectionFinished()
 {
-    if (this->nextGCIsSuspended)
+    this->dedupEngine.EndRelocationTracking();
+
+    DedupPendingCollection collection = {DedupTriggerDecision::SkippedNotGen2, false, 0};
+    if (this->pendingCollectionCount > 0)
     {
-        printf("Deduping\n");
-        this->GarbageCollectionStartedCore(5);
+        --this->pendingCollectionCount;
+        if (this->pendingCollectionCount < MaxPendingCollections)
+        {
+            collection = this->pendingCollections[this->pendingCollectionCount];
+        }
     }
 
-    printf("GarbageCollectionFinished\n");
+    // a background collection started suspended too, but the runtime resumed while it ran
+    bool blocking = collection.Suspended && this->nextGCIsSuspended && collection.Resumes == this->runtimeResumes;
+    auto decision = this->triggerPolicy.OnGarbageCollectionFinished(collection.Decision, blocking);
+    if (decision != DedupTriggerDecision::Processed)
+    {
+        this->triggerPolicy.Record(decision);
+    }
+    else
+    {
+        this->GarbageCollectionStartedCore();
+    }
+
+    this->eventLog.Log(DedupEventKind::GarbageCollectionFinished, (uint32_t)this->triggerPolicy.GetLastDecision());
 
     return S_OK;
 }
@@ -560,6 +655,8 @@ HRESULT STDMETHODCALLTYPE StringDedupingProfiler::FinalizeableObjectQueued(DWORD
 
 HRESULT STDMETHODCALLTYPE StringDedupingProfiler::RootReferences2(ULONG cRootRefs, ObjectID rootRefIds[], COR_PRF_GC_ROOT_KIND rootKinds[], COR_PRF_GC_ROOT_FLAGS rootFlags[], UINT_PTR rootIds[])
 {
+    this->dedupEngine.AddRootReferences(cRootRefs, rootKinds, rootFlags, rootIds);
+
     return S_OK;
 }
 
@@ -582,15 +679,180 @@ HRESULT STDMETHODCALLTYPE StringDedupingProfiler::InitializeForAttach(IUnknown *
         return E_FAIL;
     }
 
-    if (cbClientData != sizeof(SIZE_T))
+    // older callers pass only the string MethodTable
+    DedupConfig config = DedupConfig::Default();
+    if (cbClientData < sizeof(SIZE_T) || (cbClientData > sizeof(SIZE_T) && !DedupConfig::Read((PBYTE)pvClientData + sizeof(SIZE_T), cbClientData - sizeof(SIZE_T), &config)))
     {
         return E_FAIL;
     }
 
     IfFailRet(this->corProfilerInfo->GetStringLayout2(&this->stringLengthOffset, &this->stringBufferOffset));
+
     this->stringMethodTable = *(SIZE_T *)pvClientData;
 
-    return this->corProfilerInfo->SetEventMask2(COR_PRF_MONITOR_SUSPENDS, COR_PRF_HIGH_BASIC_GC);
+    StringHash::Initialize();
+    ReferenceScan::Initialize(StringHash::GetKernel() == StringHashKernel::Avx2);
+
+    // without events or reports the profiler still works, so a failure here is not
+    // fatal
+    this->StartEventLog();
+    this->OpenReportWriter();
+
+    this->heapInfo.Initialize(this->corProfilerInfo);
+    this->dedupEngine.Initialize(&this->heapInfo, this->stringMethodTable, this->stringLengthOffset, this->stringBufferOffset);
+    this->dedupEngine.SetEventLog(&this->eventLog);
+
+    this->controlBlock.Publish(config);
+    this->controlBlock.ReadIfChanged(&this->configSequence, &config);
+    this->ApplyPassConfig(config);
+    IfFailRet(this->ApplyConfig(config, true));
+
+    attachedProfiler = this;
+    return S_OK;
+}
+
+// Events are written as DedupEvent records to the file named by STRING_DEDUP_EVENT_LOG,
+// or printed to stdout as text if it is "-"; without it no events are logged.
+HRESULT StringDedupingProfiler::StartEventLog()
+{
+    WCHAR path[MAX_PATH];
+    DWORD length = GetEnvironmentVariableW(L"STRING_DEDUP_EVENT_LOG", path, MAX_PATH);
+    if (length == 0 || length >= MAX_PATH)
+    {
+        return S_FALSE;
+    }
+
+    bool console = path[0] == L'-' && path[1] == 0;
+    return this->eventLog.Start(console ? nullptr : path, EventLogCapacity);
+}
+
+// Reports of report-only passes are appended to the file named by STRING_DEDUP_REPORT,
+// in the binary format if its name ends in ".bin" and as CSV otherwise, or printed to
+// stdout as CSV if it is "-"; without it no reports are written.
+HRESULT StringDedupingProfiler::OpenReportWriter()
+{
+    WCHAR path[MAX_PATH];
+    DWORD length = GetEnvironmentVariableW(L"STRING_DEDUP_REPORT", path, MAX_PATH);
+    if (length == 0 || length >= MAX_PATH)
+    {
+        return S_FALSE;
+    }
+
+    bool console = path[0] == L'-' && path[1] == 0;
+    bool binary = length >= 4 && path[length - 4] == L'.' && (path[length - 3] | 0x20) == L'b' && (path[length - 2] | 0x20) == L'i' && (path[length - 1] | 0x20) == L'n';
+    return this->reportWriter.Open(console ? nullptr : path, binary ? DedupReportFormat::Binary : DedupReportFormat::Csv);
+}
+
+// Applies the settings that only change what a pass does. Called from
+// GarbageCollectionStarted, before the collection is admitted.
+void StringDedupingProfiler::ApplyPassConfig(const DedupConfig &config)
+{
+    this->enabled = (config.Flags & DedupConfigEnabled) != 0;
+
+    DedupTriggerSettings trigger;
+    if (config.TriggerMode <= (uint32_t)DedupTriggerMode::Gen2Growth)
+    {
+        trigger.Mode = (DedupTriggerMode)config.TriggerMode;
+    }
+
+    trigger.EveryNthGen2 = config.EveryNthGen2;
+    trigger.Gen2GrowthBytes = (SIZE_T)config.Gen2GrowthBytes;
+    this->triggerPolicy.Configure(trigger);
+
+    this->dedupEngine.SetLengthLimits(config.MinimumLength, config.MaximumLength);
+    this->dedupEngine.SetFoldShortStrings((config.Flags & DedupConfigFoldShortStrings) != 0);
+    this->dedupEngine.SetSampling(config.SamplingStride, config.MinimumDuplicateRatio);
+
+    DedupCanonicalPolicy policy = DedupCanonicalPolicy::FirstSeen;
+    if (config.CanonicalPolicy <= (uint32_t)DedupCanonicalPolicy::LowestAddress)
+    {
+        policy = (DedupCanonicalPolicy)config.CanonicalPolicy;
+    }
+
+    this->dedupEngine.SetCanonicalPolicy(policy, (config.Flags & DedupConfigSeedFrozen) != 0);
+}
+
+// Applies the settings that allocate, start threads or change the event mask, and
+// so are kept out of the pause. Only what changed since the last config is applied,
+// unless this is the initial one. If the event mask cannot be set, the rest is applied
+// anyway, with the modes that need GC monitoring off unless the old mask has it; the
+// failure is logged, counted in the statistics and returned.
+HRESULT StringDedupingProfiler::ApplyConfig(const DedupConfig &requested, bool initial)
+{
+    DedupConfig config = requested;
+
+    if (initial || config.WorkerCount != this->config.WorkerCount)
+    {
+        this->dedupEngine.StartWorkers(config.WorkerCount != 0 ? (int)config.WorkerCount : (int)std::thread::hardware_concurrency());
+    }
+
+    if (initial || config.MemoryLimit != this->config.MemoryLimit)
+    {
+        this->dedupEngine.SetMemoryLimit((SIZE_T)config.MemoryLimit);
+    }
+
+    if (initial || config.HeavyHitters != this->config.HeavyHitters)
+    {
+        this->dedupEngine.SetHeavyHitters((SIZE_T)config.HeavyHitters);
+    }
+
+    bool reportOnly = (config.Flags & DedupConfigReportOnly) != 0;
+    if (initial || reportOnly != this->dedupEngine.IsReportOnly() || config.ReportTopStrings != this->config.ReportTopStrings)
+    {
+        this->dedupEngine.SetReportOnly(reportOnly, (SIZE_T)config.ReportTopStrings);
+    }
+
+    bool persistent = (config.Flags & DedupConfigPersistent) != 0;
+    bool extended = (config.Flags & DedupConfigExtended) != 0;
+    DWORD eventMask = COR_PRF_MONITOR_SUSPENDS;
+    if (persistent || extended || config.TimeBudgetMilliseconds != 0)
+    {
+        // moved and surviving references, and roots, are only reported with full GC
+        // monitoring
+        eventMask |= COR_PRF_MONITOR_GC;
+    }
+
+    HRESULT hr = S_OK;
+    if (initial || eventMask != this->eventMask)
+    {
+        hr = this->corProfilerInfo->SetEventMask2(eventMask, COR_PRF_HIGH_BASIC_GC);
+        if (SUCCEEDED(hr))
+        {
+            this->eventMask = eventMask;
+        }
+        else
+        {
+            this->eventLog.Log(DedupEventKind::EventMaskFailed, (uint32_t)hr, eventMask);
+            this->dedupEngine.RecordEventMaskFailure(hr);
+        }
+    }
+
+    if ((this->eventMask & COR_PRF_MONITOR_GC) == 0)
+    {
+        // recorded as off too, since that is what was applied
+        persistent = false;
+        extended = false;
+        config.Flags &= ~(DedupConfigPersistent | DedupConfigExtended);
+        config.TimeBudgetMilliseconds = 0;
+    }
+
+    if (initial || persistent != this->dedupEngine.IsPersistent())
+    {
+        this->dedupEngine.SetPersistent(persistent);
+    }
+
+    if (initial || config.TimeBudgetMilliseconds != this->dedupEngine.GetTimeBudget())
+    {
+        this->dedupEngine.SetTimeBudget(config.TimeBudgetMilliseconds);
+    }
+
+    if (initial || extended != this->dedupEngine.IsExtended() || config.ExtendedBudgetMicroseconds != this->config.ExtendedBudgetMicroseconds)
+    {
+        this->dedupEngine.SetExtended(extended, config.ExtendedBudgetMicroseconds);
+    }
+
+    this->config = config;
+    return hr;
 }
 
 HRESULT STDMETHODCALLTYPE StringDedupingProfiler::ProfilerAttachComplete()
@@ -625,11 +887,15 @@ HRESULT STDMETHODCALLTYPE StringDedupingProfiler::ReJITError(ModuleID moduleId,
 
 HRESULT STDMETHODCALLTYPE StringDedupingProfiler::MovedReferences2(ULONG cMovedObjectIDRanges, ObjectID oldObjectIDRangeStart[], ObjectID newObjectIDRangeStart[], SIZE_T cObjectIDRangeLength[])
 {
+    this->dedupEngine.AddMovedReferences(cMovedObjectIDRanges, oldObjectIDRangeStart, newObjectIDRangeStart, cObjectIDRangeLength);
+
     return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE StringDedupingProfiler::SurvivingReferences2(ULONG cSurvivingObjectIDRanges, ObjectID objectIDRangeStart[], SIZE_T cObjectIDRangeLength[])
 {
+    this->dedupEngine.AddSurvivingReferences(cSurvivingObjectIDRanges, objectIDRangeStart, cObjectIDRangeLength);
+
     return S_OK;
 }
 
@@ -5,10 +5,28 @@
 
 #include <atomic>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <thread>
-#include <unordered_map>
 #include "cor.h"
 #include "corprof.h"
+#include "DedupConfig.h"
+#include "DedupEngine.h"
+#include "DedupReport.h"
+#include "DedupTriggerPolicy.h"
+#include "EventLog.h"
+
+// A collection that has started but not finished. A background gen2 collection runs
+// with the runtime resumed, and foreground collections can start and finish inside it,
+// so these nest. Resumes is the runtime resume count when the collection started: a
+// collection blocked only if the runtime was suspended when it started and has not
+// resumed by the time it finishes.
+struct DedupPendingCollection
+{
+    DedupTriggerDecision Decision;
+    bool Suspended;
+    ULONGLONG Resumes;
+};
 
 class StringDedupingProfiler : public ICorProfilerCallback9
 {
@@ -148,17 +166,62 @@ class StringDedupingProfiler : public ICorProfilerCallback9
         return count;
     }
 
+    void GetStatistics(DedupStatistics *statistics)
+    {
+        this->dedupEngine.GetStatistics(statistics);
+    }
+
+    // Takes effect from the next collection on.
+    void PublishConfig(const DedupConfig &config)
+    {
+        this->controlBlock.Publish(config);
+    }
+
+    // Captures the heap to path during the next pass, before it rewrites anything.
+    void RequestSnapshot(const WCHAR *path)
+    {
+        std::lock_guard<std::mutex> lock(this->snapshotLock);
+        this->snapshotPath = path;
+        this->snapshotRequested.store(true, std::memory_order_release);
+    }
+
   private:
+    static const int MaxPendingCollections = 4;
+
     bool nextGCIsSuspended;
+    ULONGLONG runtimeResumes;
+    DedupPendingCollection pendingCollections[MaxPendingCollections];
+    int pendingCollectionCount;
+    DedupTriggerPolicy triggerPolicy;
     std::atomic<int> refCount;
     ICorProfilerInfo10 *corProfilerInfo;
     SIZE_T stringMethodTable;
     ULONG stringLengthOffset;
     ULONG stringBufferOffset;
-    std::unordered_map<ULONG, ObjectID> hashToObjectMap;
+    ProfilerHeapInfo heapInfo;
+    DedupEngine dedupEngine;
+    DedupReportWriter reportWriter;
+    EventLog eventLog;
+
+    DedupControlBlock controlBlock;
+    uint32_t configSequence;
+    DedupConfig config;
+    DedupConfig pendingConfig;
+    std::atomic<bool> configPending;
+    bool enabled;
+    DWORD eventMask;
+
+    std::mutex snapshotLock;
+    std::basic_string<WCHAR> snapshotPath;
+    std::atomic<bool> snapshotRequested;
 
   private:
-    HRESULT GarbageCollectionStartedCore(int cGenerations);
+    HRESULT GarbageCollectionStartedCore();
+    void CaptureSnapshot(const std::vector<COR_PRF_GC_GENERATION_RANGE> &objectRanges);
+    HRESULT StartEventLog();
+    HRESULT OpenReportWriter();
+    void ApplyPassConfig(const DedupConfig &config);
+    HRESULT ApplyConfig(const DedupConfig &requested, bool initial);
 };
 
 #undef IfFailRet
@@ -0,0 +1,401 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <cstring>
+#include "StringHash.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define STRINGHASH_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#if defined(__GNUC__)
+#define STRINGHASH_TARGET(isa) __attribute__((target(isa)))
+#else
+#define STRINGHASH_TARGET(isa)
+#endif
+
+static const ULONG BlockChars = 32;
+static const uint16_t NonAsciiMask = 0xFF80;
+
+static const uint64_t Prime1 = 0x9E3779B185EBCA87ull;
+static const uint64_t Prime2 = 0xC2B2AE3D27D4EB4Full;
+static const uint64_t Prime3 = 0x165667B19E3779F9ull;
+static const uint64_t Prime4 = 0x85EBCA77C2B2AE63ull;
+static const uint64_t Prime5 = 0x27D4EB2F165667C5ull;
+
+// Keys for the first and second half of a UTF-16 block and for a narrowed ASCII block
+alignas(32) static const uint64_t Key0[4] = {0xBE4BA423396CFEB8ull, 0x1CAD21F72C81017Cull, 0xDB979083E96DD4DEull, 0x1F67B3B7A4A44072ull};
+alignas(32) static const uint64_t Key1[4] = {0x78E5C0CC4EE679CBull, 0x2172FFCC7DD05A82ull, 0x8E2443F7744608B8ull, 0x4C263A81E69035E0ull};
+alignas(32) static const uint64_t KeyAscii[4] = {0xCB00C391BB52283Cull, 0xA32E531B8B65D088ull, 0x4EF90DA297486471ull, 0xD8ACDEA946EF1938ull};
+
+static inline uint64_t Read64(const uint8_t *ptr)
+{
+    uint64_t value;
+    memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+static inline uint64_t RotateLeft(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t Avalanche(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= Prime2;
+    h ^= h >> 29;
+    h *= Prime3;
+    h ^= h >> 32;
+    return h;
+}
+
+static inline uint64_t Round(uint64_t h, uint64_t word)
+{
+    word *= Prime2;
+    word = RotateLeft(word, 31) * Prime1;
+    h ^= word;
+    return RotateLeft(h, 27) * Prime1 + Prime4;
+}
+
+static inline void InitializeAccumulators(uint64_t acc[4])
+{
+    acc[0] = Prime3;
+    acc[1] = Prime4;
+    acc[2] = Prime2;
+    acc[3] = Prime5;
+}
+
+// Mixes the accumulators of the block phase and then the characters that did not
+// fill a whole block. Shared by every kernel so their results agree.
+static uint64_t Finalize(const uint64_t acc[4], bool hasBlocks, const WCHAR *tail, ULONG tailLength, ULONG length)
+{
+    uint64_t h = Prime5 + (uint64_t)length * Prime1;
+
+    if (hasBlocks)
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            h = (h ^ Avalanche(acc[i])) * Prime1;
+        }
+    }
+
+    auto ptr = (const uint8_t *)tail;
+    SIZE_T bytes = (SIZE_T)tailLength * sizeof(WCHAR);
+    while (bytes >= sizeof(uint64_t))
+    {
+        h = Round(h, Read64(ptr));
+        ptr += sizeof(uint64_t);
+        bytes -= sizeof(uint64_t);
+    }
+
+    if (bytes != 0)
+    {
+        uint64_t word = 0;
+        memcpy(&word, ptr, bytes);
+        h = Round(h, word);
+    }
+
+    return Avalanche(h);
+}
+
+static inline void AccumulateStripe(uint64_t acc[4], const uint8_t *stripe, const uint64_t *key)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        uint64_t data = Read64(stripe + i * sizeof(uint64_t));
+        uint64_t dataKey = data ^ key[i];
+        acc[i ^ 1] += data;
+        acc[i] += (dataKey & 0xFFFFFFFF) * (dataKey >> 32);
+    }
+}
+
+uint64_t StringHash::HashScalar(const WCHAR *chars, ULONG length)
+{
+    uint64_t acc[4];
+    InitializeAccumulators(acc);
+
+    ULONG blocks = length / BlockChars;
+    for (ULONG b = 0; b < blocks; ++b)
+    {
+        const WCHAR *block = chars + b * BlockChars;
+
+        uint16_t combined = 0;
+        for (ULONG i = 0; i < BlockChars; ++i)
+        {
+            combined |= (uint16_t)block[i];
+        }
+
+        if ((combined & NonAsciiMask) == 0)
+        {
+            uint8_t narrowed[BlockChars];
+            for (ULONG i = 0; i < BlockChars; ++i)
+            {
+                narrowed[i] = (uint8_t)block[i];
+            }
+
+            AccumulateStripe(acc, narrowed, KeyAscii);
+        }
+        else
+        {
+            AccumulateStripe(acc, (const uint8_t *)block, Key0);
+            AccumulateStripe(acc, (const uint8_t *)block + BlockChars, Key1);
+        }
+    }
+
+    return Finalize(acc, blocks != 0, chars + blocks * BlockChars, length % BlockChars, length);
+}
+
+static bool EqualsScalar(const WCHAR *left, const WCHAR *right, ULONG length)
+{
+    return memcmp(left, right, (SIZE_T)length * sizeof(WCHAR)) == 0;
+}
+
+StringHashKernel StringHash::kernel = StringHashKernel::Scalar;
+StringHash::HashFunc StringHash::hashFunc = &StringHash::HashScalar;
+StringHash::EqualsFunc StringHash::equalsFunc = &EqualsScalar;
+
+#ifdef STRINGHASH_X86
+
+STRINGHASH_TARGET("sse2")
+static inline __m128i AccumulateSse2(__m128i acc, __m128i data, const uint64_t *key)
+{
+    __m128i dataKey = _mm_xor_si128(data, _mm_load_si128((const __m128i *)key));
+    __m128i product = _mm_mul_epu32(dataKey, _mm_srli_epi64(dataKey, 32));
+    __m128i swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+    return _mm_add_epi64(acc, _mm_add_epi64(product, swapped));
+}
+
+STRINGHASH_TARGET("sse2")
+uint64_t StringHash::HashSse2(const WCHAR *chars, ULONG length)
+{
+    alignas(16) uint64_t acc[4];
+    InitializeAccumulators(acc);
+
+    __m128i acc0 = _mm_load_si128((const __m128i *)acc);
+    __m128i acc1 = _mm_load_si128((const __m128i *)(acc + 2));
+    const __m128i nonAscii = _mm_set1_epi16((short)NonAsciiMask);
+    const __m128i zero = _mm_setzero_si128();
+
+    ULONG blocks = length / BlockChars;
+    for (ULONG b = 0; b < blocks; ++b)
+    {
+        auto block = (const __m128i *)(chars + b * BlockChars);
+        __m128i v0 = _mm_loadu_si128(block);
+        __m128i v1 = _mm_loadu_si128(block + 1);
+        __m128i v2 = _mm_loadu_si128(block + 2);
+        __m128i v3 = _mm_loadu_si128(block + 3);
+
+        __m128i combined = _mm_or_si128(_mm_or_si128(v0, v1), _mm_or_si128(v2, v3));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(combined, nonAscii), zero)) == 0xFFFF)
+        {
+            acc0 = AccumulateSse2(acc0, _mm_packus_epi16(v0, v1), KeyAscii);
+            acc1 = AccumulateSse2(acc1, _mm_packus_epi16(v2, v3), KeyAscii + 2);
+        }
+        else
+        {
+            acc0 = AccumulateSse2(acc0, v0, Key0);
+            acc1 = AccumulateSse2(acc1, v1, Key0 + 2);
+            acc0 = AccumulateSse2(acc0, v2, Key1);
+            acc1 = AccumulateSse2(acc1, v3, Key1 + 2);
+        }
+    }
+
+    _mm_store_si128((__m128i *)acc, acc0);
+    _mm_store_si128((__m128i *)(acc + 2), acc1);
+    return Finalize(acc, blocks != 0, chars + blocks * BlockChars, length % BlockChars, length);
+}
+
+STRINGHASH_TARGET("avx2")
+static inline __m256i AccumulateAvx2(__m256i acc, __m256i data, const uint64_t *key)
+{
+    __m256i dataKey = _mm256_xor_si256(data, _mm256_load_si256((const __m256i *)key));
+    __m256i product = _mm256_mul_epu32(dataKey, _mm256_srli_epi64(dataKey, 32));
+    __m256i swapped = _mm256_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+    return _mm256_add_epi64(acc, _mm256_add_epi64(product, swapped));
+}
+
+STRINGHASH_TARGET("avx2")
+uint64_t StringHash::HashAvx2(const WCHAR *chars, ULONG length)
+{
+    alignas(32) uint64_t acc[4];
+    InitializeAccumulators(acc);
+
+    __m256i acc0 = _mm256_load_si256((const __m256i *)acc);
+    const __m256i nonAscii = _mm256_set1_epi16((short)NonAsciiMask);
+    const __m256i zero = _mm256_setzero_si256();
+
+    ULONG blocks = length / BlockChars;
+    for (ULONG b = 0; b < blocks; ++b)
+    {
+        auto block = (const __m256i *)(chars + b * BlockChars);
+        __m256i v0 = _mm256_loadu_si256(block);
+        __m256i v1 = _mm256_loadu_si256(block + 1);
+
+        __m256i combined = _mm256_or_si256(v0, v1);
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_and_si256(combined, nonAscii), zero)) == -1)
+        {
+            // packus interleaves the 128-bit lanes, restore character order
+            __m256i narrowed = _mm256_permute4x64_epi64(_mm256_packus_epi16(v0, v1), _MM_SHUFFLE(3, 1, 2, 0));
+            acc0 = AccumulateAvx2(acc0, narrowed, KeyAscii);
+        }
+        else
+        {
+            acc0 = AccumulateAvx2(acc0, v0, Key0);
+            acc0 = AccumulateAvx2(acc0, v1, Key1);
+        }
+    }
+
+    _mm256_store_si256((__m256i *)acc, acc0);
+    return Finalize(acc, blocks != 0, chars + blocks * BlockChars, length % BlockChars, length);
+}
+
+STRINGHASH_TARGET("sse2")
+static bool EqualsSse2(const WCHAR *left, const WCHAR *right, ULONG length)
+{
+    auto l = (const uint8_t *)left;
+    auto r = (const uint8_t *)right;
+    SIZE_T bytes = (SIZE_T)length * sizeof(WCHAR);
+
+    while (bytes >= sizeof(__m128i))
+    {
+        __m128i equal = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)l), _mm_loadu_si128((const __m128i *)r));
+        if (_mm_movemask_epi8(equal) != 0xFFFF)
+        {
+            return false;
+        }
+
+        l += sizeof(__m128i);
+        r += sizeof(__m128i);
+        bytes -= sizeof(__m128i);
+    }
+
+    return memcmp(l, r, bytes) == 0;
+}
+
+STRINGHASH_TARGET("avx2")
+static bool EqualsAvx2(const WCHAR *left, const WCHAR *right, ULONG length)
+{
+    auto l = (const uint8_t *)left;
+    auto r = (const uint8_t *)right;
+    SIZE_T bytes = (SIZE_T)length * sizeof(WCHAR);
+
+    while (bytes >= sizeof(__m256i))
+    {
+        __m256i equal = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)l), _mm256_loadu_si256((const __m256i *)r));
+        if (_mm256_movemask_epi8(equal) != -1)
+        {
+            return false;
+        }
+
+        l += sizeof(__m256i);
+        r += sizeof(__m256i);
+        bytes -= sizeof(__m256i);
+    }
+
+    return memcmp(l, r, bytes) == 0;
+}
+
+static void CpuId(int info[4], int leaf, int subleaf)
+{
+#if defined(_MSC_VER)
+    __cpuidex(info, leaf, subleaf);
+#else
+    __cpuid_count(leaf, subleaf, info[0], info[1], info[2], info[3]);
+#endif
+}
+
+static uint64_t ReadXcr0()
+{
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    uint32_t eax, edx;
+    __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
+static StringHashKernel DetectKernel()
+{
+    int info[4];
+    CpuId(info, 0, 0);
+    int maxLeaf = info[0];
+
+    CpuId(info, 1, 0);
+    bool sse2 = (info[3] & (1 << 26)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+
+    if (osxsave && avx && maxLeaf >= 7 && (ReadXcr0() & 0x6) == 0x6)
+    {
+        CpuId(info, 7, 0);
+        if ((info[1] & (1 << 5)) != 0)
+        {
+            return StringHashKernel::Avx2;
+        }
+    }
+
+    return sse2 ? StringHashKernel::Sse2 : StringHashKernel::Scalar;
+}
+
+#else
+
+uint64_t StringHash::HashSse2(const WCHAR *chars, ULONG length)
+{
+    return HashScalar(chars, length);
+}
+
+uint64_t StringHash::HashAvx2(const WCHAR *chars, ULONG length)
+{
+    return HashScalar(chars, length);
+}
+
+static StringHashKernel DetectKernel()
+{
+    return StringHashKernel::Scalar;
+}
+
+#endif
+
+void StringHash::Initialize()
+{
+    kernel = DetectKernel();
+
+    switch (kernel)
+    {
+#ifdef STRINGHASH_X86
+    case StringHashKernel::Avx2:
+        hashFunc = &StringHash::HashAvx2;
+        equalsFunc = &EqualsAvx2;
+        break;
+    case StringHashKernel::Sse2:
+        hashFunc = &StringHash::HashSse2;
+        equalsFunc = &EqualsSse2;
+        break;
+#endif
+    default:
+        hashFunc = &StringHash::HashScalar;
+        equalsFunc = &EqualsScalar;
+        break;
+    }
+}
+
+const char *StringHash::GetKernelName()
+{
+    switch (kernel)
+    {
+    case StringHashKernel::Avx2:
+        return "AVX2";
+    case StringHashKernel::Sse2:
+        return "SSE2";
+    default:
+        return "Scalar";
+    }
+}
@@ -0,0 +1,55 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <cstdint>
+#include "cor.h"
+
+enum class StringHashKernel
+{
+    Scalar,
+    Sse2,
+    Avx2,
+};
+
+// Hashing and equality over the UTF-16 payload of a string, length * sizeof(WCHAR)
+// bytes. The kernel is chosen once from CPUID by Initialize; every kernel produces
+// the same hash for the same characters. Blocks of 32 characters that are entirely
+// ASCII are narrowed to bytes before mixing, which halves the multiply work for the
+// common case.
+class StringHash
+{
+  public:
+    static void Initialize();
+
+    static StringHashKernel GetKernel()
+    {
+        return kernel;
+    }
+
+    static const char *GetKernelName();
+
+    static uint64_t Hash(const WCHAR *chars, ULONG length)
+    {
+        return hashFunc(chars, length);
+    }
+
+    static bool Equals(const WCHAR *left, const WCHAR *right, ULONG length)
+    {
+        return equalsFunc(left, right, length);
+    }
+
+    // Exposed for consistency checks between kernels
+    static uint64_t HashScalar(const WCHAR *chars, ULONG length);
+    static uint64_t HashSse2(const WCHAR *chars, ULONG length);
+    static uint64_t HashAvx2(const WCHAR *chars, ULONG length);
+
+  private:
+    typedef uint64_t (*HashFunc)(const WCHAR *, ULONG);
+    typedef bool (*EqualsFunc)(const WCHAR *, const WCHAR *, ULONG);
+
+    static StringHashKernel kernel;
+    static HashFunc hashFunc;
+    static EqualsFunc equalsFunc;
+};
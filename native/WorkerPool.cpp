@@ -0,0 +1,121 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <system_error>
+#include "WorkerPool.h"
+
+WorkerPool::WorkerPool() : job(nullptr), generation(0), pending(0), stopping(false)
+{
+}
+
+WorkerPool::~WorkerPool()
+{
+    this->Stop();
+}
+
+bool WorkerPool::Start(int workerCount)
+{
+    this->Stop();
+
+    unsigned long long seen;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = false;
+        seen = this->generation;
+    }
+
+    for (int i = 1; i < workerCount; ++i)
+    {
+        try
+        {
+            this->threads.emplace_back(&WorkerPool::ThreadMain, this, i, seen);
+        }
+        catch (const std::system_error &)
+        {
+            // run with the workers that did start
+            return i > 1;
+        }
+    }
+
+    return true;
+}
+
+void WorkerPool::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+
+    this->jobReady.notify_all();
+
+    for (auto &thread : this->threads)
+    {
+        thread.join();
+    }
+
+    this->threads.clear();
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->job = nullptr;
+    this->pending = 0;
+}
+
+void WorkerPool::Run(const std::function<void(int)> &job)
+{
+    if (this->threads.empty())
+    {
+        job(0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->job = &job;
+        this->pending = (int)this->threads.size();
+        ++this->generation;
+    }
+
+    this->jobReady.notify_all();
+
+    job(0);
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->jobDone.wait(lock, [this] { return this->pending == 0; });
+    this->job = nullptr;
+}
+
+void WorkerPool::ThreadMain(int workerIndex, unsigned long long seen)
+{
+    while (true)
+    {
+        const std::function<void(int)> *current;
+
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->jobReady.wait(lock, [&] { return this->stopping || this->generation != seen; });
+            if (this->stopping)
+            {
+                return;
+            }
+
+            seen = this->generation;
+            current = this->job;
+            if (current == nullptr)
+            {
+                // the job finished before this thread woke up for it
+                continue;
+            }
+        }
+
+        (*current)(workerIndex);
+
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            if (--this->pending == 0)
+            {
+                this->jobDone.notify_one();
+            }
+        }
+    }
+}
@@ -0,0 +1,44 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fork-join pool of native threads. The threads are created up front so a pass never
+// pays for thread creation while the runtime is suspended. The calling thread takes
+// part in every job as worker 0.
+class WorkerPool
+{
+  public:
+    WorkerPool();
+    ~WorkerPool();
+
+    bool Start(int workerCount);
+    void Stop();
+
+    int GetWorkerCount() const
+    {
+        return (int)this->threads.size() + 1;
+    }
+
+    // Runs job(workerIndex) once on every worker and returns when all have finished.
+    void Run(const std::function<void(int)> &job);
+
+  private:
+    // seen is the generation when the thread was started; only later jobs are run.
+    void ThreadMain(int workerIndex, unsigned long long seen);
+
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable jobReady;
+    std::condition_variable jobDone;
+    const std::function<void(int)> *job;
+    unsigned long long generation;
+    int pending;
+    bool stopping;
+};
@@ -0,0 +1,186 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Measures how resolving candidates against the shared CanonicalStringTable scales
+// with the number of workers. The population is a set of synthetic string objects in
+// the runtime's layout, referenced with a skewed distribution so that a few strings
+// account for a large share of the references, as on real heaps.
+//
+// usage: CanonicalTableBenchmark [references] [distinct strings] [max workers]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include "CanonicalStringTable.h"
+#include "StringHash.h"
+#include "WorkerPool.h"
+
+// method table, length, then the characters, as in a 64-bit string object
+static const ULONG StringLengthOffset = sizeof(SIZE_T);
+static const ULONG StringBufferOffset = sizeof(SIZE_T) + sizeof(ULONG);
+
+struct Reference
+{
+    ObjectID String;
+    uint64_t Hash;
+    ULONG Length;
+};
+
+static ObjectID AllocateString(std::vector<SIZE_T> &heap, SIZE_T &used, const std::vector<WCHAR> &characters)
+{
+    SIZE_T bytes = StringBufferOffset + (characters.size() + 1) * sizeof(WCHAR);
+    SIZE_T words = (bytes + sizeof(SIZE_T) - 1) / sizeof(SIZE_T);
+
+    PBYTE object = (PBYTE)&heap[used];
+    used += words;
+
+    *(SIZE_T *)object = 1;
+    *(ULONG *)(object + StringLengthOffset) = (ULONG)characters.size();
+    std::copy(characters.begin(), characters.end(), (WCHAR *)(object + StringBufferOffset));
+    return (ObjectID)object;
+}
+
+static void BuildPopulation(SIZE_T referenceCount, SIZE_T distinctCount, std::vector<SIZE_T> &heap, std::vector<Reference> &references)
+{
+    std::mt19937_64 random(42);
+    std::vector<std::vector<WCHAR>> contents(distinctCount);
+    SIZE_T words = 0;
+
+    for (SIZE_T i = 0; i < distinctCount; ++i)
+    {
+        SIZE_T length = 8 + random() % 40;
+        for (SIZE_T c = 0; c < length; ++c)
+        {
+            contents[i].push_back((WCHAR)('a' + random() % 26));
+        }
+
+        // make every content distinct
+        for (SIZE_T n = i; n != 0; n /= 26)
+        {
+            contents[i].push_back((WCHAR)('A' + n % 26));
+        }
+    }
+
+    // every reference gets its own string object, so each one is a duplicate to fold
+    // except the first copy of each content
+    std::vector<SIZE_T> picks(referenceCount);
+    for (SIZE_T i = 0; i < referenceCount; ++i)
+    {
+        // squaring a uniform variate favors the low indices
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(random);
+        picks[i] = (SIZE_T)(u * u * distinctCount) % distinctCount;
+        words += (StringBufferOffset + (contents[picks[i]].size() + 1) * sizeof(WCHAR) + sizeof(SIZE_T) - 1) / sizeof(SIZE_T);
+    }
+
+    heap.assign(words, 0);
+    SIZE_T used = 0;
+
+    references.resize(referenceCount);
+    for (SIZE_T i = 0; i < referenceCount; ++i)
+    {
+        const std::vector<WCHAR> &characters = contents[picks[i]];
+        references[i].String = AllocateString(heap, used, characters);
+        references[i].Hash = StringHash::Hash(characters.data(), (ULONG)characters.size());
+        references[i].Length = (ULONG)characters.size();
+    }
+}
+
+static double Resolve(CanonicalStringTable &table, WorkerPool &pool, const std::vector<Reference> &references, SIZE_T *canonicalCount)
+{
+    int workerCount = pool.GetWorkerCount();
+    std::vector<SIZE_T> inserted(workerCount);
+
+    table.Clear();
+    table.Reserve(references.size());
+
+    auto start = std::chrono::steady_clock::now();
+
+    pool.Run([&](int worker) {
+        SIZE_T slice = (references.size() + workerCount - 1) / workerCount;
+        SIZE_T begin = std::min(references.size(), slice * worker);
+        SIZE_T end = std::min(references.size(), begin + slice);
+
+        for (SIZE_T i = begin; i < end; ++i)
+        {
+            const Reference &reference = references[i];
+            WCHAR *stringData = (WCHAR *)((PBYTE)reference.String + StringBufferOffset);
+
+            bool added;
+            table.FindOrInsert(reference.Hash, reference.Length, reference.String, [=](ObjectID existing) {
+                return StringHash::Equals(stringData, (WCHAR *)((PBYTE)existing + StringBufferOffset), reference.Length);
+            }, &added);
+
+            if (added)
+            {
+                ++inserted[worker];
+            }
+        }
+    });
+
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    *canonicalCount = 0;
+    for (SIZE_T count : inserted)
+    {
+        *canonicalCount += count;
+    }
+
+    return std::chrono::duration<double>(elapsed).count();
+}
+
+int main(int argc, char **argv)
+{
+    SIZE_T referenceCount = argc > 1 ? strtoull(argv[1], nullptr, 10) : 8 * 1024 * 1024;
+    SIZE_T distinctCount = argc > 2 ? strtoull(argv[2], nullptr, 10) : 1024 * 1024;
+    int maxWorkers = argc > 3 ? atoi(argv[3]) : 64;
+
+    StringHash::Initialize();
+
+    std::vector<SIZE_T> heap;
+    std::vector<Reference> references;
+    BuildPopulation(referenceCount, distinctCount, heap, references);
+
+    printf("%llu references, %llu distinct strings, hash kernel %s\n", (unsigned long long)referenceCount, (unsigned long long)distinctCount, StringHash::GetKernelName());
+    printf("%8s %12s %14s %10s %12s\n", "workers", "seconds", "lookups/s", "speedup", "canonical");
+
+    CanonicalStringTable table;
+    double baseline = 0;
+    SIZE_T expectedCanonicalCount = 0;
+
+    for (int workers = 1; workers <= maxWorkers; workers *= 2)
+    {
+        WorkerPool pool;
+        pool.Start(workers);
+
+        // one warm-up round so page faults on the table are not measured
+        SIZE_T canonicalCount;
+        Resolve(table, pool, references, &canonicalCount);
+
+        double best = 0;
+        for (int round = 0; round < 3; ++round)
+        {
+            double seconds = Resolve(table, pool, references, &canonicalCount);
+            best = round == 0 ? seconds : std::min(best, seconds);
+        }
+
+        if (workers == 1)
+        {
+            baseline = best;
+            expectedCanonicalCount = canonicalCount;
+        }
+
+        printf("%8d %12.4f %14.0f %10.2f %12llu\n", pool.GetWorkerCount(), best, referenceCount / best, baseline / best, (unsigned long long)canonicalCount);
+
+        // every content has exactly one canonical copy however the lookups interleave
+        if (canonicalCount != expectedCanonicalCount)
+        {
+            printf("error: expected %llu canonical strings\n", (unsigned long long)expectedCanonicalCount);
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,101 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Checks that DedupConfig::Read takes from a caller's structure only the fields and
+// flags of the version it was written against. Each older layout is filled with
+// garbage past its last field, where a newer version put fields into what used to be
+// padding. Exits with 1 if any check fails.
+//
+// usage: ConfigCheck
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "DedupConfig.h"
+
+static int failures = 0;
+
+static void Check(bool condition, const char *what)
+{
+    if (!condition)
+    {
+        printf("error: %s\n", what);
+        ++failures;
+    }
+}
+
+// A caller's structure of the given version and size, with every byte past the
+// fields of that version set to 0xFF.
+static std::vector<BYTE> CallerConfig(uint32_t version, SIZE_T size, SIZE_T fieldsEnd, uint32_t flags)
+{
+    DedupConfig config = DedupConfig::Default();
+    config.Size = (uint32_t)size;
+    config.Version = version;
+    config.Flags = flags;
+    config.WorkerCount = 3;
+    config.MinimumLength = 5;
+    config.ExtendedBudgetMicroseconds = 250;
+    config.CanonicalPolicy = 1;
+
+    std::vector<BYTE> data(size, 0xFF);
+    memcpy(data.data(), &config, fieldsEnd < size ? fieldsEnd : size);
+    return data;
+}
+
+int main()
+{
+    DedupConfig defaults = DedupConfig::Default();
+    DedupConfig config;
+
+    const SIZE_T version1End = offsetof(DedupConfig, ExtendedBudgetMicroseconds);
+    const SIZE_T version2End = offsetof(DedupConfig, CanonicalPolicy);
+    const SIZE_T version2Size = (version2End + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t);
+
+    uint32_t allFlags = DedupConfigEnabled | DedupConfigPersistent | DedupConfigExtended | DedupConfigSeedFrozen;
+
+    // version 1: the version 2 and 3 fields and flags keep their defaults
+    std::vector<BYTE> version1 = CallerConfig(1, version1End, version1End, allFlags);
+    Check(DedupConfig::Read(version1.data(), version1.size(), &config), "version 1 is read");
+    Check(config.WorkerCount == 3 && config.MinimumLength == 5, "version 1 fields are taken");
+    Check((config.Flags & DedupConfigPersistent) != 0, "version 1 flags are taken");
+    Check((config.Flags & DedupConfigExtended) == 0, "version 1 cannot set the extended flag");
+    Check((config.Flags & DedupConfigSeedFrozen) == 0, "version 1 cannot set the seed-frozen flag");
+    Check((config.Flags & DedupConfigFoldShortStrings) == (defaults.Flags & DedupConfigFoldShortStrings), "version 1 keeps the default short-string folding");
+    Check(config.ExtendedBudgetMicroseconds == defaults.ExtendedBudgetMicroseconds, "version 1 keeps the default extended budget");
+    Check(config.CanonicalPolicy == defaults.CanonicalPolicy, "version 1 keeps the default canonical policy");
+
+    // version 2: the same size as version 3, with the version 3 field in its padding
+    Check(version2Size == sizeof(DedupConfig), "version 3 fits in the padding of version 2");
+    std::vector<BYTE> version2 = CallerConfig(2, version2Size, version2End, allFlags);
+    Check(DedupConfig::Read(version2.data(), version2.size(), &config), "version 2 is read");
+    Check((config.Flags & DedupConfigExtended) != 0, "version 2 sets the extended flag");
+    Check(config.ExtendedBudgetMicroseconds == 250, "version 2 sets the extended budget");
+    Check((config.Flags & DedupConfigSeedFrozen) == 0, "version 2 cannot set the seed-frozen flag");
+    Check(config.CanonicalPolicy == defaults.CanonicalPolicy, "version 2 padding is not read as the canonical policy");
+
+    // version 3: everything is taken
+    std::vector<BYTE> version3 = CallerConfig(3, sizeof(DedupConfig), sizeof(DedupConfig), allFlags);
+    Check(DedupConfig::Read(version3.data(), version3.size(), &config), "version 3 is read");
+    Check((config.Flags & DedupConfigSeedFrozen) != 0, "version 3 sets the seed-frozen flag");
+    Check((config.Flags & DedupConfigFoldShortStrings) == 0, "version 3 clears short-string folding");
+    Check(config.CanonicalPolicy == 1, "version 3 sets the canonical policy");
+    Check(config.Size == sizeof(DedupConfig) && config.Version == DedupConfig::CurrentVersion, "the copy is of the current version");
+
+    // a later version: the known fields are taken and the rest ignored
+    std::vector<BYTE> later = CallerConfig(DedupConfig::CurrentVersion + 1, sizeof(DedupConfig) + 16, sizeof(DedupConfig), allFlags);
+    Check(DedupConfig::Read(later.data(), later.size(), &config), "a later version is read");
+    Check(config.CanonicalPolicy == 1 && config.WorkerCount == 3, "a later version's known fields are taken");
+
+    // malformed
+    Check(!DedupConfig::Read(nullptr, 0, &config), "no data is refused");
+    Check(!DedupConfig::Read(version1.data(), offsetof(DedupConfig, Version), &config), "a truncated header is refused");
+    Check(!DedupConfig::Read(version3.data(), version3.size() - sizeof(uint64_t), &config), "a size that does not match is refused");
+    Check(config.Flags == defaults.Flags && config.WorkerCount == defaults.WorkerCount, "a refused config leaves the defaults");
+
+    if (failures == 0)
+    {
+        printf("all config checks passed\n");
+    }
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,355 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Checks what a deduping pass over a SyntheticHeap leaves behind under each canonical
+// policy: every content referenced through one copy, the lowest-addressed copy with
+// LowestAddress, and the frozen copy when frozen strings are seeded. The first third
+// of gen2 stands in for a frozen segment. Also checks that one-character strings are
+// folded whether or not they go through the table, that one engine keeps deduping as
+// its worker count changes between passes, that a truncated statistics copy reports
+// the version that fits, and that a report-only pass leaves the heap alone and reports
+// about what a real pass dedupes, leaving out what a memory limit kept it from
+// tracking. Exits with 1 if any check fails.
+//
+// usage: DedupEngineCheck [objects] [workers]
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+#include "DedupEngine.h"
+#include "ReferenceScan.h"
+#include "StringHash.h"
+#include "SyntheticHeap.h"
+
+static int failures = 0;
+
+static void Check(bool condition, const char *what)
+{
+    if (!condition)
+    {
+        printf("error: %s\n", what);
+        ++failures;
+    }
+}
+
+typedef std::basic_string<WCHAR> Content;
+
+// Reports the objects below frozenEnd as frozen.
+class FrozenSyntheticHeap : public ManagedHeapInfo
+{
+  public:
+    FrozenSyntheticHeap(SyntheticHeap *heap, ObjectID frozenEnd) : heap(heap), frozenEnd(frozenEnd)
+    {
+    }
+
+    HRESULT GetObjectSize(ObjectID object, SIZE_T *size) override
+    {
+        return this->heap->GetObjectSize2(object, size);
+    }
+
+    HRESULT IsFrozenObject(ObjectID object, BOOL *frozen) override
+    {
+        *frozen = object < this->frozenEnd;
+        return S_OK;
+    }
+
+  private:
+    SyntheticHeap *heap;
+    ObjectID frozenEnd;
+};
+
+struct CheckHeap
+{
+    SyntheticHeap Heap;
+    ObjectID Start;
+    ObjectID End;
+    // the first object past the first third of gen2
+    ObjectID FrozenEnd;
+    std::vector<COR_PRF_GC_GENERATION_RANGE> Ranges;
+    // gen2 cut at FrozenEnd, so the frozen part is a range of its own
+    std::vector<COR_PRF_GC_GENERATION_RANGE> FrozenRanges;
+
+    bool IsString(ObjectID object) const
+    {
+        return object >= this->Start && object < this->End && *(SIZE_T *)object == this->Heap.GetStringMethodTable();
+    }
+
+    static Content ContentOf(ObjectID string)
+    {
+        ULONG length = *(ULONG *)(string + SyntheticHeap::StringLengthOffset);
+        WCHAR *text = (WCHAR *)(string + SyntheticHeap::StringBufferOffset);
+        return Content(text, text + length);
+    }
+
+    static SIZE_T SizeOf(ObjectID string)
+    {
+        SIZE_T size = (SyntheticHeap::StringBufferOffset + ((SIZE_T)ContentOf(string).size() + 1) * sizeof(WCHAR) + sizeof(SIZE_T) - 1) & ~(sizeof(SIZE_T) - 1);
+        return size > 3 * sizeof(SIZE_T) ? size : 3 * sizeof(SIZE_T);
+    }
+
+    // The string referenced from each slot of an object at or above from.
+    std::vector<std::pair<ObjectID *, ObjectID>> StringReferences(ObjectID from) const
+    {
+        std::vector<std::pair<ObjectID *, ObjectID>> references;
+        this->Heap.ForEachReference([&](ObjectID object, ObjectID *slot) {
+            if (object >= from && this->IsString(*slot))
+            {
+                references.emplace_back(slot, *slot);
+            }
+        });
+
+        return references;
+    }
+
+    bool Build(SIZE_T objects)
+    {
+        SyntheticHeapSettings settings;
+        settings.Objects = objects;
+        settings.MinimumLength = 1;
+        settings.MaximumLength = 64;
+        settings.YoungRatio = 0;
+        if (!this->Heap.Build(settings))
+        {
+            return false;
+        }
+
+        ULONG rangeCount;
+        this->Heap.GetGenerationBounds(0, &rangeCount, nullptr);
+        this->Ranges.resize(rangeCount);
+        this->Heap.GetGenerationBounds(rangeCount, &rangeCount, this->Ranges.data());
+
+        for (const COR_PRF_GC_GENERATION_RANGE &range : this->Ranges)
+        {
+            if (range.generation != COR_PRF_GC_GEN_2)
+            {
+                this->FrozenRanges.push_back(range);
+                continue;
+            }
+
+            this->Start = range.rangeStart;
+            this->End = range.rangeStart + range.rangeLength;
+            this->FrozenEnd = this->Start;
+            while (this->FrozenEnd - this->Start < range.rangeLength / 3)
+            {
+                SIZE_T size;
+                this->Heap.GetObjectSize2(this->FrozenEnd, &size);
+                this->FrozenEnd += (size + sizeof(SIZE_T) - 1) & ~(sizeof(SIZE_T) - 1);
+            }
+
+            COR_PRF_GC_GENERATION_RANGE frozen = range;
+            frozen.rangeLength = this->FrozenEnd - this->Start;
+            COR_PRF_GC_GENERATION_RANGE rest = range;
+            rest.rangeStart = this->FrozenEnd;
+            rest.rangeLength = this->End - this->FrozenEnd;
+            this->FrozenRanges.push_back(frozen);
+            this->FrozenRanges.push_back(rest);
+        }
+
+        return true;
+    }
+};
+
+static bool RunPass(ManagedHeapInfo *heapInfo, CheckHeap &heap, const std::vector<COR_PRF_GC_GENERATION_RANGE> &ranges, int workers, DedupCanonicalPolicy policy, bool seedFrozen, bool foldShortStrings, bool reportOnly, DedupStatistics *statistics, DedupReport *report)
+{
+    DedupEngine engine;
+    engine.Initialize(heapInfo, heap.Heap.GetStringMethodTable(), SyntheticHeap::StringLengthOffset, SyntheticHeap::StringBufferOffset);
+    if (!engine.StartWorkers(workers))
+    {
+        return false;
+    }
+
+    engine.SetCanonicalPolicy(policy, seedFrozen);
+    engine.SetFoldShortStrings(foldShortStrings);
+    engine.SetReportOnly(reportOnly, 10);
+    engine.PrepareNextPass();
+
+    HRESULT hr = engine.Run(ranges);
+    statistics->Size = sizeof(*statistics);
+    engine.GetStatistics(statistics);
+    bool reported = engine.TakeReport(report);
+    engine.StopWorkers();
+
+    return SUCCEEDED(hr) && reported == reportOnly;
+}
+
+static void CheckOneCopyPerContent(CheckHeap &heap, const char *what)
+{
+    SIZE_T objects, contents;
+    heap.Heap.CountReferencedStrings(&objects, &contents);
+    Check(objects == contents, what);
+}
+
+int main(int argc, char **argv)
+{
+    SIZE_T objects = argc > 1 ? strtoull(argv[1], nullptr, 10) : 200000;
+    int workers = argc > 2 ? atoi(argv[2]) : 4;
+
+    StringHash::Initialize();
+    ReferenceScan::Initialize(StringHash::GetKernel() == StringHashKernel::Avx2);
+
+    CheckHeap heap;
+    if (!heap.Build(objects))
+    {
+        printf("error: could not build the heap\n");
+        return 1;
+    }
+
+    DedupStatistics statistics = {};
+    DedupReport report;
+
+    // the lowest-addressed copy of each content, and the copy in the frozen third
+    std::map<Content, ObjectID> lowest;
+    std::map<Content, ObjectID> frozen;
+    for (const auto &reference : heap.StringReferences(heap.Start))
+    {
+        Content content = CheckHeap::ContentOf(reference.second);
+        auto found = lowest.find(content);
+        if (found == lowest.end() || reference.second < found->second)
+        {
+            lowest[content] = reference.second;
+        }
+
+        if (reference.second < heap.FrozenEnd && frozen.find(content) == frozen.end())
+        {
+            frozen[content] = reference.second;
+        }
+    }
+
+    // the exact duplicates a pass folds, for checking the report's estimates
+    SIZE_T duplicateInstances = 0;
+    SIZE_T wastedBytes = 0;
+    {
+        std::map<ObjectID, bool> seen;
+        for (const auto &reference : heap.StringReferences(heap.Start))
+        {
+            if (!seen[reference.second])
+            {
+                seen[reference.second] = true;
+                if (lowest[CheckHeap::ContentOf(reference.second)] != reference.second)
+                {
+                    ++duplicateInstances;
+                    wastedBytes += CheckHeap::SizeOf(reference.second);
+                }
+            }
+        }
+    }
+
+    for (int fold = 0; fold < 2; ++fold)
+    {
+        heap.Heap.Reset();
+        Check(RunPass(&heap.Heap, heap, heap.Ranges, workers, DedupCanonicalPolicy::FirstSeen, false, fold != 0, false, &statistics, &report), "first-seen pass runs");
+        CheckOneCopyPerContent(heap, fold != 0 ? "first-seen with folding leaves one copy per content" : "first-seen without folding leaves one copy per content");
+    }
+
+    heap.Heap.Reset();
+    Check(RunPass(&heap.Heap, heap, heap.Ranges, workers, DedupCanonicalPolicy::LowestAddress, false, true, false, &statistics, &report), "lowest-address pass runs");
+    CheckOneCopyPerContent(heap, "lowest-address leaves one copy per content");
+    {
+        SIZE_T notLowest = 0;
+        for (const auto &reference : heap.StringReferences(heap.Start))
+        {
+            notLowest += lowest[CheckHeap::ContentOf(reference.second)] != reference.second ? 1 : 0;
+        }
+
+        Check(notLowest == 0, "lowest-address references only the lowest-addressed copy");
+    }
+
+    heap.Heap.Reset();
+    FrozenSyntheticHeap frozenHeap(&heap.Heap, heap.FrozenEnd);
+    Check(RunPass(&frozenHeap, heap, heap.FrozenRanges, workers, DedupCanonicalPolicy::LowestAddress, true, true, false, &statistics, &report), "seeded pass runs");
+    {
+        SIZE_T notFrozen = 0;
+        for (const auto &reference : heap.StringReferences(heap.FrozenEnd))
+        {
+            auto found = frozen.find(CheckHeap::ContentOf(reference.second));
+            notFrozen += found != frozen.end() && reference.second >= heap.FrozenEnd ? 1 : 0;
+        }
+
+        Check(notFrozen == 0, "seeding references the frozen copy of every content that has one");
+    }
+
+    {
+        // one engine across passes, as when a new config changes the worker count
+        DedupEngine engine;
+        engine.Initialize(&heap.Heap, heap.Heap.GetStringMethodTable(), SyntheticHeap::StringLengthOffset, SyntheticHeap::StringBufferOffset);
+        int workerCounts[] = { workers, workers + 1, 1, workers };
+        for (int count : workerCounts)
+        {
+            heap.Heap.Reset();
+            Check(engine.StartWorkers(count), "workers restart with a new count");
+            engine.PrepareNextPass();
+            Check(SUCCEEDED(engine.Run(heap.Ranges)), "a pass runs after the worker count changes");
+            CheckOneCopyPerContent(heap, "a pass after the worker count changes leaves one copy per content");
+        }
+
+        // a caller's structure that ends part-way through version 2 gets version 1
+        DedupStatistics truncated = {};
+        truncated.Size = (uint32_t)(offsetof(DedupStatistics, LastExtended) + sizeof(uint64_t));
+        engine.GetStatistics(&truncated);
+        Check(truncated.Version == 1 && truncated.Passes == 4, "a truncated copy reports the version that fits");
+        truncated.Size = sizeof(truncated);
+        engine.GetStatistics(&truncated);
+        Check(truncated.Version == DedupStatistics::CurrentVersion, "a full copy reports the current version");
+
+        engine.StopWorkers();
+    }
+
+    heap.Heap.Reset();
+    DedupStatistics realPass = {};
+    Check(RunPass(&heap.Heap, heap, heap.Ranges, workers, DedupCanonicalPolicy::LowestAddress, false, true, false, &realPass, &report), "real pass runs");
+
+    heap.Heap.Reset();
+    std::vector<std::pair<ObjectID *, ObjectID>> before = heap.StringReferences(heap.Start);
+    Check(RunPass(&heap.Heap, heap, heap.Ranges, workers, DedupCanonicalPolicy::LowestAddress, false, true, true, &statistics, &report), "report-only pass runs");
+    {
+        SIZE_T changed = 0;
+        for (const auto &reference : before)
+        {
+            changed += *reference.first != reference.second ? 1 : 0;
+        }
+
+        Check(changed == 0, "report-only leaves every reference alone");
+        Check(report.DuplicateReferences == realPass.LastPass.Dedupes, "report-only counts every reference a real pass rewrites");
+        Check(report.DistinctStrings == lowest.size(), "report-only counts every distinct content");
+
+        double instanceError = (double)report.DuplicateInstances / duplicateInstances - 1;
+        double wastedError = (double)report.WastedBytes / wastedBytes - 1;
+        Check(instanceError > -0.05 && instanceError < 0.05, "report-only estimates the duplicate instances within 5%");
+        Check(wastedError > -0.05 && wastedError < 0.05, "report-only estimates the wasted bytes within 5%");
+
+        bool sorted = !report.TopStrings.empty();
+        for (SIZE_T i = 0; i < report.TopStrings.size(); ++i)
+        {
+            const DedupReportString &string = report.TopStrings[i];
+            sorted &= i == 0 || string.WastedBytes <= report.TopStrings[i - 1].WastedBytes;
+            sorted &= string.Text.size() == (string.Length < DedupReport::MaxTextLength ? string.Length : DedupReport::MaxTextLength);
+        }
+
+        Check(report.TopStrings.size() <= 10 && sorted, "report-only lists the top strings by wasted bytes");
+    }
+
+    {
+        // a memory limit too small for every content leaves references untracked
+        heap.Heap.Reset();
+        DedupEngine engine;
+        engine.Initialize(&heap.Heap, heap.Heap.GetStringMethodTable(), SyntheticHeap::StringLengthOffset, SyntheticHeap::StringBufferOffset);
+        Check(engine.StartWorkers(workers), "limited report-only workers start");
+        engine.SetReportOnly(true, 10);
+        engine.SetMemoryLimit(64 * 1024);
+        engine.PrepareNextPass();
+        Check(SUCCEEDED(engine.Run(heap.Ranges)) && engine.TakeReport(&report), "limited report-only pass runs");
+        engine.StopWorkers();
+
+        Check(report.UntrackedReferences != 0, "a limited report-only pass counts untracked references");
+        Check(report.DistinctStrings < lowest.size(), "untracked references are not counted as distinct contents");
+    }
+
+    if (failures == 0)
+    {
+        printf("all engine checks passed\n");
+    }
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,91 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Runs full deduping passes over a heap captured with CaptureStringDedupSnapshot and
+// reports them like HeapWalkBenchmark. The snapshot is mapped again before every pass,
+// so each one starts from the heap as it was captured.
+//
+// usage: HeapSnapshotReplay <snapshot> [workers] [passes]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "DedupEngine.h"
+#include "ReferenceScan.h"
+#include "SnapshotHeap.h"
+#include "StringHash.h"
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        printf("usage: HeapSnapshotReplay <snapshot> [workers] [passes]\n");
+        return 1;
+    }
+
+    int workers = argc > 2 ? atoi(argv[2]) : 8;
+    int passes = argc > 3 ? atoi(argv[3]) : 5;
+
+    StringHash::Initialize();
+    ReferenceScan::Initialize(StringHash::GetKernel() == StringHashKernel::Avx2);
+
+    SnapshotHeap heap;
+    HRESULT hr = heap.Open(argv[1]);
+    if (FAILED(hr))
+    {
+        printf("error: could not open %s (0x%08x); E_OUTOFMEMORY means an address it needs is in use, try again\n", argv[1], (unsigned int)hr);
+        return 1;
+    }
+
+    printf("%llu ranges, %.1f MB in gen2, %.1f MB in all, %llu MethodTables, hash kernel %s\n", (unsigned long long)heap.GetRanges().size(), heap.GetBytes(COR_PRF_GC_GEN_2) / (1024.0 * 1024.0), heap.GetBytes(COR_PRF_GC_GEN_0) / (1024.0 * 1024.0), (unsigned long long)heap.GetMethodTableCount(), StringHash::GetKernelName());
+
+    DedupEngine engine;
+    engine.Initialize(&heap, heap.GetStringMethodTable(), heap.GetStringLengthOffset(), heap.GetStringBufferOffset());
+    if (!engine.StartWorkers(workers))
+    {
+        printf("error: could not start %d workers\n", workers);
+        return 1;
+    }
+
+    printf("%6s %10s %10s %10s %10s %14s %14s %12s %14s\n", "pass", "total ms", "walk ms", "resolve ms", "rewrite ms", "objects/s", "refs/s", "dedupes", "bytes saved");
+
+    std::vector<double> latencies;
+    for (int pass = 1; pass <= passes; ++pass)
+    {
+        if (pass > 1 && FAILED(heap.Reset()))
+        {
+            printf("error: could not map the snapshot again\n");
+            return 1;
+        }
+
+        engine.PrepareNextPass();
+
+        hr = engine.Run(heap.GetRanges());
+        if (FAILED(hr))
+        {
+            printf("error: pass %d failed with 0x%08x\n", pass, (unsigned int)hr);
+            return 1;
+        }
+
+        DedupStatistics statistics = {};
+        statistics.Size = sizeof(statistics);
+        engine.GetStatistics(&statistics);
+
+        const DedupPassCounters &counters = statistics.LastPass;
+        double seconds = counters.TotalNanoseconds / 1e9;
+        latencies.push_back(seconds * 1e3);
+
+        printf("%6d %10.2f %10.2f %10.2f %10.2f %14.0f %14.0f %12llu %14llu\n", pass, seconds * 1e3, counters.WalkNanoseconds / 1e6, counters.ResolveNanoseconds / 1e6, counters.RewriteNanoseconds / 1e6, counters.ObjectsScanned / seconds, counters.ReferencesVisited / seconds, (unsigned long long)counters.Dedupes, (unsigned long long)counters.BytesReclaimed);
+    }
+
+    engine.StopWorkers();
+
+    if (!latencies.empty())
+    {
+        std::sort(latencies.begin(), latencies.end());
+        printf("pass latency ms: min %.2f, median %.2f, max %.2f\n", latencies.front(), latencies[latencies.size() / 2], latencies.back());
+    }
+
+    return 0;
+}
@@ -0,0 +1,99 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Runs full deduping passes over a SyntheticHeap and reports how fast objects and
+// references are walked and how long a pass takes. The heap is restored before every
+// pass, so each one does the same work. After the last pass it checks that every
+// gen2 string content is referenced through a single copy.
+//
+// usage: HeapWalkBenchmark [objects] [duplicate ratio] [min length] [max length] [workers] [passes]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "DedupEngine.h"
+#include "ReferenceScan.h"
+#include "StringHash.h"
+#include "SyntheticHeap.h"
+
+int main(int argc, char **argv)
+{
+    SyntheticHeapSettings settings;
+    settings.Objects = argc > 1 ? strtoull(argv[1], nullptr, 10) : 4 * 1024 * 1024;
+    settings.DuplicateRatio = argc > 2 ? atof(argv[2]) : 0.5;
+    settings.MinimumLength = argc > 3 ? (ULONG)strtoul(argv[3], nullptr, 10) : 4;
+    settings.MaximumLength = argc > 4 ? (ULONG)strtoul(argv[4], nullptr, 10) : 64;
+    int workers = argc > 5 ? atoi(argv[5]) : 8;
+    int passes = argc > 6 ? atoi(argv[6]) : 5;
+
+    StringHash::Initialize();
+    ReferenceScan::Initialize(StringHash::GetKernel() == StringHashKernel::Avx2);
+
+    SyntheticHeap heap;
+    if (!heap.Build(settings))
+    {
+        printf("error: could not build the heap\n");
+        return 1;
+    }
+
+    printf("%llu objects, %llu strings, %.1f MB, duplicate ratio %.2f, lengths %u-%u, hash kernel %s\n", (unsigned long long)heap.GetObjectCount(), (unsigned long long)heap.GetStringCount(), heap.GetBytes() / (1024.0 * 1024.0), settings.DuplicateRatio, settings.MinimumLength, settings.MaximumLength, StringHash::GetKernelName());
+
+    DedupEngine engine;
+    engine.Initialize(&heap, heap.GetStringMethodTable(), SyntheticHeap::StringLengthOffset, SyntheticHeap::StringBufferOffset);
+    if (!engine.StartWorkers(workers))
+    {
+        printf("error: could not start %d workers\n", workers);
+        return 1;
+    }
+
+    ULONG rangeCount;
+    heap.GetGenerationBounds(0, &rangeCount, nullptr);
+    std::vector<COR_PRF_GC_GENERATION_RANGE> ranges(rangeCount);
+    heap.GetGenerationBounds(rangeCount, &rangeCount, ranges.data());
+
+    printf("%6s %10s %10s %10s %10s %14s %14s %12s\n", "pass", "total ms", "walk ms", "resolve ms", "rewrite ms", "objects/s", "refs/s", "dedupes");
+
+    std::vector<double> latencies;
+    for (int pass = 1; pass <= passes; ++pass)
+    {
+        heap.Reset();
+        engine.PrepareNextPass();
+
+        HRESULT hr = engine.Run(ranges);
+        if (FAILED(hr))
+        {
+            printf("error: pass %d failed with 0x%08x\n", pass, (unsigned int)hr);
+            return 1;
+        }
+
+        DedupStatistics statistics = {};
+        statistics.Size = sizeof(statistics);
+        engine.GetStatistics(&statistics);
+
+        const DedupPassCounters &counters = statistics.LastPass;
+        double seconds = counters.TotalNanoseconds / 1e9;
+        latencies.push_back(seconds * 1e3);
+
+        printf("%6d %10.2f %10.2f %10.2f %10.2f %14.0f %14.0f %12llu\n", pass, seconds * 1e3, counters.WalkNanoseconds / 1e6, counters.ResolveNanoseconds / 1e6, counters.RewriteNanoseconds / 1e6, counters.ObjectsScanned / seconds, counters.ReferencesVisited / seconds, (unsigned long long)counters.Dedupes);
+    }
+
+    engine.StopWorkers();
+
+    if (!latencies.empty())
+    {
+        std::sort(latencies.begin(), latencies.end());
+        printf("pass latency ms: min %.2f, median %.2f, max %.2f\n", latencies.front(), latencies[latencies.size() / 2], latencies.back());
+
+        SIZE_T referencedStrings;
+        SIZE_T distinctContents;
+        heap.CountReferencedStrings(&referencedStrings, &distinctContents);
+        if (referencedStrings != distinctContents)
+        {
+            printf("error: %llu string objects referenced for %llu distinct contents\n", (unsigned long long)referencedStrings, (unsigned long long)distinctContents);
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,356 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include "SnapshotHeap.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Older kernels and C libraries only take the address as a hint; MapAt checks where the
+// mapping ended up either way.
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0
+#endif
+#endif
+
+template <typename T>
+static bool ReadTable(FILE *file, uint64_t offset, uint32_t count, std::vector<T> *table)
+{
+    table->resize(count);
+    return count == 0 || (fseek(file, (long)offset, SEEK_SET) == 0 && fread(table->data(), sizeof(T), count, file) == count);
+}
+
+#ifdef _WIN32
+static void *MapAt(HANDLE mapping, uint64_t address, uint64_t length, uint64_t fileOffset)
+{
+    return MapViewOfFileEx(mapping, FILE_MAP_COPY, (DWORD)(fileOffset >> 32), (DWORD)fileOffset, (SIZE_T)length, (void *)address);
+}
+
+static void Unmap(void *address, uint64_t length)
+{
+    UnmapViewOfFile(address);
+}
+
+static void *AllocateAt(uint64_t address, uint64_t length)
+{
+    return VirtualAlloc((void *)address, (SIZE_T)length, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+}
+
+static void Free(void *address, uint64_t length)
+{
+    VirtualFree(address, 0, MEM_RELEASE);
+}
+#else
+static void *MapAt(int fileDescriptor, uint64_t address, uint64_t length, uint64_t fileOffset)
+{
+    int flags = fileDescriptor == -1 ? MAP_PRIVATE | MAP_ANONYMOUS : MAP_PRIVATE;
+    void *mapped = mmap((void *)address, (size_t)length, PROT_READ | PROT_WRITE, flags | MAP_FIXED_NOREPLACE, fileDescriptor, (off_t)fileOffset);
+    if (mapped == MAP_FAILED)
+    {
+        return nullptr;
+    }
+
+    if (mapped != (void *)address)
+    {
+        munmap(mapped, (size_t)length);
+        return nullptr;
+    }
+
+    return mapped;
+}
+
+static void Unmap(void *address, uint64_t length)
+{
+    munmap(address, (size_t)length);
+}
+
+static void *AllocateAt(uint64_t address, uint64_t length)
+{
+    return MapAt(-1, address, length, 0);
+}
+
+static void Free(void *address, uint64_t length)
+{
+    munmap(address, (size_t)length);
+}
+#endif
+
+SnapshotHeap::SnapshotHeap() : header()
+{
+#ifdef _WIN32
+    this->fileHandle = INVALID_HANDLE_VALUE;
+    this->mappingHandle = nullptr;
+#else
+    this->fileDescriptor = -1;
+#endif
+}
+
+SnapshotHeap::~SnapshotHeap()
+{
+    this->Close();
+}
+
+HRESULT SnapshotHeap::Open(const char *path)
+{
+    this->Close();
+
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr)
+    {
+        return E_FAIL;
+    }
+
+    HRESULT hr = this->ReadMetadata(file);
+    fclose(file);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+#ifdef _WIN32
+    this->fileHandle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (this->fileHandle == INVALID_HANDLE_VALUE)
+    {
+        return E_FAIL;
+    }
+
+    this->mappingHandle = CreateFileMappingA(this->fileHandle, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+    if (this->mappingHandle == nullptr)
+    {
+        this->Close();
+        return E_FAIL;
+    }
+#else
+    this->fileDescriptor = open(path, O_RDONLY);
+    if (this->fileDescriptor == -1)
+    {
+        return E_FAIL;
+    }
+#endif
+
+    hr = this->AllocateMethodTables();
+    if (SUCCEEDED(hr))
+    {
+        hr = this->MapExtents();
+    }
+
+    if (FAILED(hr))
+    {
+        this->Close();
+        return hr;
+    }
+
+    for (auto &range : this->snapshotRanges)
+    {
+        COR_PRF_GC_GENERATION_RANGE converted;
+        converted.generation = (COR_PRF_GC_GENERATION)range.Generation;
+        converted.rangeStart = (ObjectID)range.Start;
+        converted.rangeLength = (UINT_PTR)range.Length;
+        converted.rangeLengthReserved = (UINT_PTR)range.Length;
+        this->ranges.push_back(converted);
+    }
+
+    return S_OK;
+}
+
+HRESULT SnapshotHeap::ReadMetadata(FILE *file)
+{
+    if (fread(&this->header, sizeof(this->header), 1, file) != 1 ||
+        memcmp(this->header.Magic, HeapSnapshotMagic, sizeof(HeapSnapshotMagic)) != 0 ||
+        this->header.Version != HeapSnapshotVersion ||
+        this->header.HeaderSize != sizeof(HeapSnapshotHeader) ||
+        this->header.PointerSize != sizeof(SIZE_T))
+    {
+        return E_INVALIDARG;
+    }
+
+    if (!ReadTable(file, this->header.RangesOffset, this->header.RangeCount, &this->snapshotRanges) ||
+        !ReadTable(file, this->header.ExtentsOffset, this->header.ExtentCount, &this->extents) ||
+        !ReadTable(file, this->header.MethodTablesOffset, this->header.MethodTableCount, &this->methodTables) ||
+        !ReadTable(file, this->header.ObjectSizesOffset, this->header.ObjectSizeCount, &this->objectSizes))
+    {
+        return E_INVALIDARG;
+    }
+
+    // the MethodTable bytes run from the end of the object sizes up to the padding
+    // before the extents
+    uint64_t start = this->header.ObjectSizesOffset + this->header.ObjectSizeCount * sizeof(HeapSnapshotObjectSize);
+    uint64_t end = start;
+    for (auto &methodTable : this->methodTables)
+    {
+        if (methodTable.FileOffset < start)
+        {
+            return E_INVALIDARG;
+        }
+
+        end = std::max(end, methodTable.FileOffset + methodTable.Length);
+    }
+
+    if (end > this->header.ExtentDataOffset || !ReadTable(file, start, (uint32_t)(end - start), &this->methodTableBytes))
+    {
+        return E_INVALIDARG;
+    }
+
+    for (auto &methodTable : this->methodTables)
+    {
+        methodTable.FileOffset -= start;
+    }
+
+    return S_OK;
+}
+
+HRESULT SnapshotHeap::AllocateMethodTables()
+{
+    std::set<uint64_t> allocated;
+
+    for (auto &methodTable : this->methodTables)
+    {
+        uint64_t first = methodTable.Address & ~(HeapSnapshotAlignment - 1);
+        for (uint64_t block = first; block < methodTable.Address + methodTable.Length; block += HeapSnapshotAlignment)
+        {
+            if (!allocated.insert(block).second)
+            {
+                continue;
+            }
+
+            void *memory = AllocateAt(block, HeapSnapshotAlignment);
+            if (memory == nullptr)
+            {
+                return E_OUTOFMEMORY;
+            }
+
+            this->methodTableBlocks.push_back(memory);
+        }
+
+        memcpy((void *)methodTable.Address, this->methodTableBytes.data() + methodTable.FileOffset, (size_t)methodTable.Length);
+    }
+
+    return S_OK;
+}
+
+void SnapshotHeap::FreeMethodTables()
+{
+    for (void *block : this->methodTableBlocks)
+    {
+        Free(block, HeapSnapshotAlignment);
+    }
+
+    this->methodTableBlocks.clear();
+}
+
+HRESULT SnapshotHeap::MapExtents()
+{
+    for (auto &extent : this->extents)
+    {
+#ifdef _WIN32
+        void *mapped = MapAt(this->mappingHandle, extent.Address, extent.Length, extent.FileOffset);
+#else
+        void *mapped = MapAt(this->fileDescriptor, extent.Address, extent.Length, extent.FileOffset);
+#endif
+        if (mapped == nullptr)
+        {
+            this->UnmapExtents();
+            return E_OUTOFMEMORY;
+        }
+
+        this->mappedExtents.push_back(mapped);
+    }
+
+    return S_OK;
+}
+
+void SnapshotHeap::UnmapExtents()
+{
+    for (SIZE_T i = 0; i < this->mappedExtents.size(); ++i)
+    {
+        Unmap(this->mappedExtents[i], this->extents[i].Length);
+    }
+
+    this->mappedExtents.clear();
+}
+
+HRESULT SnapshotHeap::Reset()
+{
+    this->UnmapExtents();
+    return this->MapExtents();
+}
+
+void SnapshotHeap::Close()
+{
+    this->UnmapExtents();
+    this->FreeMethodTables();
+
+#ifdef _WIN32
+    if (this->mappingHandle != nullptr)
+    {
+        CloseHandle(this->mappingHandle);
+        this->mappingHandle = nullptr;
+    }
+
+    if (this->fileHandle != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(this->fileHandle);
+        this->fileHandle = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (this->fileDescriptor != -1)
+    {
+        close(this->fileDescriptor);
+        this->fileDescriptor = -1;
+    }
+#endif
+
+    this->snapshotRanges.clear();
+    this->extents.clear();
+    this->methodTables.clear();
+    this->objectSizes.clear();
+    this->methodTableBytes.clear();
+    this->ranges.clear();
+}
+
+HRESULT SnapshotHeap::GetObjectSize(ObjectID object, SIZE_T *size)
+{
+    auto found = std::lower_bound(this->objectSizes.begin(), this->objectSizes.end(), (uint64_t)object, [](const HeapSnapshotObjectSize &entry, uint64_t object) { return entry.Object < object; });
+    if (found == this->objectSizes.end() || found->Object != (uint64_t)object)
+    {
+        return E_FAIL;
+    }
+
+    *size = (SIZE_T)found->Size;
+    return S_OK;
+}
+
+HRESULT SnapshotHeap::IsFrozenObject(ObjectID object, BOOL *frozen)
+{
+    *frozen = FALSE;
+    for (auto &range : this->snapshotRanges)
+    {
+        if ((uint64_t)object >= range.Start && (uint64_t)object < range.Start + range.Length)
+        {
+            *frozen = (range.Flags & HeapSnapshotRangeFrozen) != 0;
+            break;
+        }
+    }
+
+    return S_OK;
+}
+
+uint64_t SnapshotHeap::GetBytes(int generation) const
+{
+    uint64_t bytes = 0;
+    for (auto &range : this->snapshotRanges)
+    {
+        if ((int)range.Generation >= generation)
+        {
+            bytes += range.Length;
+        }
+    }
+
+    return bytes;
+}
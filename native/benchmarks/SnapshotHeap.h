@@ -0,0 +1,90 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "cor.h"
+#include "corprof.h"
+#include "HeapSnapshot.h"
+#include "ManagedHeapInfo.h"
+
+// A heap captured by HeapSnapshotWriter, put back at the addresses it was captured
+// from so that the engine walks it as it walked the live one.
+//
+// The extents are mapped copy-on-write straight from the file, so opening a snapshot
+// reads none of the heap and a pass only copies the pages it rewrites. The MethodTables
+// are copied into memory allocated at their own addresses. Opening fails if any of
+// those addresses is already in use in this process; running the tool again usually
+// gets a different layout.
+class SnapshotHeap : public ManagedHeapInfo
+{
+  public:
+    SnapshotHeap();
+    ~SnapshotHeap();
+
+    HRESULT Open(const char *path);
+    void Close();
+
+    // Maps the extents again, dropping every page a pass wrote to.
+    HRESULT Reset();
+
+    // Sizes come from the snapshot, for the objects the runtime was asked about when
+    // it was captured.
+    HRESULT GetObjectSize(ObjectID object, SIZE_T *size) override;
+    HRESULT IsFrozenObject(ObjectID object, BOOL *frozen) override;
+
+    const std::vector<COR_PRF_GC_GENERATION_RANGE> &GetRanges() const
+    {
+        return this->ranges;
+    }
+
+    SIZE_T GetStringMethodTable() const
+    {
+        return (SIZE_T)this->header.StringMethodTable;
+    }
+
+    ULONG GetStringLengthOffset() const
+    {
+        return this->header.StringLengthOffset;
+    }
+
+    ULONG GetStringBufferOffset() const
+    {
+        return this->header.StringBufferOffset;
+    }
+
+    SIZE_T GetMethodTableCount() const
+    {
+        return this->header.MethodTableCount;
+    }
+
+    // Bytes of objects in the ranges of generation or older
+    uint64_t GetBytes(int generation) const;
+
+  private:
+    HRESULT ReadMetadata(FILE *file);
+    HRESULT MapExtents();
+    void UnmapExtents();
+    HRESULT AllocateMethodTables();
+    void FreeMethodTables();
+
+    HeapSnapshotHeader header;
+    std::vector<HeapSnapshotRange> snapshotRanges;
+    std::vector<HeapSnapshotExtent> extents;
+    std::vector<HeapSnapshotMethodTable> methodTables;
+    std::vector<HeapSnapshotObjectSize> objectSizes;
+    std::vector<BYTE> methodTableBytes;
+    std::vector<COR_PRF_GC_GENERATION_RANGE> ranges;
+
+    std::vector<void *> mappedExtents;
+    std::vector<void *> methodTableBlocks;
+
+#ifdef _WIN32
+    HANDLE fileHandle;
+    HANDLE mappingHandle;
+#else
+    int fileDescriptor;
+#endif
+};
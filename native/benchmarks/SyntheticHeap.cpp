@@ -0,0 +1,457 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <new>
+#include <random>
+#include <unordered_set>
+#include "SyntheticHeap.h"
+#include "MethodTableCache.h"
+#include "StringHash.h"
+
+enum class ObjectKind : uint8_t
+{
+    String,
+    // three reference fields and a long
+    Class,
+    // two longs
+    ValueClass,
+    ObjectArray,
+    // elements of a struct holding a reference and a long
+    StructArray,
+};
+
+// Base sizes include the object header, which precedes the MethodTable pointer
+static const DWORD StringBaseSize = sizeof(SIZE_T) * 2 + sizeof(ULONG) + sizeof(WCHAR);
+static const DWORD ClassBaseSize = sizeof(SIZE_T) * 6;
+static const DWORD ValueClassBaseSize = sizeof(SIZE_T) * 4;
+static const DWORD ArrayBaseSize = sizeof(SIZE_T) * 3;
+static const int ClassReferences = 3;
+static const SIZE_T MaxObjectArrayLength = 16;
+static const SIZE_T MaxStructArrayLength = 8;
+
+// Objects and shared strings are picked from the most recent ones, as a program
+// mostly links what it allocated around the same time
+static const SIZE_T RecentWindow = 4096;
+
+struct PlannedObject
+{
+    ObjectKind Kind;
+    uint8_t Space;
+    uint32_t Components;
+    // strings: index of the content; others: index of the first reference slot
+    uint32_t Index;
+    SIZE_T Offset;
+};
+
+static const uint32_t NullTarget = 0xFFFFFFFF;
+
+static SIZE_T AlignObjectSize(SIZE_T size)
+{
+    return (size + sizeof(SIZE_T) - 1) & ~(sizeof(SIZE_T) - 1);
+}
+
+static SIZE_T GetObjectSizeFromMethodTable(ObjectID object)
+{
+    DWORD *methodTable = *(DWORD **)object;
+    DWORD flags = methodTable[0];
+    SIZE_T size = methodTable[1];
+
+    if ((flags & MethodTableFlags_HasComponentSize) != 0)
+    {
+        size += (SIZE_T)(flags & MethodTableFlags_ComponentSizeMask) * *(DWORD *)((PBYTE)object + sizeof(SIZE_T));
+    }
+
+    return AlignObjectSize(size);
+}
+
+static SIZE_T GetPlannedSize(const PlannedObject &object)
+{
+    switch (object.Kind)
+    {
+    case ObjectKind::String:
+        return AlignObjectSize(StringBaseSize + (SIZE_T)object.Components * sizeof(WCHAR));
+    case ObjectKind::Class:
+        return ClassBaseSize;
+    case ObjectKind::ValueClass:
+        return ValueClassBaseSize;
+    case ObjectKind::ObjectArray:
+        return ArrayBaseSize + (SIZE_T)object.Components * sizeof(SIZE_T);
+    default:
+        return ArrayBaseSize + (SIZE_T)object.Components * sizeof(SIZE_T) * 2;
+    }
+}
+
+static SIZE_T GetReferenceCount(const PlannedObject &object)
+{
+    switch (object.Kind)
+    {
+    case ObjectKind::Class:
+        return ClassReferences;
+    case ObjectKind::ObjectArray:
+    case ObjectKind::StructArray:
+        return object.Components;
+    default:
+        return 0;
+    }
+}
+
+static SIZE_T GetReferenceOffset(const PlannedObject &object, SIZE_T slot)
+{
+    switch (object.Kind)
+    {
+    case ObjectKind::Class:
+        return sizeof(SIZE_T) * (1 + slot);
+    case ObjectKind::ObjectArray:
+        return sizeof(SIZE_T) * (2 + slot);
+    default:
+        return sizeof(SIZE_T) * (2 + slot * 2);
+    }
+}
+
+SyntheticHeap::SyntheticHeap() : stringMethodTable(0), classMethodTable(0), valueClassMethodTable(0), objectArrayMethodTable(0), structArrayMethodTable(0), objectCount(0), stringCount(0)
+{
+    this->spaces[0].Bytes = 0;
+    this->spaces[1].Bytes = 0;
+}
+
+// gcDesc holds the pointer-sized slots that precede the MethodTable, the series count
+// last.
+SIZE_T SyntheticHeap::AddMethodTable(DWORD flags, DWORD baseSize, const std::vector<SIZE_T> &gcDesc)
+{
+    std::unique_ptr<SIZE_T[]> memory(new SIZE_T[gcDesc.size() + 2]());
+    std::copy(gcDesc.begin(), gcDesc.end(), memory.get());
+
+    DWORD *methodTable = (DWORD *)(memory.get() + gcDesc.size());
+    methodTable[0] = flags;
+    methodTable[1] = baseSize;
+
+    this->methodTableMemory.push_back(std::move(memory));
+    return (SIZE_T)methodTable;
+}
+
+bool SyntheticHeap::Build(const SyntheticHeapSettings &settings)
+{
+    if (settings.MinimumLength == 0 || settings.MaximumLength < settings.MinimumLength)
+    {
+        return false;
+    }
+
+    this->methodTableMemory.clear();
+
+    // a positive series covers [offset, offset + size + object size), so its size is
+    // the bytes of references less the base size; a repeating series packs pointer
+    // count and skip into one slot
+    this->stringMethodTable = this->AddMethodTable(MethodTableFlags_HasComponentSize | sizeof(WCHAR), StringBaseSize, {});
+    this->classMethodTable = this->AddMethodTable(MethodTableFlags_ContainsPointers, ClassBaseSize, {(SIZE_T)(intptr_t)(ClassReferences * sizeof(SIZE_T) - ClassBaseSize), sizeof(SIZE_T), 1});
+    this->valueClassMethodTable = this->AddMethodTable(0, ValueClassBaseSize, {});
+    this->objectArrayMethodTable = this->AddMethodTable(MethodTableFlags_HasComponentSize | MethodTableFlags_ContainsPointers | sizeof(SIZE_T), ArrayBaseSize, {(SIZE_T)(intptr_t)(0 - (intptr_t)ArrayBaseSize), sizeof(SIZE_T) * 2, 1});
+    this->structArrayMethodTable = this->AddMethodTable(MethodTableFlags_HasComponentSize | MethodTableFlags_ContainsPointers | (sizeof(SIZE_T) * 2), ArrayBaseSize, {1 | ((SIZE_T)sizeof(SIZE_T) << 32), sizeof(SIZE_T) * 2, (SIZE_T)(intptr_t)-1});
+
+    std::mt19937_64 random(settings.Seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    std::vector<PlannedObject> objects;
+    std::vector<uint32_t> targets;
+    std::vector<uint32_t> holders;
+    std::vector<uint32_t> strings[2];
+    std::vector<WCHAR> characters;
+    std::vector<SIZE_T> contentStarts;
+    std::vector<ULONG> contentLengths;
+
+    double logMinimum = std::log((double)settings.MinimumLength);
+    double logMaximum = std::log((double)settings.MaximumLength + 1);
+
+    auto newContent = [&]() {
+        ULONG length = (ULONG)std::exp(logMinimum + uniform(random) * (logMaximum - logMinimum));
+        length = std::min(std::max(length, settings.MinimumLength), settings.MaximumLength);
+
+        contentStarts.push_back(characters.size());
+        contentLengths.push_back(length);
+        for (ULONG c = 0; c < length; ++c)
+        {
+            characters.push_back((WCHAR)('a' + random() % 26));
+        }
+
+        // the index in the tail keeps contents distinct when there is room for it
+        WCHAR *tail = characters.data() + characters.size();
+        for (SIZE_T n = contentLengths.size(), c = 0; n != 0 && c < length; n /= 26, ++c)
+        {
+            *--tail = (WCHAR)('A' + n % 26);
+        }
+
+        return (uint32_t)(contentLengths.size() - 1);
+    };
+
+    auto pickRecent = [&](const std::vector<uint32_t> &from) {
+        SIZE_T window = std::min(from.size(), RecentWindow);
+        return from[from.size() - 1 - random() % window];
+    };
+
+    try
+    {
+        for (SIZE_T i = 0; i < settings.Objects; ++i)
+        {
+            PlannedObject holder = {};
+            holder.Space = uniform(random) < settings.YoungRatio ? 1 : 0;
+
+            uint64_t kind = random() % 10;
+            if (kind < 5)
+            {
+                holder.Kind = ObjectKind::Class;
+            }
+            else if (kind < 7)
+            {
+                holder.Kind = ObjectKind::ValueClass;
+            }
+            else if (kind < 9)
+            {
+                holder.Kind = ObjectKind::ObjectArray;
+                holder.Components = (uint32_t)(1 + random() % MaxObjectArrayLength);
+            }
+            else
+            {
+                holder.Kind = ObjectKind::StructArray;
+                holder.Components = (uint32_t)(1 + random() % MaxStructArrayLength);
+            }
+
+            holder.Index = (uint32_t)targets.size();
+            uint32_t holderIndex = (uint32_t)objects.size();
+            objects.push_back(holder);
+
+            SIZE_T references = GetReferenceCount(holder);
+            for (SIZE_T slot = 0; slot < references; ++slot)
+            {
+                uint32_t target = NullTarget;
+                double u = uniform(random);
+
+                if (u < 0.1)
+                {
+                    // left null
+                }
+                else if (u >= 0.1 + 0.9 * settings.StringReferenceRatio)
+                {
+                    if (!holders.empty())
+                    {
+                        target = pickRecent(holders);
+                    }
+                }
+                else if (!strings[0].empty() && uniform(random) < settings.SharedReferenceRatio)
+                {
+                    target = pickRecent(strings[0]);
+                }
+                else
+                {
+                    // new strings follow the object that first references them
+                    PlannedObject string = {};
+                    string.Kind = ObjectKind::String;
+                    string.Space = holder.Space;
+
+                    if (!contentLengths.empty() && uniform(random) < settings.DuplicateRatio)
+                    {
+                        // squaring a uniform variate favors the low indices
+                        double v = uniform(random);
+                        string.Index = (uint32_t)((SIZE_T)(v * v * contentLengths.size()) % contentLengths.size());
+                    }
+                    else
+                    {
+                        string.Index = newContent();
+                    }
+
+                    string.Components = contentLengths[string.Index];
+                    target = (uint32_t)objects.size();
+                    strings[string.Space].push_back(target);
+                    objects.push_back(string);
+                }
+
+                targets.push_back(target);
+            }
+
+            holders.push_back(holderIndex);
+        }
+
+        SIZE_T used[2] = {0, 0};
+        for (PlannedObject &object : objects)
+        {
+            object.Offset = used[object.Space];
+            used[object.Space] += GetPlannedSize(object);
+        }
+
+        for (int s = 0; s < 2; ++s)
+        {
+            // one header before the first object and one after the last
+            SIZE_T words = used[s] / sizeof(SIZE_T) + 2;
+            this->spaces[s].Words.reset(new SIZE_T[words]());
+            this->spaces[s].Pristine.reset(new SIZE_T[words]);
+            this->spaces[s].Bytes = used[s];
+        }
+    }
+    catch (const std::bad_alloc &)
+    {
+        return false;
+    }
+
+    this->objectCount = holders.size();
+    this->stringCount = strings[0].size() + strings[1].size();
+
+    auto addressOf = [&](const PlannedObject &object) {
+        return (PBYTE)this->spaces[object.Space].Start() + object.Offset;
+    };
+
+    for (const PlannedObject &object : objects)
+    {
+        PBYTE address = addressOf(object);
+
+        switch (object.Kind)
+        {
+        case ObjectKind::String:
+            *(SIZE_T *)address = this->stringMethodTable;
+            *(ULONG *)(address + StringLengthOffset) = object.Components;
+            memcpy(address + StringBufferOffset, characters.data() + contentStarts[object.Index], object.Components * sizeof(WCHAR));
+            continue;
+        case ObjectKind::Class:
+            *(SIZE_T *)address = this->classMethodTable;
+            break;
+        case ObjectKind::ValueClass:
+            *(SIZE_T *)address = this->valueClassMethodTable;
+            continue;
+        case ObjectKind::ObjectArray:
+            *(SIZE_T *)address = this->objectArrayMethodTable;
+            *(DWORD *)(address + sizeof(SIZE_T)) = object.Components;
+            break;
+        case ObjectKind::StructArray:
+            *(SIZE_T *)address = this->structArrayMethodTable;
+            *(DWORD *)(address + sizeof(SIZE_T)) = object.Components;
+            break;
+        }
+
+        SIZE_T references = GetReferenceCount(object);
+        for (SIZE_T slot = 0; slot < references; ++slot)
+        {
+            uint32_t target = targets[object.Index + slot];
+            *(ObjectID *)(address + GetReferenceOffset(object, slot)) = target == NullTarget ? 0 : (ObjectID)addressOf(objects[target]);
+        }
+    }
+
+    for (int s = 0; s < 2; ++s)
+    {
+        memcpy(this->spaces[s].Pristine.get(), this->spaces[s].Words.get(), this->spaces[s].Bytes + sizeof(SIZE_T) * 2);
+    }
+
+    return true;
+}
+
+void SyntheticHeap::Reset()
+{
+    for (int s = 0; s < 2; ++s)
+    {
+        if (this->spaces[s].Words != nullptr)
+        {
+            memcpy(this->spaces[s].Words.get(), this->spaces[s].Pristine.get(), this->spaces[s].Bytes + sizeof(SIZE_T) * 2);
+        }
+    }
+}
+
+HRESULT SyntheticHeap::GetGenerationBounds(ULONG cObjectRanges, ULONG *pcObjectRanges, COR_PRF_GC_GENERATION_RANGE ranges[])
+{
+    static const COR_PRF_GC_GENERATION Generations[2] = {COR_PRF_GC_GEN_2, COR_PRF_GC_GEN_0};
+
+    *pcObjectRanges = 2;
+    for (ULONG s = 0; s < 2 && s < cObjectRanges; ++s)
+    {
+        ranges[s].generation = Generations[s];
+        ranges[s].rangeStart = this->spaces[s].Start();
+        ranges[s].rangeLength = this->spaces[s].Bytes;
+        ranges[s].rangeLengthReserved = this->spaces[s].Bytes;
+    }
+
+    return S_OK;
+}
+
+HRESULT SyntheticHeap::GetObjectGeneration(ObjectID objectId, COR_PRF_GC_GENERATION_RANGE *range)
+{
+    ULONG count;
+    COR_PRF_GC_GENERATION_RANGE ranges[2];
+    this->GetGenerationBounds(2, &count, ranges);
+
+    for (const COR_PRF_GC_GENERATION_RANGE &candidate : ranges)
+    {
+        if (objectId >= candidate.rangeStart && objectId < candidate.rangeStart + candidate.rangeLength)
+        {
+            *range = candidate;
+            return S_OK;
+        }
+    }
+
+    return E_FAIL;
+}
+
+HRESULT SyntheticHeap::GetObjectSize2(ObjectID objectId, SIZE_T *pcSize)
+{
+    *pcSize = GetObjectSizeFromMethodTable(objectId);
+    return S_OK;
+}
+
+void SyntheticHeap::CountReferencedStrings(SIZE_T *objects, SIZE_T *contents) const
+{
+    const Space &space = this->spaces[0];
+    ObjectID start = space.Start();
+    ObjectID end = start + space.Bytes;
+
+    std::unordered_set<ObjectID> referenced;
+    std::unordered_set<uint64_t> distinct;
+
+    this->ForEachReference([&](ObjectID, ObjectID *slot) {
+        ObjectID target = *slot;
+        if (target < start || target >= end || *(SIZE_T *)target != this->stringMethodTable)
+        {
+            return;
+        }
+
+        if (referenced.insert(target).second)
+        {
+            ULONG length = *(ULONG *)(target + StringLengthOffset);
+            distinct.insert(StringHash::Hash((WCHAR *)(target + StringBufferOffset), length) ^ length);
+        }
+    });
+
+    *objects = referenced.size();
+    *contents = distinct.size();
+}
+
+void SyntheticHeap::ForEachReference(const std::function<void(ObjectID object, ObjectID *slot)> &visit) const
+{
+    const Space &space = this->spaces[0];
+    ObjectID start = space.Start();
+    ObjectID end = start + space.Bytes;
+
+    for (ObjectID object = start; object < end;)
+    {
+        SIZE_T methodTable = *(SIZE_T *)object;
+        PlannedObject layout = {};
+
+        if (methodTable == this->classMethodTable)
+        {
+            layout.Kind = ObjectKind::Class;
+        }
+        else if (methodTable == this->objectArrayMethodTable || methodTable == this->structArrayMethodTable)
+        {
+            layout.Kind = methodTable == this->objectArrayMethodTable ? ObjectKind::ObjectArray : ObjectKind::StructArray;
+            layout.Components = *(DWORD *)(object + sizeof(SIZE_T));
+        }
+        else
+        {
+            layout.Kind = ObjectKind::ValueClass;
+        }
+
+        SIZE_T references = GetReferenceCount(layout);
+        for (SIZE_T slot = 0; slot < references; ++slot)
+        {
+            visit(object, (ObjectID *)(object + GetReferenceOffset(layout, slot)));
+        }
+
+        object += GetObjectSizeFromMethodTable(object);
+    }
+}
@@ -0,0 +1,129 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "cor.h"
+#include "corprof.h"
+#include "ManagedHeapInfo.h"
+
+struct SyntheticHeapSettings
+{
+    SyntheticHeapSettings() : Objects(1000000), StringReferenceRatio(0.75), DuplicateRatio(0.5), SharedReferenceRatio(0.2), MinimumLength(4), MaximumLength(64), YoungRatio(0.05), Seed(42)
+    {
+    }
+
+    // objects other than strings; the strings they reference come on top
+    SIZE_T Objects;
+    // share of non-null reference slots that point at a string rather than an object
+    double StringReferenceRatio;
+    // share of new string objects that copy the content of an earlier one
+    double DuplicateRatio;
+    // share of string references that point at an earlier string object instead of
+    // a new one
+    double SharedReferenceRatio;
+    // lengths are drawn log-uniformly from [MinimumLength, MaximumLength]
+    ULONG MinimumLength;
+    ULONG MaximumLength;
+    // share of objects, with the strings they allocate, placed in gen0
+    double YoungRatio;
+    uint64_t Seed;
+};
+
+// A managed heap laid out as the runtime lays it out, for running the engine without
+// one. Objects sit back to back behind an object header, with MethodTables that carry
+// real flags, base sizes and GCDesc series, so the engine decodes them exactly as it
+// does in a process. The mix of types is fixed: classes with and without reference
+// fields, object arrays, and arrays of a struct holding a reference.
+//
+// The queries mirror the ICorProfilerInfo10 methods of the same names. Generation 2
+// is one range, and generation 0 another.
+class SyntheticHeap : public ManagedHeapInfo
+{
+  public:
+    static const ULONG StringLengthOffset = sizeof(SIZE_T);
+    static const ULONG StringBufferOffset = sizeof(SIZE_T) + sizeof(ULONG);
+
+    SyntheticHeap();
+
+    bool Build(const SyntheticHeapSettings &settings);
+
+    // Puts back every reference a pass rewrote, so that each pass sees the same heap.
+    void Reset();
+
+    HRESULT GetGenerationBounds(ULONG cObjectRanges, ULONG *pcObjectRanges, COR_PRF_GC_GENERATION_RANGE ranges[]);
+    HRESULT GetObjectGeneration(ObjectID objectId, COR_PRF_GC_GENERATION_RANGE *range);
+    HRESULT GetObjectSize2(ObjectID objectId, SIZE_T *pcSize);
+
+    HRESULT GetObjectSize(ObjectID object, SIZE_T *size) override
+    {
+        return this->GetObjectSize2(object, size);
+    }
+
+    HRESULT IsFrozenObject(ObjectID object, BOOL *frozen) override
+    {
+        *frozen = FALSE;
+        return S_OK;
+    }
+
+    SIZE_T GetStringMethodTable() const
+    {
+        return this->stringMethodTable;
+    }
+
+    SIZE_T GetObjectCount() const
+    {
+        return this->objectCount;
+    }
+
+    SIZE_T GetStringCount() const
+    {
+        return this->stringCount;
+    }
+
+    SIZE_T GetBytes() const
+    {
+        return this->spaces[0].Bytes + this->spaces[1].Bytes;
+    }
+
+    // Counts the gen2 string objects referenced from gen2 objects, and how many
+    // distinct contents they hold. After a full pass the two are equal.
+    void CountReferencedStrings(SIZE_T *objects, SIZE_T *contents) const;
+
+    // Calls visit(object, slot) for every reference slot of every gen2 object, null or
+    // not, in address order.
+    void ForEachReference(const std::function<void(ObjectID object, ObjectID *slot)> &visit) const;
+
+  private:
+    // One generation: the objects start one header into the buffer, and the pristine
+    // copy is what Reset restores.
+    struct Space
+    {
+        std::unique_ptr<SIZE_T[]> Words;
+        std::unique_ptr<SIZE_T[]> Pristine;
+        SIZE_T Bytes;
+
+        ObjectID Start() const
+        {
+            return (ObjectID)(this->Words.get() + 1);
+        }
+    };
+
+    SIZE_T AddMethodTable(DWORD flags, DWORD baseSize, const std::vector<SIZE_T> &gcDesc);
+
+    std::vector<std::unique_ptr<SIZE_T[]>> methodTableMemory;
+    SIZE_T stringMethodTable;
+    SIZE_T classMethodTable;
+    SIZE_T valueClassMethodTable;
+    SIZE_T objectArrayMethodTable;
+    SIZE_T structArrayMethodTable;
+
+    // 0 is gen2, 1 is gen0
+    Space spaces[2];
+    SIZE_T objectCount;
+    SIZE_T stringCount;
+};
@@ -0,0 +1,102 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Checks which collections DedupTriggerPolicy admits in each mode, feeding it the
+// sequence of callbacks the profiler makes: the decision taken when a collection
+// starts, whether it blocked once it finishes, and the gen2 size before a pass.
+// Exits with 1 if any check fails.
+//
+// usage: TriggerPolicyCheck
+
+#include <cstdio>
+#include "DedupTriggerPolicy.h"
+
+static int failures = 0;
+
+static void Check(bool condition, const char *what)
+{
+    if (!condition)
+    {
+        printf("error: %s\n", what);
+        ++failures;
+    }
+}
+
+static DedupTriggerDecision Collect(DedupTriggerPolicy &policy, int generation, bool blocking, COR_PRF_GC_REASON reason = COR_PRF_GC_OTHER)
+{
+    BOOL generationCollected[COR_PRF_GC_LARGE_OBJECT_HEAP + 1] = {};
+    for (int i = 0; i <= generation; ++i)
+    {
+        generationCollected[i] = TRUE;
+    }
+
+    if (generation == COR_PRF_GC_GEN_2)
+    {
+        generationCollected[COR_PRF_GC_LARGE_OBJECT_HEAP] = TRUE;
+    }
+
+    DedupTriggerDecision started = policy.OnGarbageCollectionStarted(COR_PRF_GC_LARGE_OBJECT_HEAP + 1, generationCollected, reason);
+    DedupTriggerDecision decision = policy.OnGarbageCollectionFinished(started, blocking);
+    policy.Record(decision);
+    return decision;
+}
+
+static DedupTriggerPolicy PolicyFor(DedupTriggerMode mode, ULONG everyNthGen2 = 1, SIZE_T gen2GrowthBytes = 0)
+{
+    DedupTriggerSettings settings;
+    settings.Mode = mode;
+    settings.EveryNthGen2 = everyNthGen2;
+    settings.Gen2GrowthBytes = gen2GrowthBytes;
+
+    DedupTriggerPolicy policy;
+    policy.Configure(settings);
+    return policy;
+}
+
+int main()
+{
+    {
+        DedupTriggerPolicy policy = PolicyFor(DedupTriggerMode::FullBlockingGen2);
+        Check(Collect(policy, 0, true) == DedupTriggerDecision::SkippedNotGen2, "a gen0 collection is skipped");
+        Check(Collect(policy, 1, false) == DedupTriggerDecision::SkippedNotGen2, "a non-blocking gen1 collection is skipped as not gen2");
+        Check(Collect(policy, 2, false) == DedupTriggerDecision::SkippedNotBlocking, "a background gen2 collection is skipped");
+        Check(Collect(policy, 2, true) == DedupTriggerDecision::Processed, "a blocking gen2 collection is processed");
+        Check(policy.GetDecisionCount(DedupTriggerDecision::SkippedNotGen2) == 2, "each collection is recorded once");
+        Check(policy.GetLastDecision() == DedupTriggerDecision::Processed, "the last decision is kept");
+    }
+
+    {
+        // background collections in between do not count towards N
+        DedupTriggerPolicy policy = PolicyFor(DedupTriggerMode::EveryNthGen2, 2);
+        Check(Collect(policy, 2, true) == DedupTriggerDecision::SkippedNotNthGen2, "the first blocking gen2 collection is skipped");
+        Check(Collect(policy, 2, false) == DedupTriggerDecision::SkippedNotBlocking, "a background gen2 collection is skipped as not blocking");
+        Check(Collect(policy, 2, false) == DedupTriggerDecision::SkippedNotBlocking, "another background gen2 collection is skipped as not blocking");
+        Check(Collect(policy, 2, true) == DedupTriggerDecision::Processed, "the second blocking gen2 collection is processed");
+        Check(Collect(policy, 1, true) == DedupTriggerDecision::SkippedNotGen2, "a gen1 collection does not count");
+        Check(Collect(policy, 2, true) == DedupTriggerDecision::SkippedNotNthGen2, "the third blocking gen2 collection is skipped");
+    }
+
+    {
+        DedupTriggerPolicy policy = PolicyFor(DedupTriggerMode::InducedOnly);
+        Check(Collect(policy, 2, true) == DedupTriggerDecision::SkippedNotInduced, "a gen2 collection that was not induced is skipped");
+        Check(Collect(policy, 2, false) == DedupTriggerDecision::SkippedNotInduced, "a background collection that was not induced keeps that reason");
+        Check(Collect(policy, 2, false, COR_PRF_GC_INDUCED) == DedupTriggerDecision::SkippedNotBlocking, "an induced background collection is skipped");
+        Check(Collect(policy, 2, true, COR_PRF_GC_INDUCED) == DedupTriggerDecision::Processed, "an induced blocking collection is processed");
+    }
+
+    {
+        DedupTriggerPolicy policy = PolicyFor(DedupTriggerMode::Gen2Growth, 1, 1000);
+        Check(Collect(policy, 2, true) == DedupTriggerDecision::Processed && policy.OnGen2Size(5000) == DedupTriggerDecision::Processed, "the first pass runs whatever the size");
+        Check(Collect(policy, 2, true) == DedupTriggerDecision::Processed && policy.OnGen2Size(5500) == DedupTriggerDecision::SkippedInsufficientGrowth, "a small growth is skipped");
+        Check(policy.OnGen2Size(4000) == DedupTriggerDecision::SkippedInsufficientGrowth, "a shrunk gen2 is skipped");
+        Check(policy.OnGen2Size(4900) == DedupTriggerDecision::SkippedInsufficientGrowth, "growth is measured from the low point");
+        Check(policy.OnGen2Size(5000) == DedupTriggerDecision::Processed, "enough growth from the low point runs a pass");
+    }
+
+    if (failures == 0)
+    {
+        printf("all trigger policy checks passed\n");
+    }
+
+    return failures == 0 ? 0 : 1;
+}